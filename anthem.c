@@ -22,30 +22,44 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "freq.h"
+
 static const double R = 44100;        /* sample rate (samples per second) */
 static const double maxamp = 1.0;     /* max. amplitude */
 
-static double
-freq(int n)
+/* same sample to both channels, -DPCM_F32 writes floats like pcm.h */
+static void
+put_sample(double tone)
 {
-	double f;
-
-	f = pow(2.0, ((double)n - 49.0) / 12.0) * 440.0;
-	return f;
+#ifdef PCM_F32
+	float ftone = tone;
+
+	fwrite(&ftone, sizeof(float), 1, stdout);
+	fwrite(&ftone, sizeof(float), 1, stdout);
+#else
+	int16_t itone;
+
+	/* first channel */
+	itone = tone * INT16_MAX;
+	fwrite(&itone, sizeof(int16_t), 1, stdout);
+
+	/* second channel */
+	itone = tone * INT16_MAX;
+	fwrite(&itone, sizeof(int16_t), 1, stdout);
+#endif
 }
 
-
 static void
 play_note(int note, double duration, double loudness)
 {
 	int t, tmax;
+	double f = freq(note);
 
 	tmax = duration * R;
 	for (t=0; t<tmax; t++) {
 		double tone;
-		int16_t itone;
 
-		tone = sin(t * 2 * M_PI / R * freq(note));
+		tone = sin(t * 2 * M_PI / R * f);
 
 		tone *= loudness;
 
@@ -56,13 +70,7 @@ play_note(int note, double duration, double loudness)
 			tone = -maxamp;
 		}
 
-		 /* first channel */
-		itone = tone * INT16_MAX;
-		fwrite(&itone, sizeof(int16_t), 1, stdout);
-
-		/* second channel */
-		itone = tone * INT16_MAX;
-		fwrite(&itone, sizeof(int16_t), 1, stdout);
+		put_sample(tone);
 	}
 }
 
@@ -70,17 +78,20 @@ static void
 play_major_chord(int startnote, double duration, double loudness)
 {
 	int t, tmax;
+	double f1 = freq(startnote + 0);
+	double f2 = freq(startnote + 4);
+	double f3 = freq(startnote + 7);
+	double f4 = freq(startnote + 12);
 
 	tmax = duration * R;
 	for (t=0; t<tmax; t++) {
 		double tone1, tone2, tone3, tone4;
 		double tone;
-		int16_t itone;
 
-		tone1 = sin(t * 2 * M_PI / R * freq(startnote + 0));
-		tone2 = sin(t * 2 * M_PI / R * freq(startnote + 4));
-		tone3 = sin(t * 2 * M_PI / R * freq(startnote + 7));
-		tone4 = sin(t * 2 * M_PI / R * freq(startnote + 12));
+		tone1 = sin(t * 2 * M_PI / R * f1);
+		tone2 = sin(t * 2 * M_PI / R * f2);
+		tone3 = sin(t * 2 * M_PI / R * f3);
+		tone4 = sin(t * 2 * M_PI / R * f4);
 
 		tone = (tone1 + tone2 + tone3 + tone4) / 4.0 * loudness;
 
@@ -91,13 +102,7 @@ play_major_chord(int startnote, double duration, double loudness)
 			tone = -maxamp;
 		}
 
-		 /* first channel */
-		itone = tone * INT16_MAX;
-		fwrite(&itone, sizeof(int16_t), 1, stdout);
-
-		/* second channel */
-		itone = tone * INT16_MAX;
-		fwrite(&itone, sizeof(int16_t), 1, stdout);
+		put_sample(tone);
 	}
 }
 
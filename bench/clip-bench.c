@@ -0,0 +1,267 @@
+/*
+ * Clips: a drum loop of the same bar over and over rendered note by
+ * note, through the note cache and as a clip placed once a bar, next to
+ * a memcpy() of what comes out
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra -I.. clip-bench.c -o clip-bench -lm -pthread
+ * $ ./clip-bench [bars] [notes per bar] [runs]
+ *
+ * A bar is 2 seconds, drums decaying over half a second with a phase
+ * made of exp() and sin() a sample as those of drums.c, a third of them
+ * panned. Rows:
+ *   notes   every note of every bar added and rendered by the scheduler
+ *   cache   the same with timeline_cache()
+ *   clip    the notes of one bar in a clip, timeline_clip() every bar
+ *   memcpy  as much as the planes of the piece copied into fresh
+ *           memory, what rendering can not beat
+ * Columns: wall time of the fastest of the runs, ns per frame of the
+ * piece, times the memcpy() row. The clip is placed on whole frames, so
+ * the planes match those of the notes up to rounding, the max
+ * difference is printed.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timeline.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+#define BAR 88200                     /* frames in a bar */
+
+enum {NOTES, CACHE, CLIP, COPY, NROWS};
+
+static const char *rows[NROWS] = {"notes", "cache", "clip", "memcpy"};
+
+static void
+drum_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	size_t i;
+
+	(void)voice;
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
+
+		out[i] = exp(-t * 8)
+			* sin(2 * M_PI * t * ev->fr * exp(-t * 20));
+	}
+}
+
+static const struct tl_instr instr_drum = {&drum_render, 0, NULL, NULL};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* notes of one bar */
+static void
+bar(struct tl_event *ev, size_t n)
+{
+	uint32_t x = 1;
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		x = x * 1664525 + 1013904223;
+
+		memset(&ev[i], 0, sizeof(struct tl_event));
+		ev[i].instr = &instr_drum;
+		ev[i].start = BAR * i / n;
+		ev[i].len = R / 2;
+		ev[i].loudness = 0.1;
+		ev[i].fr = 60.0 + (x >> 8) % 400;
+		ev[i].pan = i % 3 ? 0.0 : (x >> 20) % 2 ? 0.5 : -0.5;
+	}
+}
+
+/* the loop rendered into a new timeline */
+static struct timeline *
+run(int row, const struct tl_event *ev, size_t n, size_t bars)
+{
+	struct timeline *tl, *clip = NULL;
+	size_t b, i;
+	int rc = 0;
+
+	tl = timeline_init(bars * BAR);
+	if (!tl) {
+		return NULL;
+	}
+
+	if (row == CLIP) {
+		clip = timeline_init(BAR);
+		if (!clip) {
+			timeline_free(tl);
+			return NULL;
+		}
+		for (i=0; (i<n) && (rc == 0); i++) {
+			rc = timeline_add(clip, &ev[i]);
+		}
+		for (b=0; (b<bars) && (rc == 0); b++) {
+			rc = timeline_clip(tl, clip, b * BAR, 1.0);
+		}
+	} else {
+		if (row == CACHE) {
+			timeline_cache(tl, 0);
+		}
+		for (b=0; (b<bars) && (rc == 0); b++) {
+			for (i=0; (i<n) && (rc == 0); i++) {
+				struct tl_event e = ev[i];
+
+				e.start += b * BAR;
+				rc = timeline_add(tl, &e);
+			}
+		}
+	}
+
+	if (rc == 0) {
+		rc = tl_render_pending(tl);
+	}
+	if (clip) {
+		timeline_free(clip);
+	}
+	if (rc != 0) {
+		timeline_free(tl);
+		return NULL;
+	}
+
+	return tl;
+}
+
+static volatile float sink;
+
+/* src copied into fresh memory, as much as the planes of the piece take */
+static int
+copy(const float *src, size_t frames)
+{
+	float *dst;
+
+	dst = malloc(frames * sizeof(float));
+	if (!dst) {
+		return -1;
+	}
+	memcpy(dst, src, frames * sizeof(float));
+	sink = dst[frames / 2];
+	free(dst);
+
+	return 0;
+}
+
+static double
+diff(struct timeline *a, struct timeline *b)
+{
+	float x[2 * TL_BLOCK], y[2 * TL_BLOCK];
+	double d = 0.0;
+	size_t t, i;
+
+	for (t=0; t<a->end; t+=TL_BLOCK) {
+		size_t n = a->end - t < TL_BLOCK ? a->end - t : TL_BLOCK;
+
+		timeline_read(a, x, t, n);
+		timeline_read(b, y, t, n);
+		for (i=0; i<n * 2; i++) {
+			if (fabs((double)x[i] - y[i]) > d) {
+				d = fabs((double)x[i] - y[i]);
+			}
+		}
+	}
+
+	return d;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timeline *notes, *clip;
+	struct tl_event *ev;
+	double best[NROWS], t;
+	size_t bars, n, frames;
+	float *src;
+	int r, row, runs;
+
+	bars = argc > 1 ? atol(argv[1]) : 60;
+	n = argc > 2 ? atol(argv[2]) : 16;
+	runs = argc > 3 ? atoi(argv[3]) : 3;
+	if (runs < 1) {
+		runs = 1;
+	}
+	if (n < 1) {
+		n = 1;
+	}
+
+	/* the tail of the last bar rings on */
+	frames = bars * BAR + R / 2;
+
+	ev = malloc(n * sizeof(struct tl_event));
+	/* mono bus and both sides */
+	src = malloc(frames * 3 * sizeof(float));
+	if (!ev || !src) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	bar(ev, n);
+	memset(src, 0, frames * 3 * sizeof(float));
+
+	for (row=0; row<NROWS; row++) {
+		best[row] = INFINITY;
+	}
+	/* every row gets fresh pages, a piece is rendered once */
+	for (r=0; r<runs; r++) {
+		for (row=0; row<NROWS; row++) {
+			struct timeline *tl = NULL;
+			int rc;
+
+			t = now();
+			if (row == COPY) {
+				rc = copy(src, frames * 3);
+			} else {
+				tl = run(row, ev, n, bars);
+				rc = tl ? 0 : -1;
+			}
+			t = now() - t;
+
+			if (rc != 0) {
+				fprintf(stderr, "%s: out of memory\n",
+					rows[row]);
+				return EXIT_FAILURE;
+			}
+			if (tl) {
+				timeline_free(tl);
+			}
+			best[row] = t < best[row] ? t : best[row];
+		}
+	}
+
+	notes = run(NOTES, ev, n, bars);
+	clip = run(CLIP, ev, n, bars);
+	if (!notes || !clip) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%lu bars of %lu notes, %.1f s\n", (unsigned long)bars,
+		(unsigned long)n, frames / R);
+	printf("%-7s %9s %8s %8s\n", "", "time", "ns/frm", "memcpy");
+	for (row=0; row<NROWS; row++) {
+		printf("%-7s %8.2fms %8.2f %7.1fx\n", rows[row],
+			best[row] * 1e3, best[row] * 1e9 / frames,
+			best[row] / best[COPY]);
+	}
+	printf("max diff %g\n", diff(notes, clip));
+
+	timeline_free(notes);
+	timeline_free(clip);
+	free(src);
+	free(ev);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+/*
+ * Denormals: long sustained Karplus-Strong notes fade into subnormal
+ * floats, render time per window of the note with and without the
+ * guards
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra -I.. denormal-bench.c -o denormal-bench -lm -pthread
+ * $ ./denormal-bench [seconds] [window seconds]
+ *
+ * ns per sample of one string, columns:
+ *   old     the string loop as it was before ks.h flushed, IEEE mode
+ *   old ftz the same between tl_fp_enter() and tl_fp_leave()
+ *   ks      one ks.h string, IEEE mode, it guards itself
+ *   ks ftz  one ks.h string the way the timeline renders it
+ *   set     a set of KS_LANES ks.h strings, IEEE mode
+ *   set ftz the set the way the timeline renders it
+ * and the peak of the old loop in the window, subnormal below -759 dB.
+ * High notes decay fastest, the default one gets there in under a
+ * minute.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timeline.h"
+#include "ks.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+#define FR 8000.0             /* single string */
+#define FR_SET 4000.0         /* lowest of the set, the others go up */
+
+enum {OLD, OLD_FTZ, KS, KS_FTZ, SET, SET_FTZ, NMODES};
+
+static const char *names[NMODES] = {"old", "old ftz", "ks", "ks ftz", "set",
+	"set ftz"};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ks_set_chunk1() as it used to be, nothing is flushed */
+static void
+old_chunk(struct ks_set *s, float *out, size_t n)
+{
+	float *line = s->line[0];
+	uint32_t pos = s->pos[0], delay = s->delay[0], mask = s->mask[0];
+	float c = s->c[0], x1 = s->x1[0], y1 = s->y1[0], prev = s->prev[0];
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		float x = line[(pos - delay) & mask], ap;
+
+		ap = c * (x - y1) + x1;
+		x1 = x;
+		y1 = ap;
+		prev = (ap + prev) * KS_GAIN;
+		line[pos & mask] = prev;
+		out[i] = prev;
+		pos++;
+	}
+
+	s->pos[0] = pos;
+	s->x1[0] = x1;
+	s->y1[0] = y1;
+	s->prev[0] = prev;
+	s->next += n;
+}
+
+/* n samples of a mode starting at off, seconds it took and the peak */
+static double
+run(int mode, struct ks_set *s, size_t off, size_t n, float *peak)
+{
+	float out[KS_CHUNK];
+	unsigned long fp = 0;
+	double t0;
+	size_t i, j;
+
+	if (mode & 1) {
+		fp = tl_fp_enter();
+	}
+
+	t0 = now();
+	for (i=0; i<n; i+=KS_CHUNK) {
+		size_t m = n - i < KS_CHUNK ? n - i : KS_CHUNK;
+
+		if (mode <= OLD_FTZ) {
+			old_chunk(s, out, m);
+		} else {
+			ks_set_render(s, out, off + i, m);
+		}
+		for (j=0; j<m; j++) {
+			if (fabsf(out[j]) > *peak) {
+				*peak = fabsf(out[j]);
+			}
+		}
+	}
+	t0 = now() - t0;
+
+	if (mode & 1) {
+		tl_fp_leave(fp);
+	}
+
+	return t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct ks_set sets[NMODES];
+	double worst[NMODES], first[NMODES];
+	size_t len, win, off;
+	int m, j;
+
+	len = (argc > 1 ? atof(argv[1]) : 90.0) * R;
+	win = (argc > 2 ? atof(argv[2]) : 5.0) * R;
+	if (win == 0) {
+		win = R;
+	}
+
+	memset(sets, 0, sizeof(sets));
+	for (m=0; m<NMODES; m++) {
+		int nstrings = m >= SET ? KS_LANES : 1;
+
+		/* the same seeds, so every mode renders the same strings */
+		for (j=0; j<nstrings; j++) {
+			double fr = nstrings > 1 ? FR_SET * (1.0 + j / 8.0) : FR;
+
+			if (ks_string(&sets[m], R / fr, 0, len, j + 1) != 0) {
+				fprintf(stderr, "can not make a string\n");
+				return EXIT_FAILURE;
+			}
+		}
+		worst[m] = 0.0;
+	}
+
+	printf("%7s", "time");
+	for (m=0; m<NMODES; m++) {
+		printf(" %8s", names[m]);
+	}
+	printf(" %9s\n", "old peak");
+
+	for (off=0; off<len; off+=win) {
+		size_t n = len - off < win ? len - off : win;
+		float peak = 0.0f, skip = 0.0f;
+
+		printf("%6.0fs", off / R);
+		for (m=0; m<NMODES; m++) {
+			int nstrings = m >= SET ? KS_LANES : 1;
+			double ns;
+
+			ns = run(m, &sets[m], off, n, m == OLD ? &peak : &skip)
+				* 1e9 / n / nstrings;
+			if (off == 0) {
+				first[m] = ns;
+			}
+			if (ns > worst[m]) {
+				worst[m] = ns;
+			}
+			printf(" %8.1f", ns);
+		}
+		printf(" %6.0f dB\n", peak > 0.0f ? 20.0 * log10(peak)
+			: -INFINITY);
+	}
+
+	printf("%7s", "worst/1");
+	for (m=0; m<NMODES; m++) {
+		printf(" %7.1fx", worst[m] / first[m]);
+	}
+	printf("\n");
+
+	for (m=0; m<NMODES; m++) {
+		ks_set_release(&sets[m]);
+	}
+	ks_pool_free();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+/*
+ * Instrument expressions: compiled C vs the expr.h interpreter, speed
+ * and difference of the float output
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra -I.. expr-bench.c -o expr-bench -lm
+ * $ ./expr-bench [seconds per expression]
+ *
+ * Every expression is written once, the macro makes both the compiled
+ * calc_tone() and the text the interpreter gets. Both render notes in
+ * blocks of TL_BLOCK samples like the timeline asks for them. Integer
+ * division (octave) has to come out as C does it.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "expr.h"
+
+#define BLOCK 1024
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+#define TONE(name, ...) \
+	static double name(double t, int note) \
+	{ \
+		double tone; \
+		__VA_ARGS__ \
+		return tone; \
+	} \
+	static const char *const name##_src = #__VA_ARGS__;
+
+TONE(sine,
+	tone = sin(t * 2 * M_PI * freq(note));
+)
+
+TONE(piano,
+	double k = t * 2 * M_PI * freq(note);
+	tone = sin(k) * exp(-0.0004 * k);
+	tone += sin(2 * k) * exp(-0.0004 * k) / 2;
+	tone += sin(3 * k) * exp(-0.0004 * k) / 4;
+	tone += sin(4 * k) * exp(-0.0004 * k) / 8;
+	tone += sin(5 * k) * exp(-0.0004 * k) / 16;
+	tone += sin(6 * k) * exp(-0.0004 * k) / 32;
+	tone += tone * tone * tone;
+)
+
+TONE(fm,
+	double w = t * 2 * M_PI * freq(note);
+	tone = sin(w + 2 * sin(w * 3) * exp(-4 * t)) * exp(-2 * t);
+)
+
+TONE(saw,
+	double x = 2 * fmod(t * freq(note), 1) - 1;
+	tone = x * (1 - x * x / 3) * 0.8;
+)
+
+/* ints divide as ints, -44 / 7 is -6 */
+TONE(octave,
+	tone = 1 + note / 12;
+	tone *= sin(t * 2 * M_PI * freq(note / 12 * 12 + 4)) / 8;
+	tone += (note - 60) / 7 * 0.01 + 1 / 2 + 3.0 / 2;
+)
+
+static const struct
+{
+	const char *name;
+	double (*calc)(double t, int note);
+	const char *const *src;
+} cases[] = {
+	{"sine", &sine, &sine_src},
+	{"piano", &piano, &piano_src},
+	{"fm", &fm, &fm_src},
+	{"saw", &saw, &saw_src},
+	{"octave", &octave, &octave_src},
+};
+
+#define NCASES (sizeof(cases) / sizeof(cases[0]))
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int notes[] = {16, 40, 49, 64};
+	size_t nnotes = sizeof(notes) / sizeof(notes[0]);
+	size_t n, c, i, j, off;
+	float *ref, *out;
+	double worst = 0.0;
+	volatile double sink = 0.0;
+
+	n = (argc > 1 ? atof(argv[1]) : 10.0) * R;
+
+	ref = malloc(n * sizeof(float));
+	out = malloc(n * sizeof(float));
+	if (!ref || !out) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-8s %5s %5s %14s %14s %7s %10s %9s\n", "tone", "uni",
+		"ops", "compiled/s", "interp/s", "slower", "max diff",
+		"differ");
+	for (c=0; c<NCASES; c++) {
+		struct expr *e;
+		char err[256];
+		double t_cc = 0.0, t_ex = 0.0, t0, diff = 0.0;
+		size_t differ = 0;
+
+		e = expr_compile(*cases[c].src, err, sizeof(err));
+		if (!e) {
+			fprintf(stderr, "%s: %s\n", cases[c].name, err);
+			return EXIT_FAILURE;
+		}
+
+		for (j=0; j<nnotes; j++) {
+			t0 = now();
+			for (off=0; off<n; off+=BLOCK) {
+				size_t m = n - off < BLOCK ? n - off : BLOCK;
+
+				for (i=0; i<m; i++) {
+					ref[off + i] = cases[c].calc(
+						(off + i) / R, notes[j]);
+				}
+			}
+			t_cc += now() - t0;
+
+			t0 = now();
+			for (off=0; off<n; off+=BLOCK) {
+				size_t m = n - off < BLOCK ? n - off : BLOCK;
+
+				expr_eval(e, notes[j], 0, out + off, off, m);
+			}
+			t_ex += now() - t0;
+
+			for (i=0; i<n; i++) {
+				double d = fabs((double)ref[i] - out[i]);
+
+				if (d > diff) {
+					diff = d;
+				}
+				differ += ref[i] != out[i];
+				sink += out[i];
+			}
+		}
+		if (diff > worst) {
+			worst = diff;
+		}
+
+		printf("%-8s %5lu %5lu %14.0f %14.0f %6.2fx %10.3g %9lu\n",
+			cases[c].name, (unsigned long)e->nuni,
+			(unsigned long)e->nvar, n * nnotes / t_cc,
+			n * nnotes / t_ex, t_ex / t_cc, diff,
+			(unsigned long)differ);
+
+		expr_free(e);
+	}
+	printf("samples per second, %lu notes of %.1f s each, max diff %g\n",
+		(unsigned long)nnotes, n / R, worst);
+
+	free(out);
+	free(ref);
+
+	return EXIT_SUCCESS;
+}
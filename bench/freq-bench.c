@@ -0,0 +1,146 @@
+/*
+ * Chord path of anthem.c: four freq() calls with pow() per sample vs
+ * pitches resolved once per chord from the table in freq.h, plus
+ * accuracy of the table and of fractional notes
+ *
+ * $ cc -O3 -Wall -pedantic -Wextra -I.. freq-bench.c -o freq-bench -lm
+ * $ ./freq-bench [seconds of chords]
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freq.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* freq() as it used to be */
+static double
+freq_pow(int n)
+{
+	double f;
+
+	f = pow(2.0, ((double)n - 49.0) / 12.0) * 440.0;
+	return f;
+}
+
+/* play_major_chord() as it used to be, without the output */
+static void
+chord_pow(int startnote, double *out, int tmax)
+{
+	int t;
+
+	for (t=0; t<tmax; t++) {
+		double tone1, tone2, tone3, tone4;
+
+		tone1 = sin(t * 2 * M_PI / R * freq_pow(startnote + 0));
+		tone2 = sin(t * 2 * M_PI / R * freq_pow(startnote + 4));
+		tone3 = sin(t * 2 * M_PI / R * freq_pow(startnote + 7));
+		tone4 = sin(t * 2 * M_PI / R * freq_pow(startnote + 12));
+
+		out[t] = (tone1 + tone2 + tone3 + tone4) / 4.0;
+	}
+}
+
+static void
+chord_table(int startnote, double *out, int tmax)
+{
+	int t;
+	double f1 = freq(startnote + 0);
+	double f2 = freq(startnote + 4);
+	double f3 = freq(startnote + 7);
+	double f4 = freq(startnote + 12);
+
+	for (t=0; t<tmax; t++) {
+		double tone1, tone2, tone3, tone4;
+
+		tone1 = sin(t * 2 * M_PI / R * f1);
+		tone2 = sin(t * 2 * M_PI / R * f2);
+		tone3 = sin(t * 2 * M_PI / R * f3);
+		tone4 = sin(t * 2 * M_PI / R * f4);
+
+		out[t] = (tone1 + tone2 + tone3 + tone4) / 4.0;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int chords[] = {33, 37, 40, 42, 45, 49};
+	size_t nchords = sizeof(chords) / sizeof(chords[0]);
+	int tmax, n;
+	size_t i;
+	double *ref, *out;
+	double t0, t_old = 0.0, t_new = 0.0, err = 0.0, x;
+	volatile double sink = 0.0;
+
+	tmax = (argc > 1 ? atof(argv[1]) : 20.0) * R / nchords;
+
+	ref = malloc(tmax * sizeof(double));
+	out = malloc(tmax * sizeof(double));
+	if (!ref || !out) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	for (n=-40; n<200; n++) {
+		if (freq(n) != freq_pow(n)) {
+			fprintf(stderr, "table differs from pow() for note %d\n",
+				n);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i=0; i<nchords; i++) {
+		t0 = now();
+		chord_pow(chords[i], ref, tmax);
+		t_old += now() - t0;
+
+		t0 = now();
+		chord_table(chords[i], out, tmax);
+		t_new += now() - t0;
+
+		if (memcmp(ref, out, tmax * sizeof(double)) != 0) {
+			fprintf(stderr, "chord %d differs\n", chords[i]);
+			return EXIT_FAILURE;
+		}
+		sink += out[tmax - 1];
+	}
+
+	/* fractional notes against pow() */
+	for (x=FREQ_MIN; x<FREQ_MAX + 1; x+=0.001) {
+		double d = fabs(freq_frac(x) / (pow(2.0, (x - 49.0) / 12.0)
+			* 440.0) - 1.0);
+
+		if (d > err) {
+			err = d;
+		}
+	}
+
+	printf("samples:       %lu\n", (unsigned long)(tmax * nchords));
+	printf("pow per sample: %8.3f s, %12.0f samples/s\n",
+		t_old, tmax * nchords / t_old);
+	printf("table, hoisted: %8.3f s, %12.0f samples/s\n",
+		t_new, tmax * nchords / t_new);
+	printf("speedup:        %8.1fx\n", t_old / t_new);
+	printf("freq_frac() max relative error: %g (%g cent)\n",
+		err, 1200.0 * log2(1.0 + err));
+
+	free(out);
+	free(ref);
+
+	return EXIT_SUCCESS;
+}
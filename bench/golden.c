@@ -0,0 +1,585 @@
+/*
+ * Golden-audio regression check
+ *
+ * Builds every piece with -DPCM_F32, so it writes floats before
+ * quantization, renders it and compares the result with a stored
+ * reference render. For each channel it reports SNR, max absolute error
+ * and the first sample that differs, the same for the worst time window,
+ * and all windows with -v.
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra golden.c -o golden -lm
+ *
+ * on a known good tree, store the references:
+ * $ ./golden -u
+ * after a change, compare:
+ * $ ./golden [piece ...]
+ *
+ * options:
+ *   -s dir      sources, .. by default
+ *   -g dir      reference renders, golden by default (name.f32 each)
+ *   -u          write references instead of comparing
+ *   -w seconds  window length (1.0)
+ *   -c          clamp both to [-1, 1] first, as S16 output does
+ *   -T path=snr,err  threshold of a fast path, e.g. -T piano=90,1e-4
+ *   -v          print every window
+ *
+ * Every piece lists the fast paths it goes through. A piece passes when
+ * both channels have SNR and max error within the loosest budget of its
+ * paths, so an approximate kernel can go in with its accuracy measured
+ * and its budget set with -T. Budgets can also be kept in dir/thresholds,
+ * one "path snr err" per line.
+ *
+ * Pieces are built with $CC (cc) and $CFLAGS (-O2), environment is passed
+ * on, so TL_THREADS, TL_CACHE_MB etc. can be checked too. Exit status is
+ * 1 if any piece fails.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+static int clamp = 0;
+
+struct path
+{
+	const char *name;
+	double snr;     /* dB, at least */
+	double err;     /* max absolute error, at most */
+};
+
+/*
+ *   mix    timeline.h mixing and the note cache
+ *   piano  osc_piano()
+ *   osc    osc_sin() and osc_exp()
+ *   ks     ks.h strings
+ *   sin    sin() per sample, anthem.c
+ */
+static struct path paths[] = {
+	{"mix",   120.0, 1e-6},
+	{"piano", 100.0, 1e-5},
+	{"osc",   100.0, 1e-5},
+	{"ks",     90.0, 1e-4},
+	{"sin",   120.0, 1e-6},
+};
+
+#define NPATHS (sizeof(paths) / sizeof(paths[0]))
+
+struct piece
+{
+	const char *name;
+	const char *arg;    /* seed or NULL */
+	const char *paths;  /* comma separated */
+};
+
+static const struct piece pieces[] = {
+	{"anthem", NULL, "sin"},
+	{"anthem2", NULL, "mix,piano"},
+	{"overdrive", NULL, "mix,piano,osc"},
+	{"drums", NULL, "mix,osc"},
+	{"drums-piano", NULL, "mix,piano,osc"},
+	{"karplus-strong1", NULL, "mix,ks"},
+	{"random-rhythm", "1", "mix,osc,ks"},
+	{"random-cons", "12345", "mix,piano"},
+	{"random-cons8", "17", "mix,piano"},
+};
+
+#define NPIECES (sizeof(pieces) / sizeof(pieces[0]))
+
+struct diff
+{
+	double sig, noise;   /* sums of squares */
+	double max;
+	size_t first;        /* frame, SIZE_MAX if none */
+};
+
+static struct path *
+path_find(const char *name, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<NPATHS; i++) {
+		if ((strlen(paths[i].name) == len)
+			&& (strncmp(paths[i].name, name, len) == 0)) {
+
+			return &paths[i];
+		}
+	}
+	return NULL;
+}
+
+/* "path=snr,err" */
+static int
+path_set(const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	struct path *p;
+	double snr, err;
+
+	if (!eq || (sscanf(eq + 1, "%lf,%lf", &snr, &err) != 2)) {
+		return -1;
+	}
+	p = path_find(arg, eq - arg);
+	if (!p) {
+		return -1;
+	}
+	p->snr = snr;
+	p->err = err;
+
+	return 0;
+}
+
+static void
+paths_load(const char *dir)
+{
+	char file[4096], line[256], name[64];
+	FILE *f;
+
+	snprintf(file, sizeof(file), "%s/thresholds", dir);
+	f = fopen(file, "r");
+	if (!f) {
+		return;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		struct path *p;
+		double snr, err;
+
+		if ((line[0] == '#')
+			|| (sscanf(line, "%63s %lf %lf", name, &snr, &err) != 3)) {
+
+			continue;
+		}
+		p = path_find(name, strlen(name));
+		if (!p) {
+			fprintf(stderr, "%s: unknown path %s\n", file, name);
+			continue;
+		}
+		p->snr = snr;
+		p->err = err;
+	}
+	fclose(f);
+}
+
+/* loosest budget of the paths a piece goes through */
+static void
+budget(const struct piece *pc, double *snr, double *err)
+{
+	const char *s = pc->paths;
+
+	*snr = INFINITY;
+	*err = 0.0;
+	while (*s) {
+		size_t len = strcspn(s, ",");
+		struct path *p = path_find(s, len);
+
+		if (p) {
+			if (p->snr < *snr) {
+				*snr = p->snr;
+			}
+			if (p->err > *err) {
+				*err = p->err;
+			}
+		}
+		s += len;
+		if (*s == ',') {
+			s++;
+		}
+	}
+}
+
+static int
+build(const char *src, const char *dir, const char *name)
+{
+	const char *cc = getenv("CC"), *cflags = getenv("CFLAGS");
+	char cmd[4096];
+
+	snprintf(cmd, sizeof(cmd), "%s %s -DPCM_F32 -I%s %s/%s.c -o %s/%s "
+		"-lm -pthread", cc ? cc : "cc", cflags ? cflags : "-O2",
+		src, src, name, dir, name);
+
+	return system(cmd) == 0 ? 0 : -1;
+}
+
+/* whole stdout of a run in the source directory, *n is in frames */
+static float *
+render(const char *path, const char *src, const char *arg, size_t *n)
+{
+	char *buf = NULL;
+	size_t size = 0, cap = 0;
+	int fd[2], status;
+	pid_t pid;
+
+	if (pipe(fd) != 0) {
+		return NULL;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		close(fd[0]);
+		close(fd[1]);
+		return NULL;
+	}
+
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+
+		dup2(fd[1], 1);
+		if (null >= 0) {
+			dup2(null, 2);
+		}
+		close(fd[0]);
+		close(fd[1]);
+
+		/* scores are read from there */
+		if (chdir(src) != 0) {
+			_exit(127);
+		}
+		execl(path, path, arg, (char *)NULL);
+		_exit(127);
+	}
+
+	close(fd[1]);
+	for (;;) {
+		ssize_t r;
+
+		if (cap - size < (1 << 16)) {
+			char *tmp;
+
+			cap = cap ? cap * 2 : (1 << 20);
+			tmp = realloc(buf, cap);
+			if (!tmp) {
+				goto fail_read;
+			}
+			buf = tmp;
+		}
+
+		r = read(fd[0], buf + size, cap - size);
+		if (r == 0) {
+			break;
+		} else if (r > 0) {
+			size += r;
+		}
+	}
+	close(fd[0]);
+
+	if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status)
+		|| (WEXITSTATUS(status) != 0)) {
+
+		free(buf);
+		return NULL;
+	}
+
+	*n = size / (2 * sizeof(float));
+	return (float *)buf;
+
+fail_read:
+	close(fd[0]);
+	waitpid(pid, &status, 0);
+	free(buf);
+	return NULL;
+}
+
+static float *
+load(const char *file, size_t *n)
+{
+	FILE *f;
+	long size;
+	float *buf = NULL;
+
+	f = fopen(file, "rb");
+	if (!f) {
+		return NULL;
+	}
+	if ((fseek(f, 0, SEEK_END) != 0) || ((size = ftell(f)) < 0)) {
+		goto fail;
+	}
+	rewind(f);
+
+	buf = malloc(size ? size : 1);
+	if (!buf) {
+		goto fail;
+	}
+	if (fread(buf, 1, size, f) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+		goto fail;
+	}
+	*n = size / (2 * sizeof(float));
+
+fail:
+	fclose(f);
+	return buf;
+}
+
+static int
+save(const char *file, const float *buf, size_t n)
+{
+	FILE *f;
+	int rc = 0;
+
+	f = fopen(file, "wb");
+	if (!f) {
+		return -1;
+	}
+	if (fwrite(buf, 2 * sizeof(float), n, f) != n) {
+		rc = -1;
+	}
+	if (fclose(f) != 0) {
+		rc = -1;
+	}
+	return rc;
+}
+
+/* channel ch of frames from .. to - 1 */
+static void
+compare(const float *out, const float *ref, int ch, size_t from, size_t to,
+	struct diff *d)
+{
+	size_t i;
+
+	d->sig = d->noise = d->max = 0.0;
+	d->first = SIZE_MAX;
+
+	for (i=from; i<to; i++) {
+		double r = ref[i * 2 + ch], o = out[i * 2 + ch], e;
+
+		if (clamp) {
+			r = r > 1.0 ? 1.0 : (r < -1.0 ? -1.0 : r);
+			o = o > 1.0 ? 1.0 : (o < -1.0 ? -1.0 : o);
+		}
+		e = o - r;
+
+		d->sig += r * r;
+		d->noise += e * e;
+		if (fabs(e) > d->max) {
+			d->max = fabs(e);
+		}
+		if ((e != 0.0) && (d->first == SIZE_MAX)) {
+			d->first = i;
+		}
+	}
+}
+
+static double
+snr(const struct diff *d)
+{
+	if (d->noise == 0.0) {
+		return INFINITY;
+	}
+	if (d->sig == 0.0) {
+		return -INFINITY;
+	}
+	return 10.0 * log10(d->sig / d->noise);
+}
+
+static void
+print_diff(const char *what, const struct diff *d)
+{
+	printf("    %-6s snr %7.1f dB  max err %.3g", what, snr(d), d->max);
+	if (d->first != SIZE_MAX) {
+		printf("  first diff %lu (%.3f s)", (unsigned long)d->first,
+			d->first / R);
+	}
+	printf("\n");
+}
+
+/* 0 if within the budget */
+static int
+check(const struct piece *pc, const float *out, size_t n, const float *ref,
+	size_t nref, double window, int verbose)
+{
+	static const char *chname[2] = {"left", "right"};
+	size_t w, wlen, nwin, len = n < nref ? n : nref;
+	double bsnr, berr;
+	int ch, fail = 0;
+
+	budget(pc, &bsnr, &berr);
+	printf("%s: %lu frames, paths %s, budget %.1f dB %.3g\n", pc->name,
+		(unsigned long)n, pc->paths, bsnr, berr);
+
+	if (n != nref) {
+		printf("    length differs, reference has %lu frames\n",
+			(unsigned long)nref);
+		fail = 1;
+	}
+
+	wlen = window * R;
+	if (wlen == 0) {
+		wlen = 1;
+	}
+	nwin = (len + wlen - 1) / wlen;
+
+	for (ch=0; ch<2; ch++) {
+		struct diff all, d, worst;
+		size_t worst_w = 0;
+
+		compare(out, ref, ch, 0, len, &all);
+		print_diff(chname[ch], &all);
+		if ((snr(&all) < bsnr) || (all.max > berr)) {
+			fail = 1;
+		}
+
+		worst.max = -1.0;
+		for (w=0; w<nwin; w++) {
+			size_t to = (w + 1) * wlen < len ? (w + 1) * wlen : len;
+
+			compare(out, ref, ch, w * wlen, to, &d);
+			if (verbose) {
+				char name[32];
+
+				snprintf(name, sizeof(name), "  %lu",
+					(unsigned long)w);
+				print_diff(name, &d);
+			}
+			if (d.max > worst.max) {
+				worst = d;
+				worst_w = w;
+			}
+		}
+		if ((nwin > 1) && (worst.max > 0.0)) {
+			printf("    worst window %lu [%.3f s, %.3f s):\n",
+				(unsigned long)worst_w, worst_w * wlen / R,
+				(worst_w + 1) * wlen / R);
+			print_diff(chname[ch], &worst);
+		}
+	}
+
+	printf("    %s\n", fail ? "FAIL" : "ok");
+	return fail;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *src = "..", *gold = "golden";
+	char dir[] = "/tmp/golden-XXXXXX";
+	double window = 1.0;
+	int update = 0, verbose = 0, failed = 0;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:g:uw:cT:v")) != -1) {
+		switch (opt) {
+		case 's':
+			src = optarg;
+			break;
+		case 'g':
+			gold = optarg;
+			break;
+		case 'u':
+			update = 1;
+			break;
+		case 'w':
+			window = atof(optarg);
+			break;
+		case 'c':
+			clamp = 1;
+			break;
+		case 'T':
+			/* after the thresholds file, see below */
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	paths_load(gold);
+	optind = 1;
+	while ((opt = getopt(argc, argv, "s:g:uw:cT:v")) != -1) {
+		if ((opt == 'T') && (path_set(optarg) != 0)) {
+			fprintf(stderr, "bad threshold '%s'\n", optarg);
+			goto usage;
+		}
+	}
+
+	if (update && (mkdir(gold, 0777) != 0) && (access(gold, W_OK) != 0)) {
+		perror(gold);
+		return EXIT_FAILURE;
+	}
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	for (i=0; i<NPIECES; i++) {
+		const struct piece *pc = &pieces[i];
+		char path[4096], file[4096];
+		float *out, *ref;
+		size_t n, nref;
+		int k;
+
+		/* only the pieces named on the command line, if any */
+		for (k=optind; k<argc; k++) {
+			if (strcmp(argv[k], pc->name) == 0) {
+				break;
+			}
+		}
+		if ((optind < argc) && (k == argc)) {
+			continue;
+		}
+
+		if (build(src, dir, pc->name) != 0) {
+			fprintf(stderr, "%s: build failed\n", pc->name);
+			failed++;
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/%s", dir, pc->name);
+		out = render(path, src, pc->arg, &n);
+		unlink(path);
+		if (!out) {
+			fprintf(stderr, "%s: run failed\n", pc->name);
+			failed++;
+			continue;
+		}
+
+		snprintf(file, sizeof(file), "%s/%s.f32", gold, pc->name);
+		if (update) {
+			if (save(file, out, n) != 0) {
+				perror(file);
+				failed++;
+			} else {
+				printf("%s: %lu frames\n", pc->name,
+					(unsigned long)n);
+			}
+			free(out);
+			continue;
+		}
+
+		ref = load(file, &nref);
+		if (!ref) {
+			fprintf(stderr, "%s: no reference, run with -u\n",
+				file);
+			failed++;
+			free(out);
+			continue;
+		}
+
+		failed += check(pc, out, n, ref, nref, window, verbose);
+
+		free(ref);
+		free(out);
+	}
+	rmdir(dir);
+
+	return failed ? 1 : EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s [-s dir] [-g dir] [-u] [-w seconds] [-c] "
+		"[-T path=snr,err] [-v] [piece ...]\n", argv[0]);
+	return EXIT_FAILURE;
+}
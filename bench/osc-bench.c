@@ -0,0 +1,114 @@
+/*
+ * Piano tone: sin()/exp() per sample vs phasor oscillator from osc.h,
+ * accuracy and speed per voice
+ *
+ * $ cc -O3 -Wall -pedantic -Wextra -I.. osc-bench.c -o osc-bench -lm
+ * $ ./osc-bench [seconds per note]
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "osc.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* instr_piano() as it used to be */
+static double
+instr_piano(double t, double fr)
+{
+	double tone;
+
+	t *= 2.0 * M_PI * fr;
+
+	tone = sin(t) * exp(-0.0004 * t);
+
+	tone += sin(2.0 * t) * exp(-0.0004 * t) / 2.0;
+	tone += sin(3.0 * t) * exp(-0.0004 * t) / 4.0;
+	tone += sin(4.0 * t) * exp(-0.0004 * t) / 8.0;
+	tone += sin(5.0 * t) * exp(-0.0004 * t) / 16.0;
+	tone += sin(6.0 * t) * exp(-0.0004 * t) / 32.0;
+
+	tone += tone * tone * tone;
+	return tone;
+}
+
+int
+main(int argc, char *argv[])
+{
+	double frs[] = {27.5, 110.0, 261.63, 440.0, 1760.0, 4186.0};
+	size_t nfr = sizeof(frs) / sizeof(frs[0]);
+	size_t n, i, j;
+	double *ref;
+	float *out;
+	double t_old = 0.0, t_new = 0.0, maxerr = 0.0;
+	volatile double sink = 0.0;
+
+	n = (argc > 1 ? atof(argv[1]) : 100.0) * R;
+
+	ref = malloc(n * sizeof(double));
+	out = malloc(n * sizeof(float));
+	if (!ref || !out) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%10s %14s\n", "freq", "max error");
+	for (j=0; j<nfr; j++) {
+		struct osc_piano p = {0};
+		double w = 2.0 * M_PI * frs[j] / R;
+		double t0, err = 0.0;
+
+		t0 = now();
+		for (i=0; i<n; i++) {
+			ref[i] = instr_piano(i / R, frs[j]);
+		}
+		t_old += now() - t0;
+
+		t0 = now();
+		/* uneven blocks on purpose */
+		for (i=0; i<n; i+=1000) {
+			osc_piano(&p, w, out + i, i, n - i < 1000 ? n - i : 1000);
+		}
+		t_new += now() - t0;
+
+		/* out[] is float, compare in double against a fresh render */
+		for (i=0; i<n; i++) {
+			double d = fabs(ref[i] - out[i]);
+
+			if (d > err) {
+				err = d;
+			}
+			sink += out[i];
+		}
+		if (err > maxerr) {
+			maxerr = err;
+		}
+		printf("%10.2f %14.3g\n", frs[j], err);
+	}
+
+	printf("sin/exp:  %8.3f s, %12.0f samples/s per voice\n",
+		t_old, n * nfr / t_old);
+	printf("phasor:   %8.3f s, %12.0f samples/s per voice\n",
+		t_new, n * nfr / t_new);
+	printf("speedup:  %8.1fx\n", t_old / t_new);
+	printf("max error (float output, includes float rounding): %g\n",
+		maxerr);
+
+	free(out);
+	free(ref);
+
+	return EXIT_SUCCESS;
+}
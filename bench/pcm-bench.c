@@ -0,0 +1,132 @@
+/*
+ * Output stage throughput: old per-sample fwrite() loop vs block writer
+ *
+ * $ cc -O3 -Wall -pedantic -Wextra -I.. pcm-bench.c -o pcm-bench -lm
+ * $ cc -O3 -mavx2 -Wall -pedantic -Wextra -I.. pcm-bench.c -o pcm-bench -lm
+ * $ ./pcm-bench [seconds of audio]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "pcm.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+static const double maxamp = 1.0;     /* max. amplitude */
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* timeline_play() as it used to be */
+static void
+play_fwrite(FILE *f, float *left, float *right, size_t n)
+{
+	size_t t;
+	for (t=0; t<n; t++) {
+		int16_t tone;
+
+		if (left[t] > maxamp) {
+			tone = INT16_MAX;
+		} else if (left[t] < -maxamp) {
+			tone = -INT16_MAX;
+		} else {
+			tone = left[t] * INT16_MAX;
+		}
+		fwrite(&tone, sizeof(int16_t), 1, f);
+
+		if (right[t] > maxamp) {
+			tone = INT16_MAX;
+		} else if (right[t] < -maxamp) {
+			tone = -INT16_MAX;
+		} else {
+			tone = right[t] * INT16_MAX;
+		}
+		fwrite(&tone, sizeof(int16_t), 1, f);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t n, i;
+	float *left, *right;
+	int16_t *ref, *out;
+	double t0, t1, t_old, t_new;
+	FILE *devnull;
+	struct pcm_writer *w;
+
+	n = (argc > 1 ? atof(argv[1]) : 100.0) * R;
+
+	left = malloc(n * sizeof(float));
+	right = malloc(n * sizeof(float));
+	ref = malloc(n * 2 * sizeof(int16_t));
+	out = malloc(n * 2 * sizeof(int16_t));
+	w = malloc(sizeof(struct pcm_writer));
+	devnull = fopen("/dev/null", "w");
+	if (!left || !right || !ref || !out || !w || !devnull) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	/* a bit louder than full scale so clipping is exercised */
+	srand(1);
+	for (i=0; i<n; i++) {
+		left[i] = ((double)rand() / RAND_MAX - 0.5) * 2.4;
+		right[i] = ((double)rand() / RAND_MAX - 0.5) * 2.4;
+	}
+
+	/* both paths must produce the same bytes */
+	for (i=0; i<n; i++) {
+		ref[i * 2 + 0] = pcm_sample(left[i]);
+		ref[i * 2 + 1] = pcm_sample(right[i]);
+	}
+	pcm_convert(out, left, right, n);
+	if (memcmp(ref, out, n * 2 * sizeof(int16_t)) != 0) {
+		fprintf(stderr, "block conversion differs from scalar\n");
+		return EXIT_FAILURE;
+	}
+
+	t0 = now();
+	play_fwrite(devnull, left, right, n);
+	fflush(devnull);
+	t1 = now();
+	t_old = t1 - t0;
+
+	t0 = now();
+	pcm_writer_init(w, fileno(devnull));
+	pcm_writer_put(w, left, right, n);
+	pcm_writer_flush(w);
+	t1 = now();
+	t_new = t1 - t0;
+
+#if defined(__AVX2__)
+	printf("block writer: AVX2\n");
+#elif defined(__SSE2__)
+	printf("block writer: SSE2\n");
+#else
+	printf("block writer: scalar\n");
+#endif
+	printf("frames:       %lu (%.1f s of audio)\n", (unsigned long)n, n / R);
+	printf("fwrite loop:  %8.3f s, %12.0f frames/s\n", t_old, n / t_old);
+	printf("block writer: %8.3f s, %12.0f frames/s\n", t_new, n / t_new);
+	printf("speedup:      %8.1fx\n", t_old / t_new);
+
+	fclose(devnull);
+	free(w);
+	free(out);
+	free(ref);
+	free(right);
+	free(left);
+
+	return EXIT_SUCCESS;
+}
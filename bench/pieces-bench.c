@@ -0,0 +1,323 @@
+/*
+ * Builds every piece, renders it into a null sink and reports wall time,
+ * CPU time, samples (per channel) per second, realtime factor and peak
+ * RSS as JSON.
+ * With -c the run is compared against a stored one and pieces that got
+ * slower than the tolerance are flagged, exit status is 1 then.
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra pieces-bench.c -o pieces-bench
+ * $ ./pieces-bench > baseline.json
+ * $ ./pieces-bench -c baseline.json
+ *
+ * options:
+ *   -s dir      sources, .. by default
+ *   -n runs     runs per piece, the fastest counts (5)
+ *   -c file     baseline to compare with
+ *   -t percent  slowdown tolerated before it is a regression (10)
+ *
+ * Pieces are built with $CC (cc) and $CFLAGS (-O2) into a temporary
+ * directory. Random pieces get fixed seeds.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+struct piece
+{
+	const char *name;
+	const char *arg;    /* seed or NULL */
+};
+
+static const struct piece pieces[] = {
+	{"anthem", NULL},
+	{"anthem2", NULL},
+	{"overdrive", NULL},
+	{"drums", NULL},
+	{"drums-piano", NULL},
+	{"karplus-strong1", NULL},
+	{"random-rhythm", "1"},
+	{"random-cons", "12345"},
+	{"random-cons8", "17"},
+};
+
+#define NPIECES (sizeof(pieces) / sizeof(pieces[0]))
+
+struct result
+{
+	double wall, cpu;
+	size_t frames;
+	long rss;       /* KiB */
+	int ok;
+
+	/* from the baseline */
+	double base_wall;
+	int in_base;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+build(const char *src, const char *dir, const char *name)
+{
+	const char *cc = getenv("CC"), *cflags = getenv("CFLAGS");
+	char cmd[4096];
+
+	snprintf(cmd, sizeof(cmd), "%s %s -I%s %s/%s.c -o %s/%s -lm -pthread",
+		cc ? cc : "cc", cflags ? cflags : "-O2", src, src, name,
+		dir, name);
+
+	return system(cmd) == 0 ? 0 : -1;
+}
+
+/* run once in the source directory, stdout going into a pipe we only count */
+static int
+run(const char *path, const char *src, const char *arg, struct result *r)
+{
+	static char buf[1 << 16];
+	int fd[2];
+	pid_t pid;
+	struct rusage ru;
+	double t0;
+	ssize_t n;
+	size_t bytes = 0;
+	int status;
+
+	if (pipe(fd) != 0) {
+		return -1;
+	}
+
+	t0 = now();
+	pid = fork();
+	if (pid < 0) {
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+
+		dup2(fd[1], 1);
+		if (null >= 0) {
+			dup2(null, 2);
+		}
+		close(fd[0]);
+		close(fd[1]);
+
+		/* scores are read from there */
+		if (chdir(src) != 0) {
+			_exit(127);
+		}
+		execl(path, path, arg, (char *)NULL);
+		_exit(127);
+	}
+
+	close(fd[1]);
+	while ((n = read(fd[0], buf, sizeof(buf))) != 0) {
+		if (n > 0) {
+			bytes += n;
+		}
+	}
+	close(fd[0]);
+
+	if (wait4(pid, &status, 0, &ru) != pid) {
+		return -1;
+	}
+
+	r->wall = now() - t0;
+	r->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+		+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	r->rss = ru.ru_maxrss;
+	r->frames = bytes / (2 * sizeof(int16_t));
+
+	return WIFEXITED(status) && (WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+/* "name": ... "wall": ... pairs from a file this program wrote */
+static int
+load_baseline(const char *file, struct result *res)
+{
+	FILE *f;
+	char line[1024];
+
+	f = fopen(file, "r");
+	if (!f) {
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *name, *wall, *end;
+		size_t i, len;
+
+		name = strstr(line, "\"name\": \"");
+		wall = strstr(line, "\"wall\": ");
+		if (!name || !wall) {
+			continue;
+		}
+		name += strlen("\"name\": \"");
+		end = strchr(name, '"');
+		if (!end) {
+			continue;
+		}
+		len = end - name;
+
+		for (i=0; i<NPIECES; i++) {
+			if ((strlen(pieces[i].name) == len)
+				&& (strncmp(pieces[i].name, name, len) == 0)) {
+
+				res[i].base_wall = atof(wall + strlen("\"wall\": "));
+				res[i].in_base = 1;
+			}
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *src = "..", *base = NULL, *sep = "";
+	char dir[] = "/tmp/pieces-bench-XXXXXX";
+	struct result res[NPIECES];
+	double tol = 10.0;
+	int runs = 5, regressions = 0, failed = 0;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:c:t:")) != -1) {
+		switch (opt) {
+		case 's':
+			src = optarg;
+			break;
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'c':
+			base = optarg;
+			break;
+		case 't':
+			tol = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s dir] [-n runs] "
+				"[-c baseline.json] [-t percent]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (runs < 1) {
+		runs = 1;
+	}
+
+	memset(res, 0, sizeof(res));
+	if (base && (load_baseline(base, res) != 0)) {
+		fprintf(stderr, "can't read %s\n", base);
+		return EXIT_FAILURE;
+	}
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	for (i=0; i<NPIECES; i++) {
+		char path[4096];
+		int k;
+
+		fprintf(stderr, "%s\n", pieces[i].name);
+		if (build(src, dir, pieces[i].name) != 0) {
+			fprintf(stderr, "%s: build failed\n", pieces[i].name);
+			failed++;
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/%s", dir, pieces[i].name);
+		for (k=0; k<runs; k++) {
+			struct result r;
+
+			if (run(path, src, pieces[i].arg, &r) != 0) {
+				fprintf(stderr, "%s: run failed\n",
+					pieces[i].name);
+				res[i].ok = 0;
+				failed++;
+				break;
+			}
+			if (!res[i].ok || (r.wall < res[i].wall)) {
+				res[i].wall = r.wall;
+				res[i].frames = r.frames;
+			}
+			if (!res[i].ok || (r.cpu < res[i].cpu)) {
+				res[i].cpu = r.cpu;
+			}
+			if (r.rss > res[i].rss) {
+				res[i].rss = r.rss;
+			}
+			res[i].ok = 1;
+		}
+		unlink(path);
+	}
+	rmdir(dir);
+
+	printf("{\n\t\"cflags\": \"%s\",\n\t\"runs\": %d,\n",
+		getenv("CFLAGS") ? getenv("CFLAGS") : "-O2", runs);
+	printf("\t\"pieces\": [\n");
+	for (i=0; i<NPIECES; i++) {
+		const struct result *r = &res[i];
+
+		if (!r->ok) {
+			continue;
+		}
+
+		printf("%s\t\t{\"name\": \"%s\", \"wall\": %.6f, "
+			"\"cpu\": %.6f, \"samples\": %lu, "
+			"\"samples_per_s\": %.0f, \"realtime\": %.2f, "
+			"\"peak_rss_kb\": %ld",
+			sep, pieces[i].name, r->wall, r->cpu,
+			(unsigned long)r->frames, r->frames / r->wall,
+			r->frames / R / r->wall, r->rss);
+
+		if (r->in_base) {
+			double change = (r->wall / r->base_wall - 1.0) * 100.0;
+			int reg = change > tol;
+
+			printf(", \"base_wall\": %.6f, \"change_pct\": %.1f, "
+				"\"regression\": %s", r->base_wall, change,
+				reg ? "true" : "false");
+			regressions += reg;
+		}
+		printf("}");
+		sep = ",\n";
+	}
+	printf("\n\t]");
+	if (base) {
+		printf(",\n\t\"tolerance_pct\": %.1f,\n\t\"regressions\": %d",
+			tol, regressions);
+	}
+	printf("\n}\n");
+
+	if (failed) {
+		return EXIT_FAILURE;
+	}
+	return regressions ? 1 : EXIT_SUCCESS;
+}
@@ -0,0 +1,328 @@
+/*
+ * Scheduler: a dense in-memory piece rendered note by note over the
+ * whole length of each note, as timeline_add() used to do, and by the
+ * block scheduler of timeline.h, with cache misses where the CPU lets
+ * us count them
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra -I.. sched-bench.c -o sched-bench -lm -pthread
+ * $ ./sched-bench [seconds] [notes per second] [note seconds] [runs]
+ *
+ * Rows:
+ *   note    every note rendered and mixed into the pages start to end
+ *   block   timeline_play() of an in-memory timeline, without output
+ *   slices  the same with timeline_threads(tl, 1), page sized slices
+ * Columns: wall time, ns per note sample, page faults, L1 data read
+ * misses and last level cache misses (n/a without perf counters,
+ * e.g. in a VM or with perf_event_paranoid > 2), of the fastest of the
+ * runs, modes take turns. The planes must come out the same from all
+ * three, the max difference is printed.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "timeline.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+enum {NOTE, BLOCK, SLICES, NMODES};
+
+static const char *names[NMODES] = {"note", "block", "slices"};
+
+/*
+ * cheap on purpose, moving samples around is what is measured. Made of
+ * the offset only, so it gives the same samples in any blocks
+ */
+static void
+saw_render(const struct tl_event *ev, void *voice, float *out, size_t off,
+	size_t n)
+{
+	uint32_t inc = ev->fr / R * 4294967296.0;
+	float fade = 1.0f / ev->len;
+	size_t i;
+
+	(void)voice;
+
+	for (i=0; i<n; i++) {
+		int32_t ph = (uint32_t)(off + i) * inc;
+
+		out[i] = ph * (1.0f / 2147483648.0f)
+			* (1.0f - (off + i) * fade);
+	}
+}
+
+static const struct tl_instr instr_saw = {&saw_render, 0, NULL, NULL};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* counter of this thread, -1 if there is none */
+static int
+counter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr a;
+
+	memset(&a, 0, sizeof(a));
+	a.size = sizeof(a);
+	a.type = type;
+	a.config = config;
+	a.exclude_kernel = 1;
+	a.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+
+static uint64_t
+counter_read(int fd)
+{
+	uint64_t v = 0;
+
+	if ((fd < 0) || (read(fd, &v, sizeof(v)) != sizeof(v))) {
+		return 0;
+	}
+	return v;
+}
+
+static long
+faults(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_minflt + ru.ru_majflt;
+}
+
+/* the same notes every time */
+static struct tl_event *
+score(size_t len, double per_sec, double note_sec, size_t *nnotes)
+{
+	struct tl_event *ev;
+	uint32_t x = 1;
+	size_t i, n;
+
+	n = per_sec * len / R;
+	ev = calloc(n ? n : 1, sizeof(struct tl_event));
+	if (!ev) {
+		return NULL;
+	}
+
+	for (i=0; i<n; i++) {
+		x = x * 1664525 + 1013904223;
+
+		ev[i].instr = &instr_saw;
+		ev[i].start = (size_t)(x >> 8) % len;
+		ev[i].len = note_sec * R * (0.5 + (x & 0xff) / 256.0);
+		ev[i].loudness = 0.01;
+		ev[i].note = 30 + x % 40;
+		ev[i].fr = 55.0 * pow(2.0, ev[i].note / 12.0);
+	}
+
+	*nnotes = n;
+	return ev;
+}
+
+/* every note start to end, tl_render_span() on each */
+static int
+render_notes(struct timeline *tl, const struct tl_event *ev, size_t n)
+{
+	size_t i;
+	int rc = 0;
+
+	for (i=0; (i<n) && (rc == 0); i++) {
+		rc = tl_render_span(tl, &ev[i], NULL, tl->scratch, 0,
+			ev[i].len);
+		tl_extend(tl, ev[i].start + ev[i].len);
+	}
+
+	return rc;
+}
+
+static double
+diff(struct timeline *a, struct timeline *b)
+{
+	float x[2 * TL_BLOCK], y[2 * TL_BLOCK];
+	double d = 0.0;
+	size_t t, i;
+
+	for (t=0; t<a->end; t+=TL_BLOCK) {
+		size_t n = a->end - t < TL_BLOCK ? a->end - t : TL_BLOCK;
+
+		timeline_read(a, x, t, n);
+		timeline_read(b, y, t, n);
+		for (i=0; i<n * 2; i++) {
+			if (fabs((double)x[i] - y[i]) > d) {
+				d = fabs((double)x[i] - y[i]);
+			}
+		}
+	}
+
+	return d;
+}
+
+struct result
+{
+	double time;
+	long faults;
+	uint64_t l1, llc;
+};
+
+/* render the score into a new timeline */
+static struct timeline *
+run(int mode, const struct tl_event *ev, size_t nnotes, size_t len, int l1,
+	int llc, struct result *res)
+{
+	struct timeline *tl;
+	unsigned long fp;
+	size_t i;
+	int rc;
+
+	tl = timeline_init(len);
+	if (!tl) {
+		return NULL;
+	}
+	timeline_cull(tl, -INFINITY);
+	if (mode == SLICES) {
+		timeline_threads(tl, 1);
+	}
+
+	res->faults = faults();
+	res->l1 = counter_read(l1);
+	res->llc = counter_read(llc);
+	res->time = now();
+
+	if (mode == NOTE) {
+		fp = tl_fp_enter();
+		rc = render_notes(tl, ev, nnotes);
+		tl_fp_leave(fp);
+	} else {
+		for (i=0, rc=0; (i<nnotes) && (rc == 0); i++) {
+			rc = timeline_add(tl, &ev[i]);
+		}
+		if (rc == 0) {
+			rc = tl_render_events(tl);
+		}
+	}
+
+	res->time = now() - res->time;
+	res->faults = faults() - res->faults;
+	res->l1 = counter_read(l1) - res->l1;
+	res->llc = counter_read(llc) - res->llc;
+
+	if (rc != 0) {
+		timeline_free(tl);
+		return NULL;
+	}
+
+	return tl;
+}
+
+static void
+print_count(int fd, uint64_t v)
+{
+	if (fd >= 0) {
+		printf(" %14llu", (unsigned long long)v);
+	} else {
+		printf(" %14s", "n/a");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timeline *tl[NMODES];
+	struct result best[NMODES];
+	struct tl_event *ev;
+	size_t len, nnotes, samples = 0, i;
+	double per_sec, note_sec, d = 0.0;
+	int l1, llc, m, r, runs;
+
+	len = (argc > 1 ? atof(argv[1]) : 60.0) * R;
+	per_sec = argc > 2 ? atof(argv[2]) : 50.0;
+	note_sec = argc > 3 ? atof(argv[3]) : 2.0;
+	runs = argc > 4 ? atoi(argv[4]) : 3;
+	if (runs < 1) {
+		runs = 1;
+	}
+
+	ev = score(len, per_sec, note_sec, &nnotes);
+	if (!ev) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	for (i=0; i<nnotes; i++) {
+		samples += ev[i].len;
+	}
+
+	l1 = counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	llc = counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+	memset(tl, 0, sizeof(tl));
+	for (r=0; r<runs; r++) {
+		for (m=0; m<NMODES; m++) {
+			struct result res;
+			struct timeline *t;
+
+			/* who goes first pays for fresh pages, take turns */
+			int mode = (m + r) % NMODES;
+
+			t = run(mode, ev, nnotes, len, l1, llc, &res);
+			if (!t) {
+				fprintf(stderr, "%s: out of memory\n",
+					names[mode]);
+				return EXIT_FAILURE;
+			}
+			if (!tl[mode] || (res.time < best[mode].time)) {
+				best[mode] = res;
+			}
+			if (tl[mode]) {
+				timeline_free(tl[mode]);
+			}
+			tl[mode] = t;
+		}
+	}
+
+	printf("%lu notes, %.1f s each on average, %.1f voices at once\n",
+		(unsigned long)nnotes, samples / R / (nnotes ? nnotes : 1),
+		(double)samples / len);
+	printf("%-7s %8s %8s %8s %14s %14s\n", "mode", "time", "ns/smp",
+		"faults", "L1d misses", "LLC misses");
+	for (m=0; m<NMODES; m++) {
+		printf("%-7s %7.3fs %8.2f %8ld", names[m], best[m].time,
+			best[m].time * 1e9 / samples, best[m].faults);
+		print_count(l1, best[m].l1);
+		print_count(llc, best[m].llc);
+		printf("\n");
+
+		if (m > NOTE) {
+			double dm = diff(tl[NOTE], tl[m]);
+
+			d = dm > d ? dm : d;
+		}
+	}
+	printf("max diff %g\n", d);
+
+	for (m=0; m<NMODES; m++) {
+		timeline_free(tl[m]);
+	}
+	free(ev);
+
+	return EXIT_SUCCESS;
+}
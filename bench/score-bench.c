@@ -0,0 +1,195 @@
+/*
+ * Score parser speed on a generated score of a few megabytes
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra -I.. score-bench.c -o score-bench -lm -pthread
+ * $ ./score-bench [megabytes] [runs]
+ *
+ * The score has four tracks taking turns a bar each, of random notes,
+ * chords, rests and lengths, loudness changes and comments, no repeats
+ * so every byte is read once. Rows:
+ *   parse     score_parse() into a sink counting notes
+ *   timeline  score_play() into an in-memory timeline, notes are only
+ *             recorded there until it plays
+ * MB/s of text and notes per second, fastest of the runs.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timeline.h"
+#include "score.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+static const char *const names[] = {"a", "b"};
+
+static void
+dummy_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	(void)ev;
+	(void)voice;
+	(void)off;
+	memset(out, 0, n * sizeof(float));
+}
+
+static const struct tl_instr dummy = {&dummy_render, 0, NULL, NULL};
+static const struct tl_instr *const instrs[] = {&dummy, &dummy};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+count_note(void *arg, const struct score_note *n)
+{
+	(void)n;
+	(*(size_t *)arg)++;
+	return 0;
+}
+
+/* about size bytes of score */
+static char *
+generate(size_t size, size_t *len)
+{
+	static const char *const steps[] = {"DO", "RE", "MI", "FA", "SOL",
+		"LA", "SI"};
+	static const char *const lengths[] = {"", ":1", ":1/2", ":3/2",
+		":2", ":1/3", ":1-0.02s"};
+	char *buf;
+	size_t n = 0;
+	uint32_t x = 1;
+	int track = 0;
+
+	buf = malloc(size + 1024);
+	if (!buf) {
+		return NULL;
+	}
+
+	n += sprintf(buf + n, "# generated\ntempo 140\n"
+		"track t0 instr a\ntrack t1 instr b\n"
+		"track t2 instr a\ntrack t3 instr b\n");
+
+	/* a line per track and bar, the way a generator writes it */
+	while (n < size) {
+		int i, k, w;
+
+		x = x * 1664525 + 1013904223;
+		track = (track + 1) % 4;
+		n += sprintf(buf + n, "track t%d @0.%u ", track, (x >> 8) % 100);
+		if (track == 0) {
+			n += sprintf(buf + n, "# bar %u ", x >> 12);
+		}
+
+		for (w=0; w<8; w++) {
+			x = x * 1664525 + 1013904223;
+			switch (x >> 29) {
+			case 0:
+				k = 2 + (x >> 8) % 3;
+				buf[n++] = '[';
+				for (i=0; i<k; i++) {
+					x = x * 1664525 + 1013904223;
+					n += sprintf(buf + n, "%s%s_%u",
+						i ? " " : "",
+						steps[(x >> 8) % 7],
+						1 + (x >> 16) % 5);
+				}
+				n += sprintf(buf + n, "]%s ",
+					lengths[(x >> 24) % 7]);
+				break;
+			case 1:
+				n += sprintf(buf + n, "%u%s ", 24 + (x >> 8) % 72,
+					lengths[(x >> 24) % 7]);
+				break;
+			case 2:
+				n += sprintf(buf + n, "-%s ",
+					lengths[(x >> 24) % 5]);
+				break;
+			default:
+				n += sprintf(buf + n, "%s_%s%u%s ",
+					steps[(x >> 8) % 7],
+					(x >> 12) % 5 ? "" : "DIES_",
+					1 + (x >> 16) % 5,
+					lengths[(x >> 24) % 7]);
+			}
+		}
+		buf[n - 1] = '\n';
+	}
+
+	*len = n;
+	return buf;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct score_sink sink;
+	char err[256], *text;
+	size_t len, notes = 0;
+	double t_parse = INFINITY, t_tl = INFINITY, t0;
+	int r, runs;
+
+	len = (argc > 1 ? atof(argv[1]) : 16.0) * 1048576;
+	runs = argc > 2 ? atoi(argv[2]) : 5;
+
+	text = generate(len, &len);
+	if (!text) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	sink.note = &count_note;
+	sink.flush = NULL;
+	sink.arg = &notes;
+
+	for (r=0; r<runs; r++) {
+		struct timeline *tl;
+
+		notes = 0;
+		t0 = now();
+		if (score_parse(text, len, R, names, 2, &sink, err,
+			sizeof(err)) != 0) {
+
+			fprintf(stderr, "%s\n", err);
+			return EXIT_FAILURE;
+		}
+		t0 = now() - t0;
+		t_parse = t0 < t_parse ? t0 : t_parse;
+
+		tl = timeline_init(0);
+		if (!tl) {
+			fprintf(stderr, "out of memory\n");
+			return EXIT_FAILURE;
+		}
+		t0 = now();
+		if (score_play(tl, text, len, R, names, instrs, 2, err,
+			sizeof(err)) != 0) {
+
+			fprintf(stderr, "%s\n", err);
+			return EXIT_FAILURE;
+		}
+		t0 = now() - t0;
+		t_tl = t0 < t_tl ? t0 : t_tl;
+		timeline_free(tl);
+	}
+
+	printf("%.1f MB, %lu notes\n", len / 1048576.0, (unsigned long)notes);
+	printf("%-9s %10s %14s\n", "", "MB/s", "notes/s");
+	printf("%-9s %10.0f %14.0f\n", "parse", len / 1048576.0 / t_parse,
+		notes / t_parse);
+	printf("%-9s %10.0f %14.0f\n", "timeline", len / 1048576.0 / t_tl,
+		notes / t_tl);
+
+	free(text);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,346 @@
+/*
+ * Startup: a generated score of a few megabytes loaded as text and as a
+ * compiled score
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra -I.. scorebin-bench.c -o scorebin-bench -lm -pthread
+ * $ ./scorebin-bench [megabytes] [runs] [dir]
+ *
+ * The score (the one of score-bench.c) is written to dir ($TMPDIR or
+ * /tmp) as text and compiled, both are removed afterwards. Rows:
+ *   text   read, parse and record into an in-memory timeline, sort by
+ *          start as the scheduler does: everything before the first
+ *          sample
+ *   open   scorebin_open() and timeline_source(), the same for the
+ *          compiled score
+ *   walk   open and every note read from the columns, what the
+ *          scheduler adds over the whole render
+ * Columns: milliseconds with the files in the page cache and dropped
+ * from it first (posix_fadvise, the disk is read again unless it is
+ * tmpfs), fastest of the runs.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "timeline.h"
+#include "score.h"
+#include "scorebin.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+static const char *const names[] = {"a", "b"};
+
+static void
+dummy_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	(void)ev;
+	(void)voice;
+	(void)off;
+	memset(out, 0, n * sizeof(float));
+}
+
+static const struct tl_instr dummy_a = {&dummy_render, 0, NULL, NULL};
+static const struct tl_instr dummy_b = {&dummy_render, 0, NULL, NULL};
+static const struct tl_instr *const instrs[] = {&dummy_a, &dummy_b};
+
+enum {TEXT, OPEN, WALK, NROWS};
+
+static const char *rows[NROWS] = {"text", "open", "walk"};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* about size bytes of score, as score-bench.c writes it */
+static char *
+generate(size_t size, size_t *len)
+{
+	static const char *const steps[] = {"DO", "RE", "MI", "FA", "SOL",
+		"LA", "SI"};
+	static const char *const lengths[] = {"", ":1", ":1/2", ":3/2",
+		":2", ":1/3", ":1-0.02s"};
+	char *buf;
+	size_t n = 0;
+	uint32_t x = 1;
+	int track = 0;
+
+	buf = malloc(size + 1024);
+	if (!buf) {
+		return NULL;
+	}
+
+	n += sprintf(buf + n, "# generated\ntempo 140\n"
+		"track t0 instr a\ntrack t1 instr b\n"
+		"track t2 instr a\ntrack t3 instr b\n");
+
+	while (n < size) {
+		int i, k, w;
+
+		x = x * 1664525 + 1013904223;
+		track = (track + 1) % 4;
+		n += sprintf(buf + n, "track t%d @0.%u ", track,
+			(x >> 8) % 100);
+
+		for (w=0; w<8; w++) {
+			x = x * 1664525 + 1013904223;
+			switch (x >> 29) {
+			case 0:
+				k = 2 + (x >> 8) % 3;
+				buf[n++] = '[';
+				for (i=0; i<k; i++) {
+					x = x * 1664525 + 1013904223;
+					n += sprintf(buf + n, "%s%s_%u",
+						i ? " " : "",
+						steps[(x >> 8) % 7],
+						1 + (x >> 16) % 5);
+				}
+				n += sprintf(buf + n, "]%s ",
+					lengths[(x >> 24) % 7]);
+				break;
+			case 1:
+				n += sprintf(buf + n, "%u%s ",
+					24 + (x >> 8) % 72,
+					lengths[(x >> 24) % 7]);
+				break;
+			case 2:
+				n += sprintf(buf + n, "-%s ",
+					lengths[(x >> 24) % 5]);
+				break;
+			default:
+				n += sprintf(buf + n, "%s_%s%u%s ",
+					steps[(x >> 8) % 7],
+					(x >> 12) % 5 ? "" : "DIES_",
+					1 + (x >> 16) % 5,
+					lengths[(x >> 24) % 7]);
+			}
+		}
+		buf[n - 1] = '\n';
+	}
+
+	*len = n;
+	return buf;
+}
+
+/* out of the page cache, so the next run reads it again */
+static void
+drop(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd >= 0) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+/* notes of the text score, sorted as the scheduler sorts them */
+static struct timeline *
+load_text(const char *path, struct tl_start **order)
+{
+	struct timeline *tl;
+	char err[256], *text;
+	size_t len, i;
+
+	text = score_read(path, &len);
+	if (!text) {
+		return NULL;
+	}
+	tl = timeline_init(0);
+	if (!tl || (score_play(tl, text, len, R, names, instrs, 2, err,
+		sizeof(err)) != 0)) {
+
+		fprintf(stderr, "%s\n", tl ? err : "out of memory");
+		exit(EXIT_FAILURE);
+	}
+	free(text);
+
+	*order = malloc((tl->nevents ? tl->nevents : 1)
+		* sizeof(struct tl_start));
+	if (!*order) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i=0; i<tl->nevents; i++) {
+		(*order)[i].start = tl->events[i].start;
+		(*order)[i].ev = i;
+	}
+	qsort(*order, tl->nevents, sizeof(struct tl_start), &tl_start_cmp);
+
+	return tl;
+}
+
+/* every note from the columns, a sum of them to compare */
+static double
+walk(const struct scorebin *sb)
+{
+	struct tl_event ev;
+	double sum = 0.0;
+	size_t i, seq;
+
+	for (i=0; i<sb->src.n; i++) {
+		if (sb->src.event(sb->src.arg, i, &ev, &seq) != 0) {
+			fprintf(stderr, "broken note %lu\n", (unsigned long)i);
+			exit(EXIT_FAILURE);
+		}
+		sum += ev.start + ev.len * ev.loudness + ev.fr
+			+ (ev.instr == &dummy_b);
+	}
+
+	return sum;
+}
+
+static void
+run(int row, const char *text_path, const char *bin_path, int cold,
+	double *best, double *sum)
+{
+	struct tl_start *order = NULL;
+	struct timeline *tl;
+	struct scorebin sb;
+	char err[256];
+	size_t i;
+	double t;
+
+	if (cold) {
+		drop(row == TEXT ? text_path : bin_path);
+	}
+
+	t = now();
+	if (row == TEXT) {
+		tl = load_text(text_path, &order);
+		if (!tl) {
+			perror(text_path);
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		tl = timeline_init(0);
+		if (!tl || (scorebin_open(&sb, bin_path, R, names, instrs, 2,
+			err, sizeof(err)) != 0)) {
+
+			fprintf(stderr, "%s: %s\n", bin_path,
+				tl ? err : "out of memory");
+			exit(EXIT_FAILURE);
+		}
+		if (scorebin_play(tl, &sb) != 0) {
+			fprintf(stderr, "%s: can't play\n", bin_path);
+			exit(EXIT_FAILURE);
+		}
+		if (row == WALK) {
+			*sum = walk(&sb);
+		}
+	}
+	t = now() - t;
+
+	if (row == TEXT) {
+		for (i=0, *sum=0.0; i<tl->nevents; i++) {
+			const struct tl_event *ev = &tl->events[order[i].ev];
+
+			*sum += ev->start + ev->len * ev->loudness + ev->fr
+				+ (ev->instr == &dummy_b);
+		}
+	} else {
+		scorebin_close(&sb);
+	}
+	timeline_free(tl);
+	free(order);
+
+	*best = t < *best ? t : *best;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char text_path[4096], bin_path[4096], err[256];
+	struct scorebin_header h;
+	const char *dir;
+	struct timeline *tl;
+	struct tl_start *order;
+	double best[NROWS][2], sums[NROWS] = {0.0, 0.0, 0.0}, t;
+	size_t len, nnotes;
+	char *text;
+	FILE *f;
+	int r, row, cold, runs;
+
+	len = (argc > 1 ? atof(argv[1]) : 16.0) * 1048576;
+	runs = argc > 2 ? atoi(argv[2]) : 5;
+	if (runs < 1) {
+		runs = 1;
+	}
+	dir = argc > 3 ? argv[3] : getenv("TMPDIR");
+	if (!dir) {
+		dir = "/tmp";
+	}
+	snprintf(text_path, sizeof(text_path), "%s/scorebin-bench.score",
+		dir);
+	snprintf(bin_path, sizeof(bin_path), "%s/scorebin-bench.scb", dir);
+
+	text = generate(len, &len);
+	if (!text) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	f = fopen(text_path, "wb");
+	if (!f || (fwrite(text, 1, len, f) != len) || (fclose(f) != 0)) {
+		perror(text_path);
+		return EXIT_FAILURE;
+	}
+	free(text);
+
+	t = now();
+	tl = load_text(text_path, &order);
+	if (!tl) {
+		perror(text_path);
+		return EXIT_FAILURE;
+	}
+	if (scorebin_save(tl, bin_path, R, names, instrs, 2, err,
+		sizeof(err)) != 0) {
+
+		fprintf(stderr, "%s: %s\n", bin_path, err);
+		return EXIT_FAILURE;
+	}
+	t = now() - t;
+	nnotes = tl->nevents;
+	timeline_free(tl);
+	free(order);
+
+	for (row=0; row<NROWS; row++) {
+		best[row][0] = best[row][1] = INFINITY;
+	}
+	for (r=0; r<runs; r++) {
+		for (cold=0; cold<2; cold++) {
+			for (row=0; row<NROWS; row++) {
+				run(row, text_path, bin_path, cold,
+					&best[row][cold], &sums[row]);
+			}
+		}
+	}
+
+	printf("%lu notes, text %.1f MB, compiled %.1f MB in %.0f ms\n",
+		(unsigned long)nnotes, len / 1048576.0,
+		scorebin_layout(&h, nnotes) / 1048576.0, t * 1e3);
+	printf("%-5s %10s %10s\n", "", "warm ms", "cold ms");
+	for (row=0; row<NROWS; row++) {
+		printf("%-5s %10.2f %10.2f\n", rows[row], best[row][0] * 1e3,
+			best[row][1] * 1e3);
+	}
+	printf("same notes: %s\n", sums[TEXT] == sums[WALK] ? "yes" : "NO");
+
+	remove(text_path);
+	remove(bin_path);
+
+	return EXIT_SUCCESS;
+}
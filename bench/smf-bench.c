@@ -0,0 +1,338 @@
+/*
+ * MIDI import: a generated type 1 file with a few hundred thousand notes
+ * read by smf.h, speed and memory
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra -I.. smf-bench.c -o smf-bench -lm -pthread
+ * $ ./smf-bench [notes] [tracks] [runs] [dir]
+ *
+ * The file is written to dir ($TMPDIR or /tmp) and removed afterwards:
+ * a tempo track changing tempo every bar, then tracks of overlapping
+ * notes on all channels with running status, program changes and
+ * controllers in between. Rows:
+ *   parse     smf_parse() into a sink counting notes and flushes
+ *   timeline  smf_play() into a streaming timeline writing to
+ *             /dev/null, notes (64 silent frames each) are rendered and
+ *             written out as the file is read
+ * Columns: MB/s of file, MIDI events a second, fastest of the runs. Then
+ * how much the peak resident size grew over all runs, the pages of the
+ * mapped file count in it: apart from them it stays the same whatever
+ * the number of notes, nothing is expanded.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "timeline.h"
+#include "smf.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+static void
+dummy_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	(void)ev;
+	(void)voice;
+	(void)off;
+	memset(out, 0, n * sizeof(float));
+}
+
+/* every note a click, the timeline is what is measured */
+static size_t
+dummy_audible(const struct tl_event *ev, double level)
+{
+	(void)level;
+	return ev->len < 64 ? ev->len : 64;
+}
+
+static const struct tl_instr dummy = {&dummy_render, 0, NULL,
+	&dummy_audible};
+
+struct counts
+{
+	size_t notes, flushes;
+};
+
+static int
+count_note(void *arg, const struct smf_note *n)
+{
+	(void)n;
+	((struct counts *)arg)->notes++;
+	return 0;
+}
+
+static int
+count_flush(void *arg, size_t t)
+{
+	(void)t;
+	((struct counts *)arg)->flushes++;
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long
+maxrss(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static void
+put_be(FILE *f, uint32_t v, int n)
+{
+	while (n-- > 0) {
+		fputc((v >> (n * 8)) & 0xff, f);
+	}
+}
+
+static void
+put_varlen(FILE *f, uint32_t v)
+{
+	unsigned char b[4];
+	int n = 0;
+
+	do {
+		b[n++] = v & 0x7f;
+		v >>= 7;
+	} while (v);
+	while (n-- > 1) {
+		fputc(b[n] | 0x80, f);
+	}
+	fputc(b[0], f);
+}
+
+/* a track chunk, length patched in when it is done */
+static long
+track_begin(FILE *f)
+{
+	long at;
+
+	fwrite("MTrk", 1, 4, f);
+	at = ftell(f);
+	put_be(f, 0, 4);
+	return at;
+}
+
+static void
+track_end(FILE *f, long at)
+{
+	long end;
+
+	fputc(0, f);
+	fputc(0xff, f);
+	fputc(0x2f, f);
+	fputc(0, f);
+
+	end = ftell(f);
+	fseek(f, at, SEEK_SET);
+	put_be(f, end - at - 4, 4);
+	fseek(f, end, SEEK_SET);
+}
+
+/* notes spread over tracks, events in a file of their own */
+static size_t
+generate(const char *path, size_t notes, unsigned ntracks)
+{
+	FILE *f;
+	uint32_t x = 1;
+	size_t events = 0, i, bars;
+	unsigned tr;
+	long at;
+
+	f = fopen(path, "wb");
+	if (!f) {
+		return 0;
+	}
+
+	fwrite("MThd", 1, 4, f);
+	put_be(f, 6, 4);
+	put_be(f, 1, 2);
+	put_be(f, ntracks + 1, 2);
+	put_be(f, 480, 2);
+
+	/* tempo track, 4 beats a bar */
+	bars = notes / ntracks / 8 + 1;
+	at = track_begin(f);
+	for (i=0; i<bars; i++) {
+		x = x * 1664525 + 1013904223;
+		put_varlen(f, i ? 4 * 480 : 0);
+		fputc(0xff, f);
+		fputc(0x51, f);
+		fputc(3, f);
+		put_be(f, 400000 + (x >> 8) % 200000, 3);
+		events++;
+	}
+	track_end(f, at);
+
+	for (tr=0; tr<ntracks; tr++) {
+		unsigned channel = tr % 16, key = 60;
+		size_t n = notes / ntracks;
+
+		at = track_begin(f);
+		put_varlen(f, 0);
+		fputc(0xc0 | channel, f);
+		fputc(tr * 8 % 128, f);
+		events++;
+
+		/* a note every 240 ticks, overlapping the next one */
+		put_varlen(f, 0);
+		fputc(0x90 | channel, f);
+		fputc(key, f);
+		fputc(100, f);
+		events++;
+		for (i=1; i<n; i++) {
+			unsigned next;
+
+			x = x * 1664525 + 1013904223;
+			next = 36 + (x >> 8) % 60;
+			if (next == key) {
+				next++;
+			}
+			if ((x >> 20) % 16 == 0) {
+				put_varlen(f, 0);
+				fputc(0xb0 | channel, f);
+				fputc(7, f);
+				fputc(64 + (x >> 24) % 64, f);
+				events++;
+			}
+			put_varlen(f, 240);
+			fputc(0x90 | channel, f);
+			fputc(next, f);
+			fputc(40 + (x >> 14) % 80, f);
+			/* running status, velocity 0 is note-off */
+			put_varlen(f, 60);
+			fputc(key, f);
+			fputc(0, f);
+			events += 2;
+			key = next;
+		}
+		put_varlen(f, 240);
+		fputc(0x80 | channel, f);
+		fputc(key, f);
+		fputc(0, f);
+		events++;
+		track_end(f, at);
+	}
+
+	if (fclose(f) != 0) {
+		return 0;
+	}
+
+	return events;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct smf_map map;
+	struct smf_sink sink;
+	struct counts c;
+	struct smf f;
+	char path[4096], err[256];
+	const char *dir;
+	double t_parse = INFINITY, t_tl = INFINITY, t0;
+	size_t notes, events;
+	unsigned ntracks, i;
+	long rss;
+	int r, runs;
+
+	notes = argc > 1 ? atol(argv[1]) : 500000;
+	ntracks = argc > 2 ? atoi(argv[2]) : 16;
+	runs = argc > 3 ? atoi(argv[3]) : 3;
+	dir = argc > 4 ? argv[4] : getenv("TMPDIR");
+	if (!dir) {
+		dir = "/tmp";
+	}
+	if (ntracks < 1) {
+		ntracks = 1;
+	}
+	snprintf(path, sizeof(path), "%s/smf-bench.mid", dir);
+
+	events = generate(path, notes, ntracks);
+	if (events == 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	if (smf_open(&f, path, err, sizeof(err)) != 0) {
+		fprintf(stderr, "%s: %s\n", path, err);
+		return EXIT_FAILURE;
+	}
+
+	memset(&map, 0, sizeof(map));
+	for (i=0; i<128; i++) {
+		map.program[i].instr = &dummy;
+		map.program[i].gain = 0.01;
+	}
+
+	sink.note = &count_note;
+	sink.flush = &count_flush;
+	sink.arg = &c;
+
+	rss = maxrss();
+	for (r=0; r<runs; r++) {
+		struct timeline *tl;
+		int fd;
+
+		memset(&c, 0, sizeof(c));
+		t0 = now();
+		if (smf_parse(&f, R, &sink, err, sizeof(err)) != 0) {
+			fprintf(stderr, "%s: %s\n", path, err);
+			return EXIT_FAILURE;
+		}
+		t0 = now() - t0;
+		t_parse = t0 < t_parse ? t0 : t_parse;
+
+		tl = timeline_stream_init();
+		if (!tl) {
+			fprintf(stderr, "out of memory\n");
+			return EXIT_FAILURE;
+		}
+		fd = open("/dev/null", O_WRONLY);
+		timeline_output(tl, fd);
+		t0 = now();
+		if ((smf_play(tl, &f, R, &map, err, sizeof(err)) != 0)
+			|| (timeline_play(tl) != 0)) {
+
+			fprintf(stderr, "%s: %s\n", path, err);
+			return EXIT_FAILURE;
+		}
+		t0 = now() - t0;
+		t_tl = t0 < t_tl ? t0 : t_tl;
+		timeline_free(tl);
+		close(fd);
+	}
+	rss = maxrss() - rss;
+
+	printf("%lu notes, %lu events, %u tracks, %.1f MB, %lu flushes\n",
+		(unsigned long)c.notes, (unsigned long)events, ntracks + 1,
+		f.size / 1048576.0, (unsigned long)c.flushes);
+	printf("%-9s %10s %14s\n", "", "MB/s", "events/s");
+	printf("%-9s %10.1f %14.0f\n", "parse",
+		f.size / 1048576.0 / t_parse, events / t_parse);
+	printf("%-9s %10.1f %14.0f\n", "timeline",
+		f.size / 1048576.0 / t_tl, events / t_tl);
+	printf("peak resident size grew by %ld KB, up to %lu KB of it the "
+		"mapped file\n", rss, (unsigned long)(f.size / 1024));
+
+	smf_close(&f);
+	remove(path);
+
+	return EXIT_SUCCESS;
+}
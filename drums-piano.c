@@ -2,200 +2,235 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-static const double R = 44100;        /* sample rate (samples per second) */
-static const double maxamp = 1.0;     /* max. amplitude */
+#include "timeline.h"
+#include "freq.h"
+#include "osc.h"
 
+static const double R = 44100;        /* sample rate (samples per second) */
 
-typedef double (*instr_func)(double t, int note);
 
-struct timeline
+/*
+ * Instruments render a block at a time. Decays used only as amplitude
+ * envelope come from the exp() recurrence in osc.h, decays inside a
+ * phase are computed exactly: with cymbal frequencies the phase gets
+ * huge and any rounding there would change the sound.
+ */
+struct drum_voice
 {
-	size_t n;
-	size_t end;
-
-	float *left, *right;
-	float min, max;
+	struct osc_exp env1, env2;
+	struct osc_sin s1, s2, s3;
 };
 
-static struct timeline *
-timeline_init(size_t n)
+static void
+kick_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	struct timeline *t;
+	struct drum_voice *v = voice;
+	double env[TL_BLOCK], ph[TL_BLOCK];
+	size_t i;
 
-	t = malloc(sizeof(struct timeline));
-	if (!t) {
-		goto tmalloc_failed;
-	}
+	osc_exp(&v->env1, -4.0 / R, env, off, n);
 
-	t->left = calloc(n, sizeof(float));
-	if (!t->left) {
-		goto left_malloc_failed;
-	}
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-	t->right = calloc(n, sizeof(float));
-	if (!t->right) {
-		goto right_malloc_failed;
+		ph[i] = 2*M_PI*t*ev->fr * exp(-t*20);
 	}
 
-	t->n = n;
-	t->end = 0;
+	for (i=0; i<n; i++) {
+		out[i] = env[i] * sin(ph[i]);
+	}
+}
 
-	return t;
+static size_t
+kick_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, 1.0, 4.0 / R, level);
+}
 
-right_malloc_failed:
-	free(t->left);
+static const struct tl_instr instr_kick = {&kick_render,
+	sizeof(struct drum_voice), NULL, &kick_audible};
 
-left_malloc_failed:
-	free(t);
+static void
+metal_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	struct drum_voice *v = voice;
+	double env[TL_BLOCK], s1[TL_BLOCK], s2[TL_BLOCK], s3[TL_BLOCK];
+	double w = 2*M_PI*ev->fr / R;
+	size_t i;
+
+	osc_exp(&v->env1, -4.0 / R, env, off, n);
+	osc_sin(&v->s1, w, s1, off, n);
+	osc_sin(&v->s2, w*2.13232, s2, off, n);
+	osc_sin(&v->s3, w*6.12342, s3, off, n);
+
+	for (i=0; i<n; i++) {
+		out[i] = env[i] * (s1[i] + s2[i] + s3[i]);
+	}
+}
 
-tmalloc_failed:
-	return NULL;
+static size_t
+metal_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, 3.0, 4.0 / R, level);
 }
 
+static const struct tl_instr instr_metal = {&metal_render,
+	sizeof(struct drum_voice), NULL, &metal_audible};
+
 static void
-timeline_free(struct timeline *tl)
+tom_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	free(tl->left);
-	free(tl->right);
+	struct drum_voice *v = voice;
+	double env1[TL_BLOCK], env2[TL_BLOCK], ph1[TL_BLOCK], ph2[TL_BLOCK];
+	size_t i;
 
-	tl->left = tl->right = NULL;
-	tl->n = tl->end = 0;
+	osc_exp(&v->env1, -4.0 / R, env1, off, n);
+	osc_exp(&v->env2, -2.0 / R, env2, off, n);
 
-	free(tl);
-}
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-static void
-timeline_play(struct timeline *tl)
-{
-	size_t t;
-	for (t=0; t<tl->end; t++) {
-		int16_t tone;
-
-		if (tl->left[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->left[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->left[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
-
-		if (tl->right[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->right[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->right[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
+		ph1[i] = 2*M_PI*t*ev->fr * exp(-t*20);
+		ph2[i] = 2*M_PI*t*ev->fr * exp(-t*5);
+	}
+
+	for (i=0; i<n; i++) {
+		out[i] = env1[i] * sin(ph1[i]) + env2[i] * sin(ph2[i]);
 	}
 }
 
-static double
-freq(int n)
+static size_t
+tom_audible(const struct tl_event *ev, double level)
 {
-	double f;
-
-	f = pow(2.0, ((double)n - 49.0) / 12.0) * 440.0;
-	return f;
+	return tl_decay_audible(ev, 2.0, 2.0 / R, level);
 }
 
-static double
-instr_kick(double t, int note)
+static const struct tl_instr instr_tom = {&tom_render,
+	sizeof(struct drum_voice), NULL, &tom_audible};
+
+static void
+cym_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	double tone = exp(-t*4) * sin(2*M_PI*t*freq(note) * exp(-t*20));
+	double e[TL_BLOCK];
+	size_t i;
+	(void)voice;
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-	return tone;
+		e[i] = exp(-t*70);
+	}
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
+
+		out[i] = e[i] * tan(2*M_PI*t*ev->fr * e[i]);
+	}
 }
 
-static double
-instr_metal(double t, int note)
+/*
+ * |tan x| <= 2|x| for |x| <= 1, and x = 2 pi t fr e only shrinks after
+ * t = 1/70
+ */
+static size_t
+cym_audible(const struct tl_event *ev, double level)
 {
-	double tone = exp(-t*4) * (sin(2*M_PI*t*freq(note))
-		+ sin(2*M_PI*t*freq(note)*2.13232)
-		+ sin(2*M_PI*t*freq(note)*6.12342));
+	size_t i;
+
+	for (i=R/70; i<ev->len; i+=TL_BLOCK) {
+		double t = i / R;
+		double e = exp(-t*70);
+		double x = 2*M_PI*t*ev->fr * e;
+
+		if ((x <= 1.0) && (2.0 * x * e < level)) {
+			return i;
+		}
+	}
 
-	return tone;
+	return ev->len;
 }
 
-static double
-instr_tom(double t, int note)
+static const struct tl_instr instr_cym = {&cym_render, 0, NULL,
+	&cym_audible};
+
+static void
+cym2_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	double tone = exp(-t*4) * sin(2*M_PI*t*freq(note) * exp(-t*20))
-		+ exp(-t*2) * sin(2*M_PI*t*freq(note) * exp(-t*5));
+	double e[TL_BLOCK];
+	size_t i;
+	(void)voice;
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
+
+		e[i] = exp(-t*10);
+	}
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-	return tone;
+		out[i] = e[i] * sin(2*M_PI*t*ev->fr * e[i]);
+	}
 }
 
-static double
-instr_cym(double t, int note)
+static size_t
+cym2_audible(const struct tl_event *ev, double level)
 {
-	double tone = exp(-t*70) * tan(2*M_PI*t*freq(note) * exp(-t*70));
-	return tone;
+	return tl_decay_audible(ev, 1.0, 10.0 / R, level);
 }
 
-static double
-instr_cym2(double t, int note)
+static const struct tl_instr instr_cym2 = {&cym2_render, 0, NULL,
+	&cym2_audible};
+
+static void
+piano_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	double tone = exp(-t*10) * sin(2*M_PI*t*freq(note) * exp(-t*10));
-	return tone;
+	osc_piano(voice, 2.0 * M_PI * ev->fr / R, out, off, n);
 }
 
-static double
-instr_piano(double t, int note)
+/* the envelope of osc.h */
+static size_t
+piano_audible(const struct tl_event *ev, double level)
 {
-	double tone;
-
-	t *= 2.0 * M_PI * freq(note);
-
-	tone = sin(t) * exp(-0.0004 * t);
-                                                                
-	tone += sin(2.0 * t) * exp(-0.0004 * t) / 2.0;
-	tone += sin(3.0 * t) * exp(-0.0004 * t) / 4.0;
-	tone += sin(4.0 * t) * exp(-0.0004 * t) / 8.0;
-	tone += sin(5.0 * t) * exp(-0.0004 * t) / 16.0;
-	tone += sin(6.0 * t) * exp(-0.0004 * t) / 32.0;
-                                                                
-	tone += tone * tone * tone;
-	return tone;
+	return tl_decay_audible(ev, OSC_PIANO_PEAK,
+		0.0004 * 2.0 * M_PI * ev->fr / R, level);
 }
 
+static const struct tl_instr instr_piano = {&piano_render,
+	sizeof(struct osc_piano), NULL, &piano_audible};
+
 static void
 add_note(struct timeline *tl, double start,
-	int note, double duration, double loudness, instr_func instr)
+	int note, double duration, double loudness,
+	const struct tl_instr *instr)
 {
-	size_t tstart, tend, t;
+	struct tl_event ev;
+	size_t tstart, tend;
 
 	tstart = start * R;
 	tend = tstart + duration * R;
 
-	for (t=tstart; t<tend; t++) {
-		double tone;
-		double k;
-
-		k = (t - tstart) / R;
-
-		tone = (*instr)(k, note);
-
-		tone *= loudness;
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = instr;
+	ev.start = tstart;
+	ev.len = tend - tstart;
+	ev.loudness = loudness;
+	ev.note = note;
+	ev.fr = freq(note);
 
-		if (t >= tl->n) {
-			break;
-		}
-		 /* first channel */
-		tl->left[t] += tone;
-
-		/* second channel */
-		tl->right[t] += tone;
-	}
-
-	if (t > tl->end) {
-		tl->end = t;
-	}
+	timeline_add(tl, &ev);
 }
 
 
+
 int
 main()
 {
@@ -212,6 +247,7 @@ main()
 	if (!tl) {
 		return EXIT_FAILURE;
 	}
+	timeline_threads(tl, 0);
 
 	/* drums */
 	where = 0.0;
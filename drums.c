@@ -2,248 +2,315 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-static const double R = 44100;        /* sample rate (samples per second) */
-static const double maxamp = 1.0;     /* max. amplitude */
+#include "timeline.h"
+#include "freq.h"
+#include "osc.h"
 
+static const double R = 44100;        /* sample rate (samples per second) */
+static const unsigned bpm = 190;
 
-typedef double (*instr_func)(double t, int note);
 
-struct timeline
+/*
+ * Instruments render a block at a time. Decays used only as amplitude
+ * envelope come from the exp() recurrence in osc.h, decays inside a
+ * phase are computed exactly: with cymbal frequencies the phase gets
+ * huge and any rounding there would change the sound.
+ */
+struct drum_voice
 {
-	size_t n;
-	size_t end;
-
-	float *left, *right;
-	float min, max;
+	struct osc_exp env1, env2;
+	struct osc_sin s1, s2, s3;
 };
 
-static struct timeline *
-timeline_init(size_t n)
+static void
+kick_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	struct timeline *t;
+	struct drum_voice *v = voice;
+	double env[TL_BLOCK], ph[TL_BLOCK];
+	size_t i;
 
-	t = malloc(sizeof(struct timeline));
-	if (!t) {
-		goto tmalloc_failed;
-	}
+	osc_exp(&v->env1, -4.0 / R, env, off, n);
 
-	t->left = calloc(n, sizeof(float));
-	if (!t->left) {
-		goto left_malloc_failed;
-	}
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-	t->right = calloc(n, sizeof(float));
-	if (!t->right) {
-		goto right_malloc_failed;
+		ph[i] = 2*M_PI*t*ev->fr * exp(-t*20);
 	}
 
-	t->n = n;
-	t->end = 0;
+	for (i=0; i<n; i++) {
+		out[i] = env[i] * sin(ph[i]);
+	}
+}
 
-	return t;
+static size_t
+kick_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, 1.0, 4.0 / R, level);
+}
 
-right_malloc_failed:
-	free(t->left);
+static const struct tl_instr instr_kick = {&kick_render,
+	sizeof(struct drum_voice), NULL, &kick_audible};
 
-left_malloc_failed:
-	free(t);
+static void
+metal_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	struct drum_voice *v = voice;
+	double env[TL_BLOCK], s1[TL_BLOCK], s2[TL_BLOCK], s3[TL_BLOCK];
+	double w = 2*M_PI*ev->fr / R;
+	size_t i;
+
+	osc_exp(&v->env1, -4.0 / R, env, off, n);
+	osc_sin(&v->s1, w, s1, off, n);
+	osc_sin(&v->s2, w*2.13232, s2, off, n);
+	osc_sin(&v->s3, w*6.12342, s3, off, n);
+
+	for (i=0; i<n; i++) {
+		out[i] = env[i] * (s1[i] + s2[i] + s3[i]);
+	}
+}
 
-tmalloc_failed:
-	return NULL;
+static size_t
+metal_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, 3.0, 4.0 / R, level);
 }
 
+static const struct tl_instr instr_metal = {&metal_render,
+	sizeof(struct drum_voice), NULL, &metal_audible};
+
 static void
-timeline_free(struct timeline *tl)
+tom_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	free(tl->left);
-	free(tl->right);
+	struct drum_voice *v = voice;
+	double env1[TL_BLOCK], env2[TL_BLOCK], ph1[TL_BLOCK], ph2[TL_BLOCK];
+	size_t i;
 
-	tl->left = tl->right = NULL;
-	tl->n = tl->end = 0;
+	osc_exp(&v->env1, -4.0 / R, env1, off, n);
+	osc_exp(&v->env2, -2.0 / R, env2, off, n);
 
-	free(tl);
-}
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-static void
-timeline_play(struct timeline *tl)
-{
-	size_t t;
-	for (t=0; t<tl->end; t++) {
-		int16_t tone;
-
-		if (tl->left[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->left[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->left[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
-
-		if (tl->right[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->right[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->right[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
+		ph1[i] = 2*M_PI*t*ev->fr * exp(-t*20);
+		ph2[i] = 2*M_PI*t*ev->fr * exp(-t*5);
+	}
+
+	for (i=0; i<n; i++) {
+		out[i] = env1[i] * sin(ph1[i]) + env2[i] * sin(ph2[i]);
 	}
 }
 
-static double
-freq(int n)
+static size_t
+tom_audible(const struct tl_event *ev, double level)
 {
-	double f;
-
-	f = pow(2.0, ((double)n - 49.0) / 12.0) * 440.0;
-	return f;
+	return tl_decay_audible(ev, 2.0, 2.0 / R, level);
 }
 
-static double
-instr_kick(double t, int note)
+static const struct tl_instr instr_tom = {&tom_render,
+	sizeof(struct drum_voice), NULL, &tom_audible};
+
+static void
+cym_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	double tone = exp(-t*4) * sin(2*M_PI*t*freq(note) * exp(-t*20));
+	double e[TL_BLOCK];
+	size_t i;
+	(void)voice;
 
-	return tone;
-}
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-static double
-instr_metal(double t, int note)
-{
-	double tone = exp(-t*4) * (sin(2*M_PI*t*freq(note))
-		+ sin(2*M_PI*t*freq(note)*2.13232)
-		+ sin(2*M_PI*t*freq(note)*6.12342));
+		e[i] = exp(-t*25);
+	}
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-	return tone;
+		out[i] = e[i] * tan(2*M_PI*t*ev->fr * e[i]);
+	}
 }
 
-static double
-instr_tom(double t, int note)
+/*
+ * |tan x| <= 2|x| for |x| <= 1, and x = 2 pi t fr e only shrinks after
+ * t = 1/25
+ */
+static size_t
+cym_audible(const struct tl_event *ev, double level)
 {
-	double tone = exp(-t*4) * sin(2*M_PI*t*freq(note) * exp(-t*20))
-		+ exp(-t*2) * sin(2*M_PI*t*freq(note) * exp(-t*5));
+	size_t i;
 
-	return tone;
-}
+	for (i=R/25; i<ev->len; i+=TL_BLOCK) {
+		double t = i / R;
+		double e = exp(-t*25);
+		double x = 2*M_PI*t*ev->fr * e;
 
-static double
-instr_cym(double t, int note)
-{
-	double tone = exp(-t*25) * tan(2*M_PI*t*freq(note) * exp(-t*25));
-	return tone;
-}
+		if ((x <= 1.0) && (2.0 * x * e < level)) {
+			return i;
+		}
+	}
 
-static double
-instr_cym2(double t, int note)
-{
-	double tone = exp(-t*10) * sin(2*M_PI*t*freq(note) * exp(-t*10));
-	return tone;
+	return ev->len;
 }
 
+static const struct tl_instr instr_cym = {&cym_render, 0, NULL,
+	&cym_audible};
+
 static void
-add_note(struct timeline *tl, double start,
-	int note, double duration, double loudness, instr_func instr)
+cym2_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	size_t tstart, tend, t;
+	double e[TL_BLOCK];
+	size_t i;
+	(void)voice;
 
-	tstart = start * R;
-	tend = tstart + duration * R;
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-	for (t=tstart; t<tend; t++) {
-		double tone;
-		double k;
+		e[i] = exp(-t*10);
+	}
 
-		k = (t - tstart) / R;
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-		tone = (*instr)(k, note);
+		out[i] = e[i] * sin(2*M_PI*t*ev->fr * e[i]);
+	}
+}
 
-		tone *= loudness;
+static size_t
+cym2_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, 1.0, 10.0 / R, level);
+}
 
-		if (t >= tl->n) {
-			break;
-		}
-		 /* first channel */
-		tl->left[t] += tone;
+static const struct tl_instr instr_cym2 = {&cym2_render, 0, NULL,
+	&cym2_audible};
 
-		/* second channel */
-		tl->right[t] += tone;
+/* where the drums stand, as heard from the audience */
+static double
+kit_pan(const struct tl_instr *instr)
+{
+	if (instr == &instr_cym) {
+		return 0.6;
+	} else if (instr == &instr_cym2) {
+		return -0.5;
+	} else if (instr == &instr_metal) {
+		return 0.3;
+	} else if (instr == &instr_tom) {
+		return -0.2;
 	}
 
-	if (t > tl->end) {
-		tl->end = t;
-	}
+	return 0.0;
+}
+
+/* start and duration in sixteenth notes */
+static void
+add_note(struct timeline *tl, size_t start,
+	int note, size_t duration, double loudness,
+	const struct tl_instr *instr)
+{
+	struct tl_event ev;
+	size_t tstart, tend;
+
+	tstart = timeline_step(start, R, bpm * 4);
+	tend = timeline_step(start + duration, R, bpm * 4);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = instr;
+	ev.start = tstart;
+	ev.len = tend - tstart;
+	ev.loudness = loudness;
+	ev.note = note;
+	ev.fr = freq(note);
+	ev.pan = kit_pan(instr);
+
+	timeline_add(tl, &ev);
 }
 
 
+/*
+ * the piece is one pattern played 8 times: a bar 3 times, then a fill.
+ * Both are clips, rendered once and mixed in where they go
+ */
 int
 main()
 {
-	int bpm = 190;
-
 	double vol = 0.5;
-	double notelen = 60.0 / bpm / 4.0;
-	double where = 0.0;
+	size_t where = 0;
 	size_t i, j, k;
 
-	struct timeline *tl;
+	struct timeline *tl, *bar, *pattern;
 
 	tl = timeline_init(100 * R);
-	if (!tl) {
+	bar = timeline_init(0);
+	pattern = timeline_init(0);
+	if (!tl || !bar || !pattern) {
 		return EXIT_FAILURE;
 	}
+	timeline_cache(bar, 0);
+	timeline_cache(pattern, 0);
 
-	where = 0.0;
+	add_note(bar, 0, 800, 8,
+		vol * 0.2, &instr_cym2);
+	add_note(bar, 1, 90, 8,
+		vol * 0.01, &instr_metal);
 
-	for (k=0; k<8; k++) {
-		for (i=0; i<3; i++) {
-			add_note(tl, where, 800, notelen * 8,
-				vol * 0.2, &instr_cym2);
-			add_note(tl, where + notelen, 90, notelen * 8,
-				vol * 0.01, &instr_metal);
-
-			for (j=0; j<4; j++) {
-				add_note(tl, where, 30, notelen * 2,
-					vol, &instr_kick);
-				where += notelen * 1;
-
-				add_note(tl, where, 30, notelen * 2,
-					vol, &instr_kick);
-				where += notelen * 1;
-
-				add_note(tl, where, 30, notelen * 2,
-					vol, &instr_kick);
-
-				add_note(tl, where, 30, notelen * 2,
-					vol, &instr_tom);
-				add_note(tl, where, 700, notelen * 2,
-					vol * 0.02, &instr_cym);
-
-				where += notelen * 2;
-			}
-		}
+	for (j=0; j<4; j++) {
+		add_note(bar, where, 30, 2,
+			vol, &instr_kick);
+		where += 1;
+
+		add_note(bar, where, 30, 2,
+			vol, &instr_kick);
+		where += 1;
 
-		for (i=0; i<4; i++) {
-			add_note(tl, where, 800, notelen * 8,
-				vol * 0.2, &instr_cym2);
-			add_note(tl, where + notelen, 110, notelen * 8,
-				vol * 0.008, &instr_metal);
-
-			for (j=0; j<4; j++) {
-				add_note(tl, where, 40 - i * 3, notelen * 2,
-					vol * 0.2, &instr_tom);
-				add_note(tl, where, 800, notelen * 2,
-					vol * 0.01, &instr_cym);
-				where += notelen * 1;
-			}
+		add_note(bar, where, 30, 2,
+			vol, &instr_kick);
+
+		add_note(bar, where, 30, 2,
+			vol, &instr_tom);
+		add_note(bar, where, 700, 2,
+			vol * 0.02, &instr_cym);
+
+		where += 2;
+	}
+
+	for (i=0; i<3; i++) {
+		timeline_clip(pattern, bar,
+			timeline_step(i * where, R, bpm * 4), 1.0);
+	}
+	where *= 3;
+
+	for (i=0; i<4; i++) {
+		add_note(pattern, where, 800, 8,
+			vol * 0.2, &instr_cym2);
+		add_note(pattern, where + 1, 110, 8,
+			vol * 0.008, &instr_metal);
+
+		for (j=0; j<4; j++) {
+			add_note(pattern, where, 40 - i * 3, 2,
+				vol * 0.2, &instr_tom);
+			add_note(pattern, where, 800, 2,
+				vol * 0.01, &instr_cym);
+			where += 1;
 		}
 	}
 
+	for (k=0; k<8; k++) {
+		timeline_clip(tl, pattern,
+			timeline_step(k * where, R, bpm * 4), 1.0);
+	}
+
 
 	timeline_play(tl);
 
 	timeline_free(tl);
+	timeline_free(pattern);
+	timeline_free(bar);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,991 @@
+/*
+ * Instrument expressions without a C compiler
+ *
+ * A tone is written the way the instr template takes it, as C
+ * assignments:
+ *
+ *   double k = t * 2 * M_PI * freq(note);
+ *   tone = sin(k) * exp(-0.0004 * k);
+ *   tone += tone * tone * tone;
+ *
+ * Numbers, + - * / and parentheses, sin cos tan exp log sqrt fabs floor
+ * pow fmod fmin fmax, freq(n) from freq.h, noise() (-1 .. 1, one value
+ * per sample of the note, from its seed), t (seconds), note, M_PI, M_E
+ * and R. Variables are assigned with = += -= *= /=, "double" in front
+ * and C comments are skipped. The result is whatever tone is last set
+ * to. Types are those of C: note and numbers without a point or an
+ * exponent are ints, + - * of ints give ints and / of two ints divides
+ * as ints (note / 12), anything else and every variable is a double.
+ * Octal and hex numbers are not taken.
+ *
+ * expr_compile() turns the text into register code for two machines:
+ * what depends on the note only (freq(note) ...) runs once per call on
+ * scalar slots, what depends on t runs per block of EXPR_BLOCK samples,
+ * one opcode at a time over the whole block. Dispatch is paid once per
+ * opcode and block, the loops are plain arrays the compiler vectorizes,
+ * sin() and friends are called per sample like compiled C does.
+ * Constants are folded, evaluation order is that of C, so the result is
+ * what the same line compiled without -ffast-math gives, bit for bit
+ * unless the compiler fuses multiply-adds.
+ *
+ * Plain C that also builds as C++, instr checks instruments with it.
+ * bench/expr-bench.c compares it with compiled expressions.
+ */
+#ifndef expr_h_included
+#define expr_h_included
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "freq.h"
+
+#define EXPR_RATE 44100.0   /* t = sample / EXPR_RATE */
+
+#define EXPR_BLOCK 128      /* samples evaluated at once */
+#define EXPR_REGS 64        /* block registers */
+#define EXPR_SLOTS 256      /* per-note values and constants */
+#define EXPR_OPS 512        /* per machine */
+#define EXPR_VARS 32
+
+enum
+{
+	/* sources, per block only */
+	EXPR_T,
+	EXPR_NOISE,
+
+	EXPR_NEG,
+	EXPR_ADD,
+	EXPR_SUB,
+	EXPR_MUL,
+	EXPR_DIV,
+	EXPR_INEG,
+	EXPR_IMUL,
+	EXPR_IDIV,
+	EXPR_SIN,
+	EXPR_COS,
+	EXPR_TAN,
+	EXPR_EXP,
+	EXPR_LOG,
+	EXPR_SQRT,
+	EXPR_FABS,
+	EXPR_FLOOR,
+	EXPR_POW,
+	EXPR_FMOD,
+	EXPR_FMIN,
+	EXPR_FMAX,
+	EXPR_FREQ
+};
+
+struct expr_op
+{
+	unsigned short op;
+	unsigned short dst, a, b;   /* slots or block registers */
+};
+
+struct expr
+{
+	/* per note, on slots. Slot 0 is the note */
+	struct expr_op uni[EXPR_OPS];
+	size_t nuni;
+	double init[EXPR_SLOTS];   /* constants */
+	size_t nslots;
+
+	/* slots copied into block registers before the first block */
+	unsigned short bcast_slot[EXPR_REGS], bcast_reg[EXPR_REGS];
+	size_t nbcast;
+
+	/* per block, on block registers */
+	struct expr_op var[EXPR_OPS];
+	size_t nvar;
+
+	unsigned short out;   /* register with tone */
+};
+
+enum expr_kind
+{
+	EXPR_CONST,
+	EXPR_UNIFORM,   /* in a slot */
+	EXPR_VARYING    /* in a block register */
+};
+
+/* a value while compiling */
+struct expr_val
+{
+	enum expr_kind kind;
+	int idx;      /* slot or register */
+	double k;
+	int temp;     /* holds a reference to its register */
+	int integer;  /* an int in C */
+};
+
+struct expr_parser
+{
+	const char *src, *p;
+	struct expr *e;
+
+	char *err;
+	size_t errlen;
+	int failed;
+
+	char names[EXPR_VARS][32];
+	struct expr_val vals[EXPR_VARS];
+	int nvars;
+
+	/*
+	 * registers 0 .. used - 1 have been working ones, top ..
+	 * EXPR_REGS - 1 hold broadcasts, which no opcode may write
+	 */
+	int refs[EXPR_REGS];        /* 0 - free */
+	int used, top;
+	int slot_reg[EXPR_SLOTS];   /* broadcast of a slot or -1 */
+	char is_const[EXPR_SLOTS];
+	int t_reg;
+};
+
+/* noise for sample i of a note, -1 .. 1 */
+static inline double
+expr_noise(unsigned seed, size_t i)
+{
+	uint64_t x = ((uint64_t)seed << 32) ^ (uint64_t)i;
+
+	/* splitmix64 */
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	return (x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+/* one opcode over n values, d may be a or b */
+static inline void
+expr_kernel(int op, double *d, const double *a, const double *b,
+	size_t off, unsigned seed, size_t n)
+{
+	size_t i;
+	int j;
+
+	switch (op) {
+	case EXPR_T:
+		/* exact below 2^53, same as (double)(off + i) */
+		for (j=0; j<(int)n; j++) {
+			d[j] = ((double)off + (double)j) / EXPR_RATE;
+		}
+		break;
+	case EXPR_NOISE:
+		for (i=0; i<n; i++) {
+			d[i] = expr_noise(seed, off + i);
+		}
+		break;
+	case EXPR_NEG:
+		for (i=0; i<n; i++) {
+			d[i] = -a[i];
+		}
+		break;
+	case EXPR_ADD:
+		for (i=0; i<n; i++) {
+			d[i] = a[i] + b[i];
+		}
+		break;
+	case EXPR_SUB:
+		for (i=0; i<n; i++) {
+			d[i] = a[i] - b[i];
+		}
+		break;
+	case EXPR_MUL:
+		for (i=0; i<n; i++) {
+			d[i] = a[i] * b[i];
+		}
+		break;
+	case EXPR_DIV:
+		for (i=0; i<n; i++) {
+			d[i] = a[i] / b[i];
+		}
+		break;
+	/*
+	 * ints: there is no -0, + 0.0 makes it 0. The quotient of two is
+	 * never rounded as far as the next whole number
+	 */
+	case EXPR_INEG:
+		for (i=0; i<n; i++) {
+			d[i] = 0.0 - a[i];
+		}
+		break;
+	case EXPR_IMUL:
+		for (i=0; i<n; i++) {
+			d[i] = a[i] * b[i] + 0.0;
+		}
+		break;
+	case EXPR_IDIV:
+		for (i=0; i<n; i++) {
+			d[i] = trunc(a[i] / b[i]) + 0.0;
+		}
+		break;
+	case EXPR_SIN:
+		for (i=0; i<n; i++) {
+			d[i] = sin(a[i]);
+		}
+		break;
+	case EXPR_COS:
+		for (i=0; i<n; i++) {
+			d[i] = cos(a[i]);
+		}
+		break;
+	case EXPR_TAN:
+		for (i=0; i<n; i++) {
+			d[i] = tan(a[i]);
+		}
+		break;
+	case EXPR_EXP:
+		for (i=0; i<n; i++) {
+			d[i] = exp(a[i]);
+		}
+		break;
+	case EXPR_LOG:
+		for (i=0; i<n; i++) {
+			d[i] = log(a[i]);
+		}
+		break;
+	case EXPR_SQRT:
+		for (i=0; i<n; i++) {
+			d[i] = sqrt(a[i]);
+		}
+		break;
+	case EXPR_FABS:
+		for (i=0; i<n; i++) {
+			d[i] = fabs(a[i]);
+		}
+		break;
+	case EXPR_FLOOR:
+		for (i=0; i<n; i++) {
+			d[i] = floor(a[i]);
+		}
+		break;
+	case EXPR_POW:
+		for (i=0; i<n; i++) {
+			d[i] = pow(a[i], b[i]);
+		}
+		break;
+	case EXPR_FMOD:
+		for (i=0; i<n; i++) {
+			d[i] = fmod(a[i], b[i]);
+		}
+		break;
+	case EXPR_FMIN:
+		for (i=0; i<n; i++) {
+			d[i] = fmin(a[i], b[i]);
+		}
+		break;
+	case EXPR_FMAX:
+		for (i=0; i<n; i++) {
+			d[i] = fmax(a[i], b[i]);
+		}
+		break;
+	case EXPR_FREQ:
+		/* freq() takes an int like in C */
+		for (i=0; i<n; i++) {
+			d[i] = freq((int)a[i]);
+		}
+		break;
+	}
+}
+
+/* samples off .. off + n - 1 of a note */
+static inline void
+expr_eval(const struct expr *e, int note, unsigned seed, float *out,
+	size_t off, size_t n)
+{
+	double slots[EXPR_SLOTS];
+	double regs[EXPR_REGS][EXPR_BLOCK];
+	size_t i, done, m;
+
+	memcpy(slots, e->init, e->nslots * sizeof(double));
+	slots[0] = note;
+	for (i=0; i<e->nuni; i++) {
+		const struct expr_op *o = &e->uni[i];
+
+		expr_kernel(o->op, slots + o->dst, slots + o->a, slots + o->b,
+			0, seed, 1);
+	}
+
+	for (i=0; i<e->nbcast; i++) {
+		double v = slots[e->bcast_slot[i]];
+		double *r = regs[e->bcast_reg[i]];
+		size_t j;
+
+		for (j=0; j<EXPR_BLOCK; j++) {
+			r[j] = v;
+		}
+	}
+
+	for (done=0; done<n; done+=m) {
+		const double *tone = regs[e->out];
+
+		m = n - done < EXPR_BLOCK ? n - done : EXPR_BLOCK;
+
+		for (i=0; i<e->nvar; i++) {
+			const struct expr_op *o = &e->var[i];
+
+			expr_kernel(o->op, regs[o->dst], regs[o->a],
+				regs[o->b], off + done, seed, m);
+		}
+
+		for (i=0; i<m; i++) {
+			out[done + i] = tone[i];
+		}
+	}
+}
+
+static inline void
+expr_fail(struct expr_parser *ps, const char *fmt, ...)
+{
+	const char *s;
+	int line = 1, col = 1, len;
+	va_list ap;
+
+	if (ps->failed) {
+		return;
+	}
+	ps->failed = 1;
+
+	for (s=ps->src; s<ps->p; s++) {
+		col++;
+		if (*s == '\n') {
+			line++;
+			col = 1;
+		}
+	}
+
+	len = snprintf(ps->err, ps->errlen, "%d:%d: ", line, col);
+	if ((len < 0) || ((size_t)len >= ps->errlen)) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(ps->err + len, ps->errlen - len, fmt, ap);
+	va_end(ap);
+}
+
+/* white space and C comments */
+static inline void
+expr_skip(struct expr_parser *ps)
+{
+	for (;;) {
+		if (isspace((unsigned char)*ps->p)) {
+			ps->p++;
+		} else if ((ps->p[0] == '/') && (ps->p[1] == '/')) {
+			while (*ps->p && (*ps->p != '\n')) {
+				ps->p++;
+			}
+		} else if ((ps->p[0] == '/') && (ps->p[1] == '*')) {
+			const char *end = strstr(ps->p + 2, "*/");
+
+			ps->p = end ? end + 2 : ps->p + strlen(ps->p);
+		} else {
+			break;
+		}
+	}
+}
+
+static inline int
+expr_accept(struct expr_parser *ps, const char *tok)
+{
+	size_t len = strlen(tok);
+
+	expr_skip(ps);
+	if (strncmp(ps->p, tok, len) != 0) {
+		return 0;
+	}
+	ps->p += len;
+
+	return 1;
+}
+
+static inline void
+expr_expect(struct expr_parser *ps, const char *tok)
+{
+	if (!expr_accept(ps, tok)) {
+		expr_fail(ps, "expected '%s'", tok);
+	}
+}
+
+/* name into buf, 0 if there is none */
+static inline int
+expr_name(struct expr_parser *ps, char *buf, size_t size)
+{
+	size_t n = 0;
+
+	expr_skip(ps);
+	if (!isalpha((unsigned char)*ps->p) && (*ps->p != '_')) {
+		return 0;
+	}
+
+	while (isalnum((unsigned char)ps->p[n]) || (ps->p[n] == '_')) {
+		n++;
+	}
+	if (n >= size) {
+		expr_fail(ps, "name too long");
+		return 0;
+	}
+
+	memcpy(buf, ps->p, n);
+	buf[n] = '\0';
+	ps->p += n;
+
+	return 1;
+}
+
+static inline struct expr_val
+expr_const(double k)
+{
+	struct expr_val v;
+
+	v.kind = EXPR_CONST;
+	v.idx = -1;
+	v.k = k;
+	v.temp = 0;
+	v.integer = 0;
+
+	return v;
+}
+
+static inline int
+expr_new_slot(struct expr_parser *ps, double init)
+{
+	if (ps->e->nslots == EXPR_SLOTS) {
+		expr_fail(ps, "too many values");
+		return 0;
+	}
+	ps->e->init[ps->e->nslots] = init;
+
+	return ps->e->nslots++;
+}
+
+static inline int
+expr_new_reg(struct expr_parser *ps)
+{
+	int r;
+
+	for (r=0; r<ps->top; r++) {
+		if (ps->refs[r] == 0) {
+			ps->refs[r] = 1;
+			if (r >= ps->used) {
+				ps->used = r + 1;
+			}
+			return r;
+		}
+	}
+	expr_fail(ps, "expression too complex");
+
+	return 0;
+}
+
+static inline void
+expr_release(struct expr_parser *ps, const struct expr_val *v)
+{
+	if ((v->kind == EXPR_VARYING) && v->temp && !ps->failed) {
+		ps->refs[v->idx]--;
+	}
+}
+
+/* a per-note value or a constant in a slot, one slot per constant */
+static inline int
+expr_slot(struct expr_parser *ps, const struct expr_val *v)
+{
+	size_t i;
+	int slot;
+
+	if (v->kind != EXPR_CONST) {
+		return v->idx;
+	}
+
+	for (i=1; i<ps->e->nslots; i++) {
+		if (ps->is_const[i]
+			&& (memcmp(&ps->e->init[i], &v->k, sizeof(double)) == 0)) {
+
+			return i;
+		}
+	}
+
+	slot = expr_new_slot(ps, v->k);
+	ps->is_const[slot] = 1;
+
+	return slot;
+}
+
+/* any value in a block register */
+static inline int
+expr_reg(struct expr_parser *ps, const struct expr_val *v)
+{
+	struct expr *e = ps->e;
+	int slot, r;
+
+	if (v->kind == EXPR_VARYING) {
+		return v->idx;
+	}
+
+	slot = expr_slot(ps, v);
+	if (ps->slot_reg[slot] >= 0) {
+		return ps->slot_reg[slot];
+	}
+
+	/* kept for good, broadcast once per call */
+	if (ps->top <= ps->used) {
+		expr_fail(ps, "expression too complex");
+		return 0;
+	}
+	r = --ps->top;
+	ps->refs[r] = 1;
+	e->bcast_slot[e->nbcast] = slot;
+	e->bcast_reg[e->nbcast++] = r;
+	ps->slot_reg[slot] = r;
+
+	return r;
+}
+
+static inline void
+expr_emit(struct expr_parser *ps, struct expr_op *ops, size_t *nops,
+	int op, int dst, int a, int b)
+{
+	if (*nops == EXPR_OPS) {
+		expr_fail(ps, "expression too long");
+		return;
+	}
+
+	ops[*nops].op = op;
+	ops[*nops].dst = dst;
+	ops[*nops].a = a;
+	ops[*nops].b = b;
+	(*nops)++;
+}
+
+/* op on one or two values (b is a for one), folded when it can be */
+static inline struct expr_val
+expr_apply(struct expr_parser *ps, int op, struct expr_val a,
+	struct expr_val b)
+{
+	struct expr *e = ps->e;
+	struct expr_val v;
+	int ra, rb, integer;
+
+	if (ps->failed) {
+		return expr_const(0.0);
+	}
+
+	/* arithmetic on ints stays int, ints divide as ints */
+	integer = a.integer && b.integer && ((op == EXPR_NEG)
+		|| (op == EXPR_ADD) || (op == EXPR_SUB) || (op == EXPR_MUL)
+		|| (op == EXPR_DIV));
+	if (integer) {
+		op = op == EXPR_NEG ? EXPR_INEG : op == EXPR_MUL ? EXPR_IMUL
+			: op == EXPR_DIV ? EXPR_IDIV : op;
+	}
+
+	if ((a.kind == EXPR_CONST) && (b.kind == EXPR_CONST)) {
+		double k;
+
+		expr_kernel(op, &k, &a.k, &b.k, 0, 0, 1);
+		v = expr_const(k);
+		v.integer = integer;
+		return v;
+	}
+
+	if ((a.kind != EXPR_VARYING) && (b.kind != EXPR_VARYING)) {
+		ra = expr_slot(ps, &a);
+		rb = (b.kind == a.kind) && (b.idx == a.idx) && (b.k == a.k)
+			? ra : expr_slot(ps, &b);
+
+		v.kind = EXPR_UNIFORM;
+		v.idx = expr_new_slot(ps, 0.0);
+		v.k = 0.0;
+		v.temp = 0;
+		v.integer = integer;
+		expr_emit(ps, e->uni, &e->nuni, op, v.idx, ra, rb);
+
+		return v;
+	}
+
+	ra = expr_reg(ps, &a);
+	rb = expr_reg(ps, &b);
+
+	v.kind = EXPR_VARYING;
+	v.k = 0.0;
+	v.temp = 1;
+	v.integer = integer;
+	if (a.temp) {
+		v.idx = ra;
+		if (b.temp && (rb != ra)) {
+			expr_release(ps, &b);
+		}
+	} else if (b.temp) {
+		v.idx = rb;
+	} else {
+		v.idx = expr_new_reg(ps);
+	}
+	expr_emit(ps, e->var, &e->nvar, op, v.idx, ra, rb);
+
+	return v;
+}
+
+static inline struct expr_val expr_sum(struct expr_parser *ps);
+
+static const struct
+{
+	const char *name;
+	int op, nargs;
+} expr_funcs[] = {
+	{"sin", EXPR_SIN, 1}, {"cos", EXPR_COS, 1}, {"tan", EXPR_TAN, 1},
+	{"exp", EXPR_EXP, 1}, {"log", EXPR_LOG, 1}, {"sqrt", EXPR_SQRT, 1},
+	{"fabs", EXPR_FABS, 1}, {"floor", EXPR_FLOOR, 1},
+	{"pow", EXPR_POW, 2}, {"fmod", EXPR_FMOD, 2},
+	{"fmin", EXPR_FMIN, 2}, {"fmax", EXPR_FMAX, 2},
+	{"freq", EXPR_FREQ, 1}, {"noise", EXPR_NOISE, 0}
+};
+
+static inline struct expr_val
+expr_call(struct expr_parser *ps, const char *name)
+{
+	struct expr_val args[2];
+	size_t i;
+	int n;
+
+	for (i=0; i<sizeof(expr_funcs) / sizeof(expr_funcs[0]); i++) {
+		if (strcmp(expr_funcs[i].name, name) == 0) {
+			break;
+		}
+	}
+	if (i == sizeof(expr_funcs) / sizeof(expr_funcs[0])) {
+		expr_fail(ps, "unknown function '%s'", name);
+		return expr_const(0.0);
+	}
+
+	for (n=0; n<expr_funcs[i].nargs; n++) {
+		if (n > 0) {
+			expr_expect(ps, ",");
+		}
+		args[n] = expr_sum(ps);
+	}
+	expr_expect(ps, ")");
+
+	if (expr_funcs[i].op == EXPR_NOISE) {
+		struct expr_val v;
+
+		v.kind = EXPR_VARYING;
+		v.idx = expr_new_reg(ps);
+		v.k = 0.0;
+		v.temp = 1;
+		v.integer = 0;
+		expr_emit(ps, ps->e->var, &ps->e->nvar, EXPR_NOISE, v.idx,
+			v.idx, v.idx);
+		return v;
+	}
+
+	return expr_apply(ps, expr_funcs[i].op, args[0],
+		args[expr_funcs[i].nargs - 1]);
+}
+
+static inline struct expr_val
+expr_primary(struct expr_parser *ps)
+{
+	char name[32];
+	struct expr_val v;
+	int i;
+
+	expr_skip(ps);
+
+	if (isdigit((unsigned char)*ps->p) || (*ps->p == '.')) {
+		const char *s = ps->p;
+		char *end;
+		double k;
+
+		while (isdigit((unsigned char)*s)) {
+			s++;
+		}
+		if ((ps->p[0] == '0') && (isdigit((unsigned char)ps->p[1])
+			|| (ps->p[1] == 'x') || (ps->p[1] == 'X'))) {
+
+			expr_fail(ps, "octal or hex number");
+			return expr_const(0.0);
+		}
+
+		k = strtod(ps->p, &end);
+		if (end == ps->p) {
+			expr_fail(ps, "bad number");
+		}
+		ps->p = end;
+		v = expr_const(k);
+		/* no point, no exponent */
+		v.integer = end == s;
+		return v;
+	}
+
+	if (expr_accept(ps, "(")) {
+		v = expr_sum(ps);
+		expr_expect(ps, ")");
+		return v;
+	}
+
+	if (!expr_name(ps, name, sizeof(name))) {
+		expr_fail(ps, "expected a value");
+		return expr_const(0.0);
+	}
+
+	if (expr_accept(ps, "(")) {
+		return expr_call(ps, name);
+	}
+
+	for (i=ps->nvars-1; i>=0; i--) {
+		if (strcmp(ps->names[i], name) == 0) {
+			v = ps->vals[i];
+			v.temp = 0;
+			return v;
+		}
+	}
+
+	if (strcmp(name, "t") == 0) {
+		if (ps->t_reg < 0) {
+			ps->t_reg = expr_new_reg(ps);
+			expr_emit(ps, ps->e->var, &ps->e->nvar, EXPR_T,
+				ps->t_reg, ps->t_reg, ps->t_reg);
+		}
+		v.kind = EXPR_VARYING;
+		v.idx = ps->t_reg;
+		v.k = 0.0;
+		v.temp = 0;
+		v.integer = 0;
+		return v;
+	}
+	if (strcmp(name, "note") == 0) {
+		v.kind = EXPR_UNIFORM;
+		v.idx = 0;
+		v.k = 0.0;
+		v.temp = 0;
+		v.integer = 1;
+		return v;
+	}
+	if (strcmp(name, "M_PI") == 0) {
+		return expr_const(M_PI);
+	}
+	if (strcmp(name, "M_E") == 0) {
+		return expr_const(M_E);
+	}
+	if (strcmp(name, "R") == 0) {
+		return expr_const(EXPR_RATE);
+	}
+
+	expr_fail(ps, "unknown name '%s'", name);
+	return expr_const(0.0);
+}
+
+static inline struct expr_val
+expr_unary(struct expr_parser *ps)
+{
+	/* C takes these for ++ and -- */
+	if (expr_accept(ps, "--") || expr_accept(ps, "++")) {
+		expr_fail(ps, "increment or decrement");
+		return expr_const(0.0);
+	}
+	if (expr_accept(ps, "-")) {
+		struct expr_val v = expr_unary(ps);
+
+		return expr_apply(ps, EXPR_NEG, v, v);
+	}
+	if (expr_accept(ps, "+")) {
+		return expr_unary(ps);
+	}
+
+	return expr_primary(ps);
+}
+
+static inline struct expr_val
+expr_term(struct expr_parser *ps)
+{
+	struct expr_val v = expr_unary(ps);
+
+	while (!ps->failed) {
+		expr_skip(ps);
+		if ((ps->p[0] == '*') && (ps->p[1] != '=')) {
+			ps->p++;
+			v = expr_apply(ps, EXPR_MUL, v, expr_unary(ps));
+		} else if ((ps->p[0] == '/') && (ps->p[1] != '=')) {
+			ps->p++;
+			v = expr_apply(ps, EXPR_DIV, v, expr_unary(ps));
+		} else {
+			break;
+		}
+	}
+
+	return v;
+}
+
+static inline struct expr_val
+expr_sum(struct expr_parser *ps)
+{
+	struct expr_val v = expr_term(ps);
+
+	while (!ps->failed) {
+		expr_skip(ps);
+		if ((ps->p[0] == '+') && (ps->p[1] != '=')) {
+			ps->p++;
+			v = expr_apply(ps, EXPR_ADD, v, expr_term(ps));
+		} else if ((ps->p[0] == '-') && (ps->p[1] != '=')) {
+			ps->p++;
+			v = expr_apply(ps, EXPR_SUB, v, expr_term(ps));
+		} else {
+			break;
+		}
+	}
+
+	return v;
+}
+
+/* [double] name (= | += | -= | *= | /=) expression ; */
+static inline void
+expr_stmt(struct expr_parser *ps)
+{
+	static const char *const ops[] = {"=", "+=", "-=", "*=", "/="};
+	static const int codes[] = {-1, EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV};
+	char name[32];
+	struct expr_val v;
+	size_t op;
+	int i, old = -1;
+
+	if (!expr_name(ps, name, sizeof(name))) {
+		expr_fail(ps, "expected an assignment");
+		return;
+	}
+	if ((strcmp(name, "double") == 0)
+		&& !expr_name(ps, name, sizeof(name))) {
+
+		expr_fail(ps, "expected a name");
+		return;
+	}
+	if ((strcmp(name, "t") == 0) || (strcmp(name, "note") == 0)) {
+		expr_fail(ps, "can't assign to %s", name);
+		return;
+	}
+
+	for (op=sizeof(ops)/sizeof(ops[0]); op>0; op--) {
+		if (expr_accept(ps, ops[op - 1])) {
+			break;
+		}
+	}
+	if (op == 0) {
+		expr_fail(ps, "expected '='");
+		return;
+	}
+	op--;
+
+	for (i=ps->nvars-1; i>=0; i--) {
+		if (strcmp(ps->names[i], name) == 0) {
+			old = i;
+			break;
+		}
+	}
+	if ((old < 0) && (codes[op] >= 0)) {
+		expr_fail(ps, "'%s' is not set", name);
+		return;
+	}
+
+	v = expr_sum(ps);
+	if (codes[op] >= 0) {
+		struct expr_val cur = ps->vals[old];
+
+		cur.temp = 0;
+		v = expr_apply(ps, codes[op], cur, v);
+	}
+	expr_accept(ps, ";");
+	if (ps->failed) {
+		return;
+	}
+
+	/* the variable owns a reference to its register */
+	if ((v.kind == EXPR_VARYING) && !v.temp) {
+		ps->refs[v.idx]++;
+	}
+	v.temp = 0;
+	/* variables are doubles, an int assigned is converted exactly */
+	v.integer = 0;
+
+	if (old >= 0) {
+		if (ps->vals[old].kind == EXPR_VARYING) {
+			ps->refs[ps->vals[old].idx]--;
+		}
+		ps->vals[old] = v;
+		return;
+	}
+
+	if (ps->nvars == EXPR_VARS) {
+		expr_fail(ps, "too many variables");
+		return;
+	}
+	strcpy(ps->names[ps->nvars], name);
+	ps->vals[ps->nvars++] = v;
+}
+
+/* NULL and a message in err if src is not an expression program */
+static inline struct expr *
+expr_compile(const char *src, char *err, size_t errlen)
+{
+	struct expr_parser ps;
+	struct expr *e;
+	int i;
+
+	e = (struct expr *)calloc(1, sizeof(struct expr));
+	if (!e) {
+		snprintf(err, errlen, "out of memory");
+		return NULL;
+	}
+
+	memset(&ps, 0, sizeof(ps));
+	ps.src = ps.p = src;
+	ps.e = e;
+	ps.err = err;
+	ps.errlen = errlen;
+	ps.t_reg = -1;
+	ps.top = EXPR_REGS;
+	for (i=0; i<EXPR_SLOTS; i++) {
+		ps.slot_reg[i] = -1;
+	}
+
+	/* slot 0 - the note */
+	e->nslots = 1;
+
+	for (;;) {
+		expr_skip(&ps);
+		if (!*ps.p || ps.failed) {
+			break;
+		}
+		expr_stmt(&ps);
+	}
+
+	for (i=ps.nvars-1; (i>=0) && !ps.failed; i--) {
+		if (strcmp(ps.names[i], "tone") == 0) {
+			e->out = expr_reg(&ps, &ps.vals[i]);
+			break;
+		}
+	}
+	if ((i < 0) && !ps.failed) {
+		expr_fail(&ps, "tone is never set");
+	}
+
+	if (ps.failed) {
+		free(e);
+		return NULL;
+	}
+
+	return e;
+}
+
+static inline void
+expr_free(struct expr *e)
+{
+	free(e);
+}
+
+#endif
@@ -1,50 +1,408 @@
 /*
  * $ `wx-config --cxx` -Wall -pedantic -Wextra `wx-config --cppflags` `wx-config --libs` -lcrypto instr.cc -o instr
+ *
+ * with libtcc the piece is compiled in memory and rendered straight into
+ * the player instead of running cc and the program on every Play:
+ * $ `wx-config --cxx` -DINSTR_TCC -Wall -pedantic -Wextra `wx-config --cppflags` `wx-config --libs` -lcrypto instr.cc -o instr -ltcc -ldl
+ *
+ * The instrument (template-instr.c) and the notes (template-notes.c) are
+ * built separately, so editing one half rebuilds only that half: two
+ * objects linked into an executable, or with libtcc the instrument as a
+ * shared object loaded next to the notes compiled in memory.
+ *
+ * Builds go to a cache directory ($INSTR_CACHE, $XDG_CACHE_HOME/instr or
+ * ~/.cache/instr), named by the md5 of flags, source and the headers in
+ * .. the templates include (timeline.h and the rest). An index keeps
+ * sizes and use order, least recently used files are deleted when the
+ * cache grows over $INSTR_CACHE_MB (INSTR_CACHE_MB) megabytes. Files go
+ * in by rename(), a killed build never leaves half of one. Temporaries
+ * carry the pid of the instr writing them, so several instr can share
+ * the cache, those of an instr no longer running are deleted. The index
+ * is changed under flock() on the lock file: it is read again and merged
+ * first, and lists the pids of the instr using a file, those files are
+ * not evicted by anybody.
+ *
+ * There are two tiers. Play takes the optimized build ($INSTR_CFLAGS,
+ * "-O2 -march=native" by default) when the cache has it, otherwise it
+ * builds a quick draft ($INSTR_DRAFT_CFLAGS, -O0) and plays that while
+ * the optimized one is built in the background for the next Play.
+ *
+ * Instruments that are plain expressions (expr.h: tone = ...; with
+ * math functions, t and note) are not compiled at all. They run on the
+ * interpreter in template-expr.c, which is built once and then comes
+ * from the cache, the text goes to it through $INSTR_EXPR or, with
+ * libtcc, instr_expr(). Anything else is compiled as C.
+ *
+ * Play Region asks for seconds from-to and loops just that part until
+ * Stop, only the notes sounding there are rendered (timeline_window()).
+ *
+ * Compiling, rendering and playing run on a thread of their own, the
+ * window only gets status events from it. The piece is rendered while
+ * it plays: PCM goes through a pipe into aplay and the pipe holds back
+ * rendering to the pace of playback. Play again or Stop kills what is
+ * running, the renderer then stops on its next write.
  */
 #include <wx/wx.h>
 #include <wx/textctrl.h>
+#include <wx/textdlg.h>
 #include <wx/filename.h>
 #include <wx/file.h>
 #include <wx/regex.h>
+#include <wx/stopwatch.h>
+#include <wx/thread.h>
+#include <wx/tokenzr.h>
 
 #include <openssl/md5.h>
 
+#include "../expr.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#ifdef INSTR_TCC
+#include <dlfcn.h>
+#include <libtcc.h>
+#endif
+
+#define INSTR_CACHE_MB 256    /* default build cache size */
+#define INSTR_CFLAGS "-O2 -march=native"
+#define INSTR_DRAFT_CFLAGS "-O0"
+
+/* compiled files by content, least recently used are dropped first */
+class BuildCache
+{
+public:
+	BuildCache();
+	~BuildCache();
+
+	bool Open();
+	std::string Path(const std::string &name);
+	std::string Temp(const std::string &name, unsigned long id);
+
+	bool Has(const std::string &name);
+	bool Get(const std::string &name);
+	bool Put(const std::string &tmp, const std::string &name);
+	void Release(const std::string &name);
+
+	wxString Stats();
+
+private:
+	struct Entry
+	{
+		size_t size;
+		unsigned long long used;   /* tick of the last use */
+		int pins;                  /* in use, not dropped while > 0 */
+		std::vector<long> holders; /* other instr using it, by pid */
+	};
+
+	static bool Alive(long pid);
+	static bool Stale(const std::string &name);
+
+	void Merge();
+	void Evict();
+	void Save();
+
+	wxMutex lock;
+	int lock_fd;                   /* flock()ed while the index changes */
+	std::string dir;
+	std::map<std::string, Entry> entries;
+	unsigned long long tick;
+	size_t bytes, max_bytes;
+	size_t hits, misses, evictions;
+};
+
+/* the index to this instr alone while in scope, after the mutex */
+class IndexLocker
+{
+public:
+	IndexLocker(int fd)
+		: fd(fd)
+	{
+		while ((fd >= 0) && (flock(fd, LOCK_EX) != 0) && (errno == EINTR))
+			;
+	}
+
+	~IndexLocker()
+	{
+		if (fd >= 0) {
+			flock(fd, LOCK_UN);
+		}
+	}
+
+private:
+	int fd;
+};
+
 class InstrApp: public wxApp
 {
 public:
 	virtual bool OnInit();
 };
 
+class PlayThread;
+class OptimizeThread;
+
 class InstrFrame: public wxFrame
 {
 public:
 	InstrFrame(const wxString& title, const wxPoint& pos,
 		const wxSize& size);
+	~InstrFrame();
 private:
 	void OnPlay(wxCommandEvent& event);
+	void OnPlayRegion(wxCommandEvent& event);
+	void OnStop(wxCommandEvent& event);
 	void OnExit(wxCommandEvent& event);
 	void OnAbout(wxCommandEvent& event);
+	void OnWorker(wxThreadEvent& event);
+
+	bool MakeSource(const wxString &tmpl_name, const wxString &code,
+		const wxString &pattern, wxString &src);
+	void Start(double from, double to, bool loop);
+	void StopWorker();
+	void StopOptimizer();
+	void Optimize(const std::string &instr_src,
+		const std::string &notes_src);
 
 	wxTextCtrl *instr, *notes;
+	wxString region;   /* last one asked for */
+
+	BuildCache cache;
+
+	PlayThread *worker;
+	long generation;   /* events of superseded workers are dropped */
+
+	OptimizeThread *optimizer;
+	std::string optimizing;   /* sources it builds */
 
 	wxDECLARE_EVENT_TABLE();
 };
 
 enum
 {
-	ID_Play = 1
+	ID_Play = 1,
+	ID_PlayRegion,
+	ID_Stop,
+	ID_Worker
+};
+
+/* what a worker event carries */
+enum
+{
+	PLAY_STATUS,   /* text for the status bar */
+	PLAY_ERROR,    /* text for a message box */
+	PLAY_DONE,
+	BUILD_DONE     /* from the optimizer, text for the status bar */
 };
 
 wxBEGIN_EVENT_TABLE(InstrFrame, wxFrame)
 	EVT_MENU(ID_Play,    InstrFrame::OnPlay)
+	EVT_MENU(ID_PlayRegion, InstrFrame::OnPlayRegion)
+	EVT_MENU(ID_Stop,    InstrFrame::OnStop)
 	EVT_MENU(wxID_EXIT,  InstrFrame::OnExit)
 	EVT_MENU(wxID_ABOUT, InstrFrame::OnAbout)
+	EVT_THREAD(ID_Worker, InstrFrame::OnWorker)
 wxEND_EVENT_TABLE()
 
 wxIMPLEMENT_APP(InstrApp);
 
+/*
+ * thread running compilers and players. Cancel() from the GUI thread
+ * kills the child processes, cache files it used stay pinned until it
+ * is deleted
+ */
+class Worker: public wxThread
+{
+public:
+	Worker(wxEvtHandler *frame, BuildCache *cache, long generation);
+	~Worker();
+
+	void Cancel();
+
+protected:
+	void Post(int what, const wxString &msg);
+	bool Cancelled();
+
+	pid_t Spawn(const char *const argv[], int in, int out, int nice,
+		const char *env = NULL);
+	bool Reap(pid_t pid);
+
+	std::string Name(const std::vector<std::string> &args,
+		const std::string &src, const std::string &ext);
+	bool Cc(const std::vector<std::string> &args, const std::string &name,
+		int nice);
+	bool Build(const std::string &src, const std::vector<std::string> &args,
+		const std::vector<std::string> &libs, const std::string &ext,
+		int nice, std::string &name, wxString &errors);
+
+	BuildCache *cache;
+	std::vector<std::string> pinned;
+
+private:
+	wxEvtHandler *frame;
+	long generation;
+
+	wxMutex lock;
+	std::vector<pid_t> children;
+	bool cancelled;
+};
+
+/* compile, render and play one piece or loop a part of it */
+class PlayThread: public Worker
+{
+public:
+	PlayThread(wxEvtHandler *frame, BuildCache *cache, long generation,
+		const std::string &instr_src, const std::string &notes_src,
+		const std::string &expr, double from, double to, bool loop);
+
+protected:
+	virtual ExitCode Entry();
+
+private:
+	bool Pick(const std::string &src, bool is_instr, std::string &name,
+		wxString &errors);
+	bool Compile(wxString &errors);
+	bool Render(int fd);
+	bool Play();
+
+	std::string instr_src, notes_src;
+	std::string expr;   /* interpreted instrument or empty */
+	bool draft;   /* some half is not optimized yet */
+
+	double from, to;   /* seconds, to 0 - the end */
+	bool loop;
+
+#ifdef INSTR_TCC
+	void *instr_lib;
+	TCCState *jit;
+#else
+	std::string exe;
+#endif
+};
+
+/* optimized builds of both halves into the cache, niced */
+class OptimizeThread: public Worker
+{
+public:
+	OptimizeThread(wxEvtHandler *frame, BuildCache *cache,
+		const std::string &instr_src, const std::string &notes_src);
+
+protected:
+	virtual ExitCode Entry();
+
+private:
+	std::string instr_src, notes_src;
+};
+
+#ifdef INSTR_TCC
+static const char *const instr_ext = ".so";
+#else
+static const char *const instr_ext = ".o";
+#endif
+
+/* tier flags from the environment or the default, split on spaces */
+static std::vector<std::string>
+tier_args(const char *env, const char *def)
+{
+	const char *s = getenv(env);
+	std::vector<std::string> args;
+
+	wxStringTokenizer tok(s ? s : def, " \t");
+	while (tok.HasMoreTokens()) {
+		args.push_back(tok.GetNextToken().ToStdString());
+	}
+
+	return args;
+}
+
+/* md5 of the headers builds include from .., an edit makes new names */
+static std::string
+header_stamp()
+{
+	std::vector<std::string> names;
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	char hex[3];
+	std::string res;
+	struct dirent *de;
+	MD5_CTX md5;
+	DIR *d;
+
+	d = opendir("..");
+	while (d && (de = readdir(d))) {
+		std::string n = de->d_name;
+
+		if ((n.size() > 2) && (n.compare(n.size() - 2, 2, ".h") == 0)) {
+			names.push_back(n);
+		}
+	}
+	if (d) {
+		closedir(d);
+	}
+	std::sort(names.begin(), names.end());
+
+	MD5_Init(&md5);
+	for (size_t i=0; i<names.size(); i++) {
+		char buf[65536];
+		size_t n;
+		FILE *f;
+
+		MD5_Update(&md5, names[i].c_str(), names[i].size() + 1);
+		f = fopen(("../" + names[i]).c_str(), "r");
+		while (f && ((n = fread(buf, 1, sizeof(buf), f)) > 0)) {
+			MD5_Update(&md5, buf, n);
+		}
+		if (f) {
+			fclose(f);
+		}
+	}
+	MD5_Final(digest, &md5);
+
+	for (int i=0; i<MD5_DIGEST_LENGTH; i++) {
+		sprintf(hex, "%02x", digest[i]);
+		res += hex;
+	}
+
+	return res;
+}
+
+/* what a half is built as besides the tier flags, libs go after it */
+static void
+half_args(bool is_instr, std::vector<std::string> &args,
+	std::vector<std::string> &libs)
+{
+#ifdef INSTR_TCC
+	if (is_instr) {
+		args.push_back("-fPIC");
+		args.push_back("-shared");
+		libs.push_back("-lm");
+	}
+#else
+	(void)is_instr;
+	(void)libs;
+	args.push_back("-c");
+#endif
+}
+
 bool InstrApp::OnInit()
 {
+	/* a killed player shows up as a failed write, not as a signal */
+	signal(SIGPIPE, SIG_IGN);
+
 	InstrFrame *frame = new InstrFrame( "Instr",
 		wxPoint(50, 50), wxSize(750, 400) );
 	frame->Show( true );
@@ -53,11 +411,16 @@ bool InstrApp::OnInit()
 
 InstrFrame::InstrFrame(const wxString& title,
 		const wxPoint& pos, const wxSize& size)
-        : wxFrame(NULL, wxID_ANY, title, pos, size)
+        : wxFrame(NULL, wxID_ANY, title, pos, size),
+	worker(NULL), generation(0), optimizer(NULL)
 {
 	wxMenu *menuFile = new wxMenu;
 	menuFile->Append(ID_Play, "&Play...\tCtrl-P",
 		"Compile & play");
+	menuFile->Append(ID_PlayRegion, "Play &Region...\tCtrl-R",
+		"Loop a part of the piece until Stop");
+	menuFile->Append(ID_Stop, "&Stop\tCtrl-.",
+		"Stop playing");
 	menuFile->AppendSeparator();
 	menuFile->Append(wxID_EXIT);
 	wxMenu *menuHelp = new wxMenu;
@@ -87,8 +450,19 @@ InstrFrame::InstrFrame(const wxString& title,
 	sizer->Add(notes, 1, wxEXPAND);
 	SetSizer(sizer);
 
-	CreateStatusBar();
+	CreateStatusBar(2);
 	SetStatusText( "Ready" );
+
+	if (!cache.Open()) {
+		wxLogMessage("Can't create the build cache directory");
+	}
+	SetStatusText(cache.Stats(), 1);
+}
+
+InstrFrame::~InstrFrame()
+{
+	StopWorker();
+	StopOptimizer();
 }
 
 void InstrFrame::OnExit(wxCommandEvent &)
@@ -122,60 +496,1016 @@ calc_md5(const wxString &in)
 	return res;
 }
 
+BuildCache::BuildCache()
+	: lock_fd(-1), tick(0), bytes(0),
+	max_bytes((size_t)INSTR_CACHE_MB << 20), hits(0), misses(0),
+	evictions(0)
+{
+}
 
-void InstrFrame::OnPlay(wxCommandEvent &)
+BuildCache::~BuildCache()
 {
-	wxString tmpl_str, instr_str, notes_str;
-	wxString out_name;
+	if (lock_fd >= 0) {
+		close(lock_fd);
+	}
+}
 
-	SetStatusText("Compiling");
+/* find the directory, read the index, adopt files it does not know */
+bool BuildCache::Open()
+{
+	const char *env;
+	struct dirent *de;
+	DIR *d;
 
-	wxFile tmpl("template.c");
-	if (!tmpl.IsOpened()) {
-		wxLogMessage("Can't open template.c");
-		SetStatusText("Ready");
-		return;
+	if ((env = getenv("INSTR_CACHE"))) {
+		dir = env;
+	} else if ((env = getenv("XDG_CACHE_HOME"))) {
+		dir = std::string(env) + "/instr";
+	} else if ((env = getenv("HOME"))) {
+		dir = std::string(env) + "/.cache/instr";
+	} else {
+		dir = "cache";
+	}
+	if ((env = getenv("INSTR_CACHE_MB"))) {
+		max_bytes = (size_t)atol(env) << 20;
 	}
 
-	if (!tmpl.ReadAll(&tmpl_str)) {
-		wxLogMessage("Can't read template.c");
-		SetStatusText("Ready");
+	if (!wxFileName::Mkdir(dir, 0777, wxPATH_MKDIR_FULL)) {
+		return false;
+	}
+
+	lock_fd = open(Path("lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+		0666);
+	if (lock_fd < 0) {
+		return false;
+	}
+
+	wxMutexLocker locker(lock);
+	IndexLocker index_locker(lock_fd);
+
+	Merge();
+
+	/* leftovers of killed builds go, files missing in the index count
+	 * as the oldest, builds of other instr running go on. Files are put
+	 * in under the lock, none is on its way into the index */
+	d = opendir(dir.c_str());
+	while (d && (de = readdir(d))) {
+		std::string n = de->d_name;
+		struct stat st;
+		Entry e;
+
+		if ((n == ".") || (n == "..") || (n == "index") || (n == "lock")
+			|| entries.count(n)) {
+
+			continue;
+		}
+		if (n.find(".tmp") != std::string::npos) {
+			if (Stale(n)) {
+				unlink(Path(n).c_str());
+			}
+			continue;
+		}
+		if (stat(Path(n).c_str(), &st) != 0) {
+			continue;
+		}
+
+		e.size = st.st_size;
+		e.used = 0;
+		e.pins = 0;
+		entries[n] = e;
+		bytes += e.size;
+	}
+	if (d) {
+		closedir(d);
+	}
+
+	Evict();
+	Save();
+
+	return true;
+}
+
+std::string BuildCache::Path(const std::string &name)
+{
+	return dir + "/" + name;
+}
+
+/* name.id.pid.tmp, nobody else writes it */
+std::string BuildCache::Temp(const std::string &name, unsigned long id)
+{
+	return Path(name) + wxString::Format(".%lu.%ld.tmp", id,
+		(long)getpid()).ToStdString();
+}
+
+/* a temporary of a process that is gone, or of none at all */
+bool BuildCache::Stale(const std::string &name)
+{
+	size_t end = name.find(".tmp"), dot;
+	long pid;
+	char *p;
+
+	if ((end == 0)
+		|| ((dot = name.rfind('.', end - 1)) == std::string::npos)) {
+
+		return true;
+	}
+	pid = strtol(name.c_str() + dot + 1, &p, 10);
+	if ((p != name.c_str() + end) || (pid <= 0)) {
+		return true;
+	}
+	/* an earlier instr of the same pid is gone too */
+	if (pid == (long)getpid()) {
+		return true;
+	}
+
+	return !Alive(pid);
+}
+
+bool BuildCache::Alive(long pid)
+{
+	return (pid > 0) && ((kill((pid_t)pid, 0) == 0) || (errno != ESRCH));
+}
+
+/*
+ * under both locks, what other instr did since: their entries and uses
+ * come in, files they evicted go, their pins are taken from the index
+ */
+void BuildCache::Merge()
+{
+	std::map<std::string, Entry>::iterator it;
+	char line[1024], name[256];
+	unsigned long long used;
+	unsigned long size;
+	FILE *f;
+
+	for (it=entries.begin(); it!=entries.end(); ++it) {
+		it->second.holders.clear();
+	}
+
+	f = fopen(Path("index").c_str(), "r");
+	while (f && fgets(line, sizeof(line), f)) {
+		std::vector<long> holders;
+		const char *p;
+		int len;
+
+		if (sscanf(line, "%255s %lu %llu%n", name, &size, &used,
+			&len) != 3) {
+
+			continue;
+		}
+		/* pids of the instr using it, ours is in pins */
+		for (p=line+len; ; ) {
+			char *end;
+			long pid = strtol(p, &end, 10);
+
+			if (end == p) {
+				break;
+			}
+			if ((pid != (long)getpid()) && Alive(pid)) {
+				holders.push_back(pid);
+			}
+			p = end;
+		}
+
+		it = entries.find(name);
+		if (it == entries.end()) {
+			Entry e;
+
+			e.size = size;
+			e.used = used;
+			e.pins = 0;
+			it = entries.insert(std::make_pair(std::string(name),
+				e)).first;
+		} else if (used > it->second.used) {
+			it->second.used = used;
+		}
+		it->second.holders = holders;
+		if (used > tick) {
+			tick = used;
+		}
+	}
+	if (f) {
+		fclose(f);
+	}
+
+	bytes = 0;
+	for (it=entries.begin(); it!=entries.end(); ) {
+		struct stat st;
+
+		if (stat(Path(it->first).c_str(), &st) != 0) {
+			entries.erase(it++);
+			continue;
+		}
+		it->second.size = st.st_size;
+		bytes += it->second.size;
+		++it;
+	}
+}
+
+/* without counting or pinning */
+bool BuildCache::Has(const std::string &name)
+{
+	wxMutexLocker locker(lock);
+	IndexLocker index_locker(lock_fd);
+
+	Merge();
+
+	return entries.count(name) > 0;
+}
+
+/* true and pinned if the cache has it */
+bool BuildCache::Get(const std::string &name)
+{
+	wxMutexLocker locker(lock);
+	IndexLocker index_locker(lock_fd);
+	std::map<std::string, Entry>::iterator it;
+
+	Merge();
+	it = entries.find(name);
+	if (it == entries.end()) {
+		misses++;
+		return false;
+	}
+
+	hits++;
+	it->second.used = ++tick;
+	it->second.pins++;
+	Save();
+
+	return true;
+}
+
+/* move a finished build in, pinned */
+bool BuildCache::Put(const std::string &tmp, const std::string &name)
+{
+	wxMutexLocker locker(lock);
+	IndexLocker index_locker(lock_fd);
+	std::map<std::string, Entry>::iterator it;
+	struct stat st;
+	Entry e;
+
+	/* in the index before anybody else looks at the directory */
+	if ((rename(tmp.c_str(), Path(name).c_str()) != 0)
+		|| (stat(Path(name).c_str(), &st) != 0)) {
+
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	Merge();
+	e.size = st.st_size;
+	e.used = ++tick;
+	e.pins = 1;
+	it = entries.find(name);
+	if (it != entries.end()) {
+		/* built twice at once, the file is the same */
+		bytes -= it->second.size;
+		e.pins += it->second.pins;
+		e.holders = it->second.holders;
+	}
+	entries[name] = e;
+	bytes += e.size;
+
+	Evict();
+	Save();
+
+	return true;
+}
+
+void BuildCache::Release(const std::string &name)
+{
+	wxMutexLocker locker(lock);
+	IndexLocker index_locker(lock_fd);
+	std::map<std::string, Entry>::iterator it;
+
+	Merge();
+	it = entries.find(name);
+	if ((it != entries.end()) && (it->second.pins > 0)) {
+		it->second.pins--;
+	}
+	Evict();
+	Save();
+}
+
+wxString BuildCache::Stats()
+{
+	wxMutexLocker locker(lock);
+
+	return wxString::Format("cache: %lu hits, %lu misses, %lu evicted, "
+		"%.1f of %lu MiB", (unsigned long)hits, (unsigned long)misses,
+		(unsigned long)evictions, bytes / 1048576.0,
+		(unsigned long)(max_bytes >> 20));
+}
+
+/*
+ * under both locks after Merge(), files in use here or by another instr
+ * stay even over the size
+ */
+void BuildCache::Evict()
+{
+	while (bytes > max_bytes) {
+		std::map<std::string, Entry>::iterator it, lru = entries.end();
+
+		for (it=entries.begin(); it!=entries.end(); ++it) {
+			if ((it->second.pins == 0) && it->second.holders.empty()
+				&& ((lru == entries.end())
+				|| (it->second.used < lru->second.used))) {
+
+				lru = it;
+			}
+		}
+		if (lru == entries.end()) {
+			break;
+		}
+
+		unlink(Path(lru->first).c_str());
+		bytes -= lru->second.size;
+		evictions++;
+		entries.erase(lru);
+	}
+}
+
+/* under both locks, through a temporary like the builds */
+void BuildCache::Save()
+{
+	std::string tmp = Temp("index", 0);
+	std::map<std::string, Entry>::iterator it;
+	FILE *f;
+
+	f = fopen(tmp.c_str(), "w");
+	if (!f) {
 		return;
 	}
+	for (it=entries.begin(); it!=entries.end(); ++it) {
+		const std::vector<long> &h = it->second.holders;
 
-	instr_str = instr->GetValue();
-	notes_str = notes->GetValue();
+		fprintf(f, "%s %lu %llu", it->first.c_str(),
+			(unsigned long)it->second.size, it->second.used);
+		if (it->second.pins > 0) {
+			fprintf(f, " %ld", (long)getpid());
+		}
+		for (size_t i=0; i<h.size(); i++) {
+			fprintf(f, " %ld", h[i]);
+		}
+		fprintf(f, "\n");
+	}
+	if (fclose(f) == 0) {
+		rename(tmp.c_str(), Path("index").c_str());
+	} else {
+		unlink(tmp.c_str());
+	}
+}
 
-	wxRegEx re_code_instr("%%CODE_INSTR%%");
-	re_code_instr.ReplaceAll(&tmpl_str, instr_str);
+Worker::Worker(wxEvtHandler *frame, BuildCache *cache, long generation)
+	: wxThread(wxTHREAD_JOINABLE), cache(cache), frame(frame),
+	generation(generation), cancelled(false)
+{
+}
 
-	wxRegEx re_code_notes("%%CODE_NOTES%%");
-	re_code_notes.ReplaceAll(&tmpl_str, notes_str);
+Worker::~Worker()
+{
+	for (size_t i=0; i<pinned.size(); i++) {
+		cache->Release(pinned[i]);
+	}
+}
 
-	out_name = calc_md5(tmpl_str);
-	if (!wxFileName::FileExists(out_name + ".exe")) {
-		/* compile */
-		wxFile out(out_name + ".c", wxFile::write);
-		if (!out.Write(tmpl_str)) {
-			wxLogMessage("Can't write to output file");
-			SetStatusText("Ready");
-			return;
+void Worker::Post(int what, const wxString &msg)
+{
+	wxThreadEvent *ev = new wxThreadEvent(wxEVT_THREAD, ID_Worker);
+
+	ev->SetInt(what);
+	ev->SetExtraLong(generation);
+	ev->SetString(msg.Clone());
+	wxQueueEvent(frame, ev);
+}
+
+void Worker::Cancel()
+{
+	wxMutexLocker locker(lock);
+
+	cancelled = true;
+	for (size_t i=0; i<children.size(); i++) {
+		kill(children[i], SIGTERM);
+	}
+}
+
+bool Worker::Cancelled()
+{
+	wxMutexLocker locker(lock);
+
+	return cancelled;
+}
+
+/*
+ * run argv with stdin from in and stdout to out (-1 - inherited), nice
+ * is added to the child's nice value, env ("NAME=value") to its
+ * environment
+ */
+pid_t Worker::Spawn(const char *const argv[], int in, int out, int nice,
+	const char *env)
+{
+	wxMutexLocker locker(lock);
+	std::vector<char *> envp;
+	pid_t pid;
+
+	if (cancelled) {
+		return -1;
+	}
+
+	/* built here, the child may only exec */
+	for (char **e=environ; *e; e++) {
+		envp.push_back(*e);
+	}
+	if (env) {
+		envp.push_back(const_cast<char *>(env));
+	}
+	envp.push_back(NULL);
+
+	pid = fork();
+	if (pid == 0) {
+		signal(SIGPIPE, SIG_DFL);
+		if (nice) {
+			setpriority(PRIO_PROCESS, 0,
+				getpriority(PRIO_PROCESS, 0) + nice);
+		}
+		if (in >= 0) {
+			dup2(in, 0);
+		}
+		if (out >= 0) {
+			dup2(out, 1);
+		}
+		execvpe(argv[0], const_cast<char *const *>(argv), &envp[0]);
+		_exit(127);
+	}
+	if (pid > 0) {
+		children.push_back(pid);
+	}
+
+	return pid;
+}
+
+/* true if the child exited with 0 */
+bool Worker::Reap(pid_t pid)
+{
+	siginfo_t info;
+	int status = 0;
+	pid_t rc;
+
+	/* wait for the exit but leave the zombie, so Cancel() can't kill
+	 * somebody else under the same pid */
+	while ((waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0)
+		&& (errno == EINTR)) {
+	}
+
+	{
+		wxMutexLocker locker(lock);
+
+		for (size_t i=0; i<children.size(); i++) {
+			if (children[i] == pid) {
+				children.erase(children.begin() + i);
+				break;
+			}
+		}
+	}
+
+	do {
+		rc = waitpid(pid, &status, 0);
+	} while ((rc < 0) && (errno == EINTR));
+
+	return (rc == pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+/* cache name of src built with args against the headers, <md5>.ext */
+std::string Worker::Name(const std::vector<std::string> &args,
+	const std::string &src, const std::string &ext)
+{
+	std::string key;
+
+	for (size_t i=0; i<args.size(); i++) {
+		key += args[i] + " ";
+	}
+	key += "\n" + header_stamp() + "\n" + src;
+
+	return calc_md5(key).ToStdString() + ext;
+}
+
+/* cc args -o name into the cache, pinned */
+bool Worker::Cc(const std::vector<std::string> &args, const std::string &name,
+	int nice)
+{
+	std::string tmp = cache->Temp(name, (unsigned long)GetId());
+	std::vector<const char *> argv;
+	pid_t pid;
+
+	argv.push_back("cc");
+	for (size_t i=0; i<args.size(); i++) {
+		argv.push_back(args[i].c_str());
+	}
+	argv.push_back("-o");
+	argv.push_back(tmp.c_str());
+	argv.push_back(NULL);
+
+	pid = Spawn(&argv[0], -1, -1, nice);
+	if ((pid < 0) || !Reap(pid)) {
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	if (!cache->Put(tmp, name)) {
+		return false;
+	}
+	pinned.push_back(name);
+
+	return true;
+}
+
+/* src built with args unless the cache has it, pinned as name */
+bool Worker::Build(const std::string &src, const std::vector<std::string> &args,
+	const std::vector<std::string> &libs, const std::string &ext, int nice,
+	std::string &name, wxString &errors)
+{
+	std::vector<std::string> cc;
+	std::string c;
+	bool ok;
+
+	name = Name(args, src, ext);
+	if (cache->Get(name)) {
+		pinned.push_back(name);
+		return true;
+	}
+
+	c = cache->Temp(name, (unsigned long)GetId()) + ".c";
+
+	wxFile out(c, wxFile::write);
+	if (!out.Write(src.data(), src.size())) {
+		errors = "Can't write to the build cache";
+		return false;
+	}
+	out.Close();
+
+	cc.push_back("-Wall");
+	cc.push_back("-pedantic");
+	cc.push_back("-Wextra");
+	cc.push_back("-I..");
+	cc.insert(cc.end(), args.begin(), args.end());
+	cc.push_back(c);
+	cc.insert(cc.end(), libs.begin(), libs.end());
+
+	ok = Cc(cc, name, nice);
+	unlink(c.c_str());
+	if (!ok) {
+		errors = "see the compiler output";
+	}
+
+	return ok;
+}
+
+PlayThread::PlayThread(wxEvtHandler *frame, BuildCache *cache,
+	long generation, const std::string &instr_src,
+	const std::string &notes_src, const std::string &expr, double from,
+	double to, bool loop)
+	: Worker(frame, cache, generation), instr_src(instr_src),
+	notes_src(notes_src), expr(expr), draft(false), from(from), to(to),
+	loop(loop)
+{
+#ifdef INSTR_TCC
+	instr_lib = NULL;
+	jit = NULL;
+#endif
+}
+
+/* the optimized build of a half if the cache has it, a draft otherwise */
+bool PlayThread::Pick(const std::string &src, bool is_instr,
+	std::string &name, wxString &errors)
+{
+	std::string ext = is_instr ? instr_ext : ".o";
+	std::vector<std::string> args, libs;
+
+	args = tier_args("INSTR_CFLAGS", INSTR_CFLAGS);
+	half_args(is_instr, args, libs);
+	name = Name(args, src, ext);
+	if (cache->Get(name)) {
+		pinned.push_back(name);
+		return true;
+	}
+
+	draft = true;
+	args = tier_args("INSTR_DRAFT_CFLAGS", INSTR_DRAFT_CFLAGS);
+	libs.clear();
+	half_args(is_instr, args, libs);
+
+	return Build(src, args, libs, ext, 0, name, errors);
+}
+
+#ifdef INSTR_TCC
+
+static void
+jit_error(void *opaque, const char *msg)
+{
+	wxString *errors = static_cast<wxString *>(opaque);
+
+	*errors += msg;
+	*errors += "\n";
+}
+
+/*
+ * instrument into a shared object, notes in memory with INSTR_JIT
+ * defined, template-notes.c then provides instr_play()
+ */
+bool PlayThread::Compile(wxString &errors)
+{
+	std::string so;
+	void *sym;
+
+	if (!Pick(instr_src, true, so, errors)) {
+		return false;
+	}
+
+	instr_lib = dlopen(cache->Path(so).c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!instr_lib) {
+		errors = dlerror();
+		return false;
+	}
+	sym = dlsym(instr_lib, "note_instr");
+	if (!sym) {
+		errors = "no note_instr in template-instr.c";
+		return false;
+	}
+
+	if (!expr.empty()) {
+		void *set = dlsym(instr_lib, "instr_expr");
+		int (*set_expr)(const char *, char *, size_t)
+			= reinterpret_cast<int (*)(const char *, char *, size_t)>(set);
+		char err[256];
+
+		if (!set_expr || (set_expr(expr.c_str(), err, sizeof(err)) != 0)) {
+			errors = set_expr ? err : "no instr_expr in template-expr.c";
+			return false;
+		}
+	}
+
+	jit = tcc_new();
+	if (!jit) {
+		errors = "can't create compiler state";
+		return false;
+	}
+
+	tcc_set_error_func(jit, &errors, &jit_error);
+	tcc_set_output_type(jit, TCC_OUTPUT_MEMORY);
+	tcc_add_include_path(jit, "..");
+	tcc_define_symbol(jit, "INSTR_JIT", "1");
+
+	if (tcc_compile_string(jit, notes_src.c_str()) != 0) {
+		return false;
+	}
+	tcc_add_symbol(jit, "note_instr", sym);
+	tcc_add_library(jit, "m");
+	tcc_add_library(jit, "pthread");
+
+#ifdef TCC_RELOCATE_AUTO
+	return tcc_relocate(jit, TCC_RELOCATE_AUTO) >= 0;
+#else
+	return tcc_relocate(jit) >= 0;
+#endif
+}
+
+#else
+
+/* both halves into objects, linked into an executable */
+bool PlayThread::Compile(wxString &errors)
+{
+	std::string instr_obj, notes_obj;
+	std::vector<std::string> link;
+
+	if (!Pick(instr_src, true, instr_obj, errors)
+		|| !Pick(notes_src, false, notes_obj, errors)) {
+
+		return false;
+	}
+
+	exe = calc_md5(instr_obj + notes_obj).ToStdString() + ".exe";
+	if (cache->Get(exe)) {
+		pinned.push_back(exe);
+		return true;
+	}
+
+	link.push_back(cache->Path(instr_obj));
+	link.push_back(cache->Path(notes_obj));
+	link.push_back("-lm");
+	link.push_back("-pthread");
+	if (!Cc(link, exe, 0)) {
+		errors = "can't link";
+		return false;
+	}
+
+	return true;
+}
+
+#endif
+
+/* render the piece or the region once into fd */
+bool PlayThread::Render(int fd)
+{
+#ifdef INSTR_TCC
+	void *sym = tcc_get_symbol(jit, "instr_play");
+	int (*play)(int, double, double)
+		= reinterpret_cast<int (*)(int, double, double)>(sym);
+
+	return play && (play(fd, from, to) == 0);
+#else
+	std::string path = cache->Path(exe);
+	std::string start = wxString::Format("%g", from).ToStdString();
+	std::string stop = wxString::Format("%g", to).ToStdString();
+	std::string env = "INSTR_EXPR=" + expr;
+	const char *const prog[] = {path.c_str(), start.c_str(),
+		stop.c_str(), NULL};
+	pid_t pid = Spawn(prog, -1, fd, 0,
+		expr.empty() ? NULL : env.c_str());
+
+	return (pid > 0) && Reap(pid);
+#endif
+}
+
+/* renderer -> pipe -> aplay, one player for all passes of a loop */
+bool PlayThread::Play()
+{
+	const char *const aplay[] = {"aplay", "-q", "-f", "S16_LE",
+		"-r", "44100", "-c", "2", NULL};
+	int fd[2];
+	pid_t player;
+	bool ok;
+
+	/* children must not keep the other end open, not even compilers
+	 * forked by the optimizer while the pipe is made */
+	if (pipe2(fd, O_CLOEXEC) != 0) {
+		return false;
+	}
+
+	player = Spawn(aplay, fd[0], -1, 0);
+	close(fd[0]);
+	if (player < 0) {
+		close(fd[1]);
+		return false;
+	}
+
+	do {
+		ok = Render(fd[1]);
+	} while (ok && loop && !Cancelled());
+	close(fd[1]);
+
+	return Reap(player) && ok;
+}
+
+wxThread::ExitCode PlayThread::Entry()
+{
+	wxString errors;
+	wxStopWatch sw;
+
+	Post(PLAY_STATUS, "Compiling");
+
+	if (!Compile(errors)) {
+		if (!Cancelled()) {
+			Post(PLAY_ERROR, "can't compile:\n" + errors);
 		}
+		goto done;
+	}
+	if (Cancelled()) {
+		goto done;
+	}
+
+	Post(PLAY_STATUS, wxString::Format("%s %s build%s, ready in %ld ms",
+		loop ? "Looping region of" : "Playing",
+		draft ? "draft" : "optimized",
+		expr.empty() ? "" : " with interpreted instrument", sw.Time()));
+
+	if (!Play() && !Cancelled()) {
+		Post(PLAY_ERROR, "can't play");
+	}
+
+done:
+#ifdef INSTR_TCC
+	if (jit) {
+		tcc_delete(jit);
+	}
+	if (instr_lib) {
+		dlclose(instr_lib);
+	}
+#endif
+	Post(PLAY_DONE, Cancelled() ? "Stopped" : "Ready");
 
-		wxString cmd = "cc -Wall -pedantic -Wextra " + out_name + ".c"
-			+ " -o " + out_name + ".exe" + " -lm";
+	return 0;
+}
+
+OptimizeThread::OptimizeThread(wxEvtHandler *frame, BuildCache *cache,
+	const std::string &instr_src, const std::string &notes_src)
+	: Worker(frame, cache, 0), instr_src(instr_src), notes_src(notes_src)
+{
+}
 
-		wxExecute(cmd, wxEXEC_SYNC | wxEXEC_SHOW_CONSOLE);
-		if (!wxFileName::FileExists(out_name + ".exe")) {
-			wxLogMessage(wxString::Format("can't compile"));
-			SetStatusText("Ready");
-			return;
+wxThread::ExitCode OptimizeThread::Entry()
+{
+	wxString errors;
+	int built = 0;
+
+	for (int i=0; i<2; i++) {
+		const std::string &src = i ? notes_src : instr_src;
+		std::string ext = i ? ".o" : instr_ext;
+		std::vector<std::string> args, libs;
+		std::string name;
+
+#ifdef INSTR_TCC
+		/* notes are compiled in memory on every Play */
+		if (i == 1) {
+			break;
+		}
+#endif
+		args = tier_args("INSTR_CFLAGS", INSTR_CFLAGS);
+		half_args(i == 0, args, libs);
+		if (cache->Has(Name(args, src, ext))) {
+			continue;
 		}
+
+		/* niced, the draft is playing */
+		if (!Build(src, args, libs, ext, 10, name, errors)) {
+			if (!Cancelled()) {
+				Post(BUILD_DONE, "optimized build failed");
+			}
+			return 0;
+		}
+		built++;
 	}
 
-	wxString cmd = "./" + out_name + ".exe" + " | aplay -f S16_LE -r 44100 -c 2";
-	wxShell(cmd);
+	if (built) {
+		Post(BUILD_DONE, "optimized build ready for the next Play");
+	}
 
-	SetStatusText("Ready");
+	return 0;
 }
 
+/* one half of the template with its text box substituted */
+bool InstrFrame::MakeSource(const wxString &tmpl_name, const wxString &code,
+	const wxString &pattern, wxString &src)
+{
+	wxFile tmpl(tmpl_name);
+	if (!tmpl.IsOpened()) {
+		wxLogMessage("Can't open " + tmpl_name);
+		return false;
+	}
+
+	if (!tmpl.ReadAll(&src)) {
+		wxLogMessage("Can't read " + tmpl_name);
+		return false;
+	}
+
+	wxRegEx re_code(pattern);
+	re_code.ReplaceAll(&src, code);
+
+	return true;
+}
+
+/* kill what the worker runs and wait for it, the GUI waits very briefly */
+void InstrFrame::StopWorker()
+{
+	if (!worker) {
+		return;
+	}
+
+	worker->Cancel();
+	worker->Wait();
+	delete worker;
+	worker = NULL;
+}
+
+void InstrFrame::StopOptimizer()
+{
+	if (!optimizer) {
+		return;
+	}
+
+	optimizer->Cancel();
+	optimizer->Wait();
+	delete optimizer;
+	optimizer = NULL;
+}
+
+/* optimized builds of these sources, a run for older ones is dropped */
+void InstrFrame::Optimize(const std::string &instr_src,
+	const std::string &notes_src)
+{
+	std::string key = instr_src + '\0' + notes_src;
+
+	if (optimizer && optimizer->IsAlive() && (key == optimizing)) {
+		return;
+	}
+	StopOptimizer();
+
+	optimizer = new OptimizeThread(this, &cache, instr_src, notes_src);
+	if (optimizer->Run() != wxTHREAD_NO_ERROR) {
+		delete optimizer;
+		optimizer = NULL;
+		return;
+	}
+	optimizing = key;
+}
+
+void InstrFrame::OnPlay(wxCommandEvent &)
+{
+	Start(0.0, 0.0, false);
+}
+
+/* "from-to" or "from" in seconds */
+void InstrFrame::OnPlayRegion(wxCommandEvent &)
+{
+	wxString s;
+	double from, to = 0.0;
+
+	s = wxGetTextFromUser("Seconds to loop, from-to or from",
+		"Play region", region, this);
+	if (s.empty()) {
+		return;
+	}
+
+	if ((sscanf(s.c_str(), "%lf-%lf", &from, &to) < 1) || (from < 0.0)
+		|| ((to != 0.0) && (to <= from))) {
+
+		wxLogMessage("Not a region: " + s);
+		return;
+	}
+	region = s;
+
+	Start(from, to, true);
+}
+
+void InstrFrame::Start(double from, double to, bool loop)
+{
+	wxString instr_src, notes_src;
+	std::string code = instr->GetValue().ToStdString();
+	struct expr *e;
+	char err[256];
+
+	/* a new Play supersedes the one in flight */
+	StopWorker();
+
+	/* an expression runs on the interpreter, no need to compile it */
+	e = expr_compile(code.c_str(), err, sizeof(err));
+	if (e) {
+		expr_free(e);
+	} else {
+		code.clear();
+	}
+
+	if (!MakeSource(code.empty() ? "template-instr.c" : "template-expr.c",
+		instr->GetValue(), "%%CODE_INSTR%%", instr_src)
+		|| !MakeSource("template-notes.c", notes->GetValue(),
+		"%%CODE_NOTES%%", notes_src)) {
+
+		SetStatusText("Ready");
+		return;
+	}
+
+	generation++;
+	worker = new PlayThread(this, &cache, generation,
+		instr_src.ToStdString(), notes_src.ToStdString(), code,
+		from, to, loop);
+	if (worker->Run() != wxTHREAD_NO_ERROR) {
+		delete worker;
+		worker = NULL;
+		wxLogMessage("can't start playing");
+		return;
+	}
+
+	Optimize(instr_src.ToStdString(), notes_src.ToStdString());
+}
+
+void InstrFrame::OnStop(wxCommandEvent &)
+{
+	StopWorker();
+	SetStatusText("Stopped");
+}
+
+void InstrFrame::OnWorker(wxThreadEvent &event)
+{
+	SetStatusText(cache.Stats(), 1);
+
+	/* optimizer events are not tied to a Play */
+	if (event.GetInt() == BUILD_DONE) {
+		if (!worker || !worker->IsAlive()) {
+			SetStatusText(event.GetString());
+		}
+		return;
+	}
+
+	if (event.GetExtraLong() != generation) {
+		return;
+	}
+
+	switch (event.GetInt()) {
+	case PLAY_STATUS:
+	case PLAY_DONE:
+		SetStatusText(event.GetString());
+		break;
+	case PLAY_ERROR:
+		wxLogMessage(event.GetString());
+		break;
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * Instrument half for instruments instr interprets (expr.h) instead of
+ * compiling. The text comes from instr_expr() or $INSTR_EXPR, this file
+ * never changes, so it is built once and stays in the cache
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "timeline.h"
+#include "expr.h"
+
+static struct expr *prog;
+static pthread_once_t prog_once = PTHREAD_ONCE_INIT;
+
+/* the program from the environment unless instr_expr() set one */
+static void
+load_env(void)
+{
+	const char *src = getenv("INSTR_EXPR");
+	char err[256];
+
+	if (prog) {
+		return;
+	}
+
+	prog = expr_compile(src ? src : "", err, sizeof(err));
+	if (!prog) {
+		fprintf(stderr, "INSTR_EXPR: %s\n", err);
+	}
+}
+
+/* set the program, before anything is rendered */
+int
+instr_expr(const char *src, char *err, size_t errlen)
+{
+	struct expr *e;
+
+	e = expr_compile(src, err, errlen);
+	if (!e) {
+		return -1;
+	}
+
+	expr_free(prog);
+	prog = e;
+
+	return 0;
+}
+
+static void
+note_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	(void)voice;
+
+	pthread_once(&prog_once, &load_env);
+	if (!prog) {
+		memset(out, 0, n * sizeof(float));
+		return;
+	}
+
+	expr_eval(prog, ev->note, ev->seed, out, off, n);
+}
+
+/* used by the notes half */
+const struct tl_instr note_instr = {&note_render, 0, NULL, NULL};
@@ -0,0 +1,40 @@
+/*
+ * Instrument half of an instr piece, compiled on its own and cached by
+ * its content: editing notes does not rebuild it
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline.h"
+#include "freq.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+
+static double
+calc_tone(double t, int note)
+{
+	double tone;
+
+	%%CODE_INSTR%%
+
+	return tone;
+}
+
+static void
+note_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	size_t i;
+	(void)voice;
+
+	for (i=0; i<n; i++) {
+		out[i] = calc_tone((off + i) / R, ev->note);
+	}
+}
+
+/* used by the notes half */
+const struct tl_instr note_instr = {&note_render, 0, NULL, NULL};
@@ -0,0 +1,114 @@
+/*
+ * Notes half of an instr piece, linked with the instrument half
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline.h"
+#include "freq.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+
+/* from the instrument half */
+extern const struct tl_instr note_instr;
+
+static void
+add_note(struct timeline *tl, double start,
+	int note, double duration, double loudness)
+{
+	struct tl_event ev;
+	size_t tstart, tend;
+
+	tstart = start * R;
+	tend = tstart + duration * R;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = &note_instr;
+	ev.start = tstart;
+	ev.len = tend - tstart;
+	ev.loudness = loudness;
+	ev.note = note;
+
+	timeline_add(tl, &ev);
+}
+
+
+/*
+ * notes are kept as events and rendered block by block when played, so
+ * the start of the piece is heard while the rest is still rendering.
+ * Only seconds from .. to are rendered and played (to 0 - to the end)
+ */
+static struct timeline *
+make_piece(int fd, double from, double to)
+{
+	int bpm = 190;
+
+	double vol = 0.5;
+	double notelen = 60.0 / bpm / 4.0;
+	double where = 0.0;
+	size_t i;
+
+	struct timeline *tl;
+
+	tl = timeline_stream_init();
+	if (!tl) {
+		return NULL;
+	}
+	timeline_output(tl, fd);
+	timeline_window(tl, from * R, to * R);
+
+	where = 0.0;
+
+	%%CODE_NOTES%%
+
+	return tl;
+}
+
+static int
+play_piece(int fd, double from, double to)
+{
+	struct timeline *tl;
+	int rc;
+
+	tl = make_piece(fd, from, to);
+	if (!tl) {
+		return -1;
+	}
+
+	rc = timeline_play(tl);
+
+	timeline_free(tl);
+
+	return rc;
+}
+
+#ifdef INSTR_JIT
+
+/*
+ * entry point when instr compiles this file in memory: PCM goes to fd
+ * as it is rendered, a failed write (the player is gone) stops it
+ */
+int
+instr_play(int fd, double from, double to)
+{
+	return play_piece(fd, from, to);
+}
+
+#else
+
+/* optional arguments: seconds to start and to stop at */
+int
+main(int argc, char *argv[])
+{
+	double from = argc > 1 ? atof(argv[1]) : 0.0;
+	double to = argc > 2 ? atof(argv[2]) : 0.0;
+
+	return play_piece(fileno(stdout), from, to) == 0
+		? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * $ cc -g -Wall -pedantic -Wextra karplus-strong1.c  -o karplus-strong1 -lm
+ * $ cc -O2 -g -Wall -pedantic -Wextra karplus-strong1.c  -o karplus-strong1 -lm -pthread
  * $ ./karplus-strong1 | aplay -f S16_LE -r 44100 -c 2
  */
 
@@ -7,158 +7,83 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "timeline.h"
+#include "ks.h"
+
 
 static const double R = 44100;        /* sample rate (samples per second) */
-static const double maxamp = 1.0;     /* max. amplitude */
 
-typedef double (*instr_func)(double t, double fr, double overdrive);
+/* major chord on six strings, 1 ms apart */
+static const double chord[] = {1.0, 1.26f, 1.26f * 1.19f, 2.0f,
+	2.0f * 1.26f, 2.0f * 1.26f * 1.19f};
 
-struct timeline
-{
-	size_t n;
-	size_t end;
+#define NSTRINGS (sizeof(chord) / sizeof(chord[0]))
+#define STRUM ((size_t)(0.001 * R))
 
-	float *left, *right;
-	float min, max;
+struct ks_voice
+{
+	struct ks_set set;
+	int ready;
 };
 
-static struct timeline *
-timeline_init(size_t n)
+static void
+ks_chord_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	struct timeline *t;
+	struct ks_voice *v = voice;
 
-	t = malloc(sizeof(struct timeline));
-	if (!t) {
-		goto tmalloc_failed;
-	}
+	if (!v->ready) {
+		size_t len = ev->len - (NSTRINGS - 1) * STRUM;
+		size_t j;
 
-	t->left = calloc(n, sizeof(float));
-	if (!t->left) {
-		goto left_malloc_failed;
-	}
+		/* noise comes from the note, not from the order of rendering */
+		for (j=0; j<NSTRINGS; j++) {
+			if (ks_string(&v->set, R / (ev->fr * chord[j]),
+				j * STRUM, j * STRUM + len, ev->seed + j) != 0) {
 
-	t->right = calloc(n, sizeof(float));
-	if (!t->right) {
-		goto right_malloc_failed;
+				fprintf(stderr, "string of %.1f Hz not played\n",
+					ev->fr * chord[j]);
+			}
+		}
+		v->ready = 1;
 	}
 
-	t->n = n;
-	t->end = 0;
-
-	return t;
-
-right_malloc_failed:
-	free(t->left);
-
-left_malloc_failed:
-	free(t);
-
-tmalloc_failed:
-	return NULL;
+	ks_set_render(&v->set, out, off, n);
 }
 
 static void
-timeline_free(struct timeline *tl)
+ks_release(void *voice)
 {
-	free(tl->left);
-	free(tl->right);
-
-	tl->left = tl->right = NULL;
-	tl->n = tl->end = 0;
+	struct ks_voice *v = voice;
 
-	free(tl);
-}
-
-static void
-timeline_play(struct timeline *tl)
-{
-	size_t t;
-	for (t=0; t<tl->end; t++) {
-		int16_t tone;
-
-		if (tl->left[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->left[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->left[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
-
-		if (tl->right[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->right[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->right[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
-	}
+	ks_set_release(&v->set);
 }
 
+static const struct tl_instr ks_chord = {&ks_chord_render,
+	sizeof(struct ks_voice), &ks_release, NULL};
 
 static void
-karplus_strong(struct timeline *tl, double start, double fr,
+karplus_major_chord(struct timeline *tl, double start, double fr,
 	double duration, double loudness)
 {
-	size_t i, c;
-	double prev;
-	size_t init_len = R / fr;
-	double *init_waveform;
-	size_t tstart, tend, t;
-
-	init_waveform = malloc(sizeof(double) * init_len);
-
-	for (i=0; i<init_len; i++) {
-		init_waveform[i] = (double)rand() / (double)RAND_MAX;
-	}
+	struct tl_event ev;
+	size_t tstart, tend;
 
 	tstart = start * R;
 	tend = tstart + duration * R;
 
-	c = 0;
-	prev = 0.0f;
-	for (t=tstart; t<tend; t++) {
-		double tone;
-
-		init_waveform[c] = ((init_waveform[c] + prev) / 2.0) * 0.9999f;
-		tone = init_waveform[c];
-		prev = tone;
-		c = (c + 1) % init_len;
-
-		tone *= loudness;
-
-		if (t >= tl->n) {
-			break;
-		}
-		 /* first channel */
-		tl->left[t] += tone;
-
-		/* second channel */
-		tl->right[t] += tone;
-	}
-
-	if (t > tl->end) {
-		tl->end = t;
-	}
-
-	free(init_waveform);
-}
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = &ks_chord;
+	ev.start = tstart;
+	ev.len = tend - tstart + (NSTRINGS - 1) * STRUM;
+	ev.loudness = loudness / 6.0;
+	ev.fr = fr;
+	ev.seed = rand();
 
-static void
-karplus_major_chord(struct timeline *tl, double start, double fr,
-	double duration, double loudness)
-{
-	karplus_strong(tl, start, fr, duration, loudness / 6.0);
-	karplus_strong(tl, start + 0.001, fr * 1.26f, duration, loudness / 6.0);
-	karplus_strong(tl, start + 0.002, fr * 1.26f * 1.19f, duration, loudness / 6.0);
-	karplus_strong(tl, start + 0.003, fr * 2.0f, duration, loudness / 6.0);
-	karplus_strong(tl, start + 0.004, fr * 2.0f * 1.26f,
-		duration, loudness / 6.0);
-	karplus_strong(tl, start + 0.005, fr * 2.0f * 1.26f * 1.19f,
-		duration, loudness / 6.0);
+	timeline_add(tl, &ev);
 }
 
 int
@@ -174,7 +99,7 @@ main()
 
 	struct timeline *tl;
 
-	tl = timeline_init(100 * R);
+	tl = timeline_stream_init();
 	if (!tl) {
 		return EXIT_FAILURE;
 	}
@@ -186,11 +111,13 @@ main()
 		for (i=0; i<8; i++) {
 			karplus_major_chord(tl, where, fr, notelen * 1, vol);
 			where += notelen * 1;
+			timeline_flush_until(tl, where * R);
 		}
 
 		for (i=0; i<8; i++) {
 			karplus_major_chord(tl, where, fr * 1.33f, notelen * 1, vol);
 			where += notelen * 1;
+			timeline_flush_until(tl, where * R);
 		}
 	}
 
@@ -198,28 +125,33 @@ main()
 		for (i=0; i<8; i++) {
 			karplus_major_chord(tl, where, fr, notelen * 1, vol);
 			where += notelen * 1;
+			timeline_flush_until(tl, where * R);
 		}
 
 		for (i=0; i<8; i++) {
 			karplus_major_chord(tl, where, fr * 1.33f, notelen * 1, vol);
 			where += notelen * 1;
+			timeline_flush_until(tl, where * R);
 		}
 	}
 
 	for (i=0; i<8; i++) {
 		karplus_major_chord(tl, where, fr, notelen * 1, vol);
 		where += notelen * 1;
+		timeline_flush_until(tl, where * R);
 	}
 
 	for (i=0; i<8; i++) {
 		karplus_major_chord(tl, where, fr / 1.33f, notelen * 1, vol);
 		where += notelen * 1;
+		timeline_flush_until(tl, where * R);
 	}
 
 
 	timeline_play(tl);
 
 	timeline_free(tl);
+	ks_pool_free();
 
 	return EXIT_SUCCESS;
 }
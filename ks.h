@@ -0,0 +1,587 @@
+/*
+ * Karplus-Strong strings
+ *
+ * A string is a delay line fed back through a fractional delay allpass
+ * and the averaging lowpass the programs always used:
+ *
+ *   y[n] = (ap(y[n - N]) + y[n - 1]) / 2 * 0.9999
+ *
+ * The delay line starts with N samples of noise from a per-string
+ * xorshift generator. N and the allpass coefficient are chosen so the
+ * loop resonates right at the string frequency: first from the phase
+ * delay of the lowpass, then corrected with the resonance found as the
+ * root of the loop equation next to it (high notes decay within a few
+ * periods and sit off the unit circle). Truncating R / fr to N used to
+ * make every note flat, by 13 cent at 440 Hz and 69 at 2 kHz.
+ *
+ * Delay lines are power of two sized, positions wrap with a mask. They
+ * come from a pool that takes memory from malloc() a slab at a time and
+ * keeps released lines on free lists, notes do not allocate once the
+ * pool is warm. The pool is shared by all threads.
+ *
+ * Up to KS_LANES strings form a set rendered together. Their state is
+ * kept as arrays, one element per string: a chunk of the input of every
+ * string is gathered from the delay lines, then the loop runs for all
+ * strings at once sample by sample (the compiler makes vector code of
+ * it) and the output is scattered back. A chunk is never longer than
+ * the shortest active delay, so nothing it reads is written by it.
+ *
+ * The loop decays towards zero forever and ends up in subnormal floats,
+ * which are slow on x86. The timeline renders with flush-to-zero, for
+ * when it does not (other targets, -DTL_DENORMALS) the strings guard
+ * themselves: values under KS_FLUSH go into the delay line as 0 and
+ * subnormal loop state is cleared after every chunk, so a string that
+ * has faded out turns into exact zeros.
+ */
+#ifndef ks_h_included
+#define ks_h_included
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <float.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define KS_LANES 8            /* strings in a set */
+#define KS_CHUNK 64           /* samples gathered at once */
+#define KS_MIN_BITS 2
+#define KS_MAX_BITS 16        /* longest delay line 2^16 samples */
+#define KS_MAX_PERIOD ((double)(1U << KS_MAX_BITS) - 16)
+#define KS_SLAB 16            /* lines allocated at once */
+
+#define KS_GAIN (0.5f * 0.9999f)
+#define KS_FLUSH 1e-30f       /* quieter samples are stored as 0 */
+
+struct ks_slab
+{
+	struct ks_slab *next;
+};
+
+/* released lines, linked through their first bytes */
+struct ks_free
+{
+	struct ks_free *next;
+};
+
+struct ks_pool
+{
+	pthread_mutex_t lock;
+	struct ks_free *free[KS_MAX_BITS + 1];
+	struct ks_slab *slabs;
+};
+
+static struct ks_pool ks_pool = {PTHREAD_MUTEX_INITIALIZER, {NULL}, NULL};
+
+struct ks_set
+{
+	int nlanes;
+	size_t next;                  /* next sample of the set */
+
+	/* strings, relative to the start of the set */
+	size_t start[KS_LANES], end[KS_LANES];
+
+	float *line[KS_LANES];
+	unsigned bits[KS_LANES];
+	uint32_t mask[KS_LANES];
+	uint32_t pos[KS_LANES];       /* next write position */
+	uint32_t delay[KS_LANES];
+
+	float c[KS_LANES];            /* allpass coefficient */
+	float x1[KS_LANES], y1[KS_LANES];
+	float prev[KS_LANES];
+};
+
+static inline float *
+ks_line_get(unsigned bits)
+{
+	struct ks_pool *p = &ks_pool;
+	float *line = NULL;
+
+	pthread_mutex_lock(&p->lock);
+
+	if (!p->free[bits]) {
+		size_t size = sizeof(float) << bits;
+		struct ks_slab *s;
+		char *mem;
+		int i;
+
+		/* slab header padded to keep lines aligned */
+		s = malloc(64 + size * KS_SLAB);
+		if (!s) {
+			goto out;
+		}
+		s->next = p->slabs;
+		p->slabs = s;
+
+		mem = (char *)s + 64;
+		for (i=0; i<KS_SLAB; i++) {
+			struct ks_free *f = (struct ks_free *)(mem + size * i);
+
+			f->next = p->free[bits];
+			p->free[bits] = f;
+		}
+	}
+
+	line = (float *)p->free[bits];
+	p->free[bits] = p->free[bits]->next;
+
+out:
+	pthread_mutex_unlock(&p->lock);
+	return line;
+}
+
+static inline void
+ks_line_put(float *line, unsigned bits)
+{
+	struct ks_pool *p = &ks_pool;
+	struct ks_free *f = (struct ks_free *)line;
+
+	pthread_mutex_lock(&p->lock);
+	f->next = p->free[bits];
+	p->free[bits] = f;
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* give the memory back, no set may be in use */
+static inline void
+ks_pool_free(void)
+{
+	struct ks_pool *p = &ks_pool;
+
+	while (p->slabs) {
+		struct ks_slab *s = p->slabs;
+
+		p->slabs = s->next;
+		free(s);
+	}
+	memset(p->free, 0, sizeof(p->free));
+}
+
+static inline uint32_t
+ks_rand(uint32_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+
+	return *x;
+}
+
+/* a * ap(z) * z^-n + a * z^-1 - 1, zero at the loop resonances */
+static inline double complex
+ks_loop(double complex z, uint32_t n, double c)
+{
+	double complex zi = 1.0 / z, zn;
+	double a = -carg(z) * n;
+
+	zn = pow(cabs(z), -(double)n) * (cos(a) + I * sin(a));
+
+	return KS_GAIN * (c + zi) / (1.0 + c * zi) * zn + KS_GAIN * zi - 1.0;
+}
+
+/* angle of the resonance next to w, Newton from the unit circle */
+static inline double
+ks_resonance(double w, uint32_t n, double c)
+{
+	double complex z = cexp(I * w);
+	int k;
+
+	for (k=0; k<8; k++) {
+		double complex h = z * 1e-7, f, step;
+
+		f = ks_loop(z, n, c);
+		step = f * h / (ks_loop(z + h, n, c) - f);
+		z -= step;
+		if (cabs(step) < 1e-10) {
+			break;
+		}
+	}
+
+	return carg(z);
+}
+
+/* delay line length and allpass coefficient for a total delay */
+static inline uint32_t
+ks_delay(double rest, double w, double *c)
+{
+	uint32_t n;
+	double d;
+
+	/* allpass delay kept in [0.1, 1.1) */
+	n = rest > 1.1 ? (uint32_t)(rest - 0.1) : 1;
+	d = rest - n;
+	if (d < 0.0) {
+		d = 0.0;
+	}
+	*c = sin(w * (1.0 - d) / 2.0) / sin(w * (1.0 + d) / 2.0);
+
+	return n;
+}
+
+/*
+ * add a string with period in samples (R / fr) sounding from start to
+ * end of the set, set must be zeroed before the first one. Periods
+ * longer than a delay line holds (under 1 Hz) are clamped, -1 when the
+ * set is full, the period is not a number above 0 or out of memory
+ */
+static inline int
+ks_string(struct ks_set *s, double period, size_t start, size_t end,
+	uint32_t seed)
+{
+	int j = s->nlanes;
+	double w, rest, c;
+	uint32_t n, i;
+	unsigned bits;
+	int k;
+
+	if ((j == KS_LANES) || !(period > 0.0)) {
+		return -1;
+	}
+	if (period > KS_MAX_PERIOD) {
+		period = KS_MAX_PERIOD;
+	}
+
+	/*
+	 * phase delay of the lowpass y = a * (x + y[-1]) at the string
+	 * frequency, the rest of the period is the delay line and the
+	 * allpass
+	 */
+	w = 2.0 * M_PI / period;
+	rest = period - atan2(KS_GAIN * sin(w), 1.0 - KS_GAIN * cos(w)) / w;
+	n = ks_delay(rest, w, &c);
+
+	for (k=0; (k<4) && (n > 1); k++) {
+		double r = ks_resonance(w, n, c);
+
+		/* not the neighbouring resonance, keep what we have */
+		if (!isfinite(r) || (fabs(r - w) * n > M_PI)) {
+			break;
+		}
+		rest *= r / w;
+		n = ks_delay(rest, w, &c);
+		if (fabs(r - w) < w * 1e-7) {
+			break;
+		}
+	}
+
+	for (bits=KS_MIN_BITS; (1U << bits) <= n; bits++)
+		;
+	if (bits > KS_MAX_BITS) {
+		return -1;
+	}
+
+	s->line[j] = ks_line_get(bits);
+	if (!s->line[j]) {
+		return -1;
+	}
+	s->bits[j] = bits;
+	s->mask[j] = (1U << bits) - 1;
+	s->delay[j] = n;
+	s->pos[j] = n;
+
+	s->c[j] = c;
+	s->x1[j] = s->y1[j] = s->prev[j] = 0.0f;
+
+	s->start[j] = start;
+	s->end[j] = end;
+
+	/* xorshift must not start from 0 */
+	seed = seed * 2654435761U + 0x9e3779b9U;
+	if (seed == 0) {
+		seed = 1;
+	}
+	for (i=0; i<n; i++) {
+		s->line[j][i] = (ks_rand(&seed) >> 8) * (1.0f / 16777216.0f);
+	}
+
+	s->nlanes++;
+
+	return 0;
+}
+
+/* loop state that went subnormal, never the case with flush-to-zero on */
+static inline float
+ks_flush(float x)
+{
+	return fabsf(x) < FLT_MIN ? 0.0f : x;
+}
+
+#if defined(__SSE2__)
+static inline __m128
+ks_flush4(__m128 x)
+{
+	__m128 a = _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+
+	return _mm_and_ps(x, _mm_cmpge_ps(a, _mm_set1_ps(FLT_MIN)));
+}
+#endif
+
+/*
+ * the loop for the first lanes (4 or 8) of a chunk. Each string is a
+ * chain of dependent operations, the SSE version runs two groups of four
+ * strings side by side with the state in registers
+ */
+static inline void
+ks_set_loop(float in[][KS_LANES], float y[][KS_LANES], const float *c,
+	float *x1, float *y1, float *prev, const float *wt, float *out,
+	size_t n, int lanes)
+{
+	size_t i;
+
+#if defined(__SSE2__)
+	const __m128 g = _mm_set1_ps(KS_GAIN);
+	const __m128 fl = _mm_set1_ps(KS_FLUSH), sign = _mm_set1_ps(-0.0f);
+	__m128 wa = _mm_loadu_ps(wt), wb = _mm_loadu_ps(wt + 4);
+	__m128 ca = _mm_loadu_ps(c), cb = _mm_loadu_ps(c + 4);
+	__m128 xa = _mm_loadu_ps(x1), xb = _mm_loadu_ps(x1 + 4);
+	__m128 ya = _mm_loadu_ps(y1), yb = _mm_loadu_ps(y1 + 4);
+	__m128 pa = _mm_loadu_ps(prev), pb = _mm_loadu_ps(prev + 4);
+
+	for (i=0; i<n; i++) {
+		__m128 x = _mm_loadu_ps(in[i]), sum;
+
+		ya = _mm_add_ps(_mm_mul_ps(ca, _mm_sub_ps(x, ya)), xa);
+		xa = x;
+		pa = _mm_mul_ps(_mm_add_ps(ya, pa), g);
+		_mm_storeu_ps(y[i], _mm_and_ps(pa,
+			_mm_cmpge_ps(_mm_andnot_ps(sign, pa), fl)));
+		sum = _mm_mul_ps(pa, wa);
+
+		if (lanes > 4) {
+			x = _mm_loadu_ps(in[i] + 4);
+
+			yb = _mm_add_ps(_mm_mul_ps(cb, _mm_sub_ps(x, yb)), xb);
+			xb = x;
+			pb = _mm_mul_ps(_mm_add_ps(yb, pb), g);
+			_mm_storeu_ps(y[i] + 4, _mm_and_ps(pb,
+				_mm_cmpge_ps(_mm_andnot_ps(sign, pb), fl)));
+			sum = _mm_add_ps(sum, _mm_mul_ps(pb, wb));
+		}
+
+		/* strings silent at the moment have weight 0 */
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		_mm_store_ss(out + i, sum);
+	}
+
+	_mm_storeu_ps(x1, ks_flush4(xa));
+	_mm_storeu_ps(y1, ks_flush4(ya));
+	_mm_storeu_ps(prev, ks_flush4(pa));
+	if (lanes > 4) {
+		_mm_storeu_ps(x1 + 4, ks_flush4(xb));
+		_mm_storeu_ps(y1 + 4, ks_flush4(yb));
+		_mm_storeu_ps(prev + 4, ks_flush4(pb));
+	}
+#else
+	int j;
+
+	for (i=0; i<n; i++) {
+		float sum = 0.0f;
+
+		for (j=0; j<lanes; j++) {
+			float x = in[i][j], ap;
+
+			ap = c[j] * (x - y1[j]) + x1[j];
+			x1[j] = x;
+			y1[j] = ap;
+			prev[j] = (ap + prev[j]) * KS_GAIN;
+			y[i][j] = fabsf(prev[j]) < KS_FLUSH ? 0.0f : prev[j];
+			sum += prev[j] * wt[j];
+		}
+		out[i] = sum;
+	}
+
+	for (j=0; j<lanes; j++) {
+		x1[j] = ks_flush(x1[j]);
+		y1[j] = ks_flush(y1[j]);
+		prev[j] = ks_flush(prev[j]);
+	}
+#endif
+}
+
+/* a set of one string, straight on the delay line */
+static inline void
+ks_set_chunk1(struct ks_set *s, float *out, size_t n)
+{
+	float *line = s->line[0];
+	uint32_t pos = s->pos[0], delay = s->delay[0], mask = s->mask[0];
+	float c = s->c[0], x1 = s->x1[0], y1 = s->y1[0], prev = s->prev[0];
+	size_t i;
+
+	if ((s->next < s->start[0]) || (s->next >= s->end[0])) {
+		memset(out, 0, sizeof(float) * n);
+		s->next += n;
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+		float x = line[(pos - delay) & mask], ap;
+
+		ap = c * (x - y1) + x1;
+		x1 = x;
+		y1 = ap;
+		prev = (ap + prev) * KS_GAIN;
+		line[pos & mask] = fabsf(prev) < KS_FLUSH ? 0.0f : prev;
+		out[i] = prev;
+		pos++;
+	}
+
+	s->pos[0] = pos;
+	s->x1[0] = ks_flush(x1);
+	s->y1[0] = ks_flush(y1);
+	s->prev[0] = ks_flush(prev);
+	s->next += n;
+}
+
+/* next n samples of the set, n is at most KS_CHUNK */
+static inline void
+ks_set_chunk(struct ks_set *s, float *out, size_t n)
+{
+	float in[KS_CHUNK][KS_LANES], y[KS_CHUNK][KS_LANES];
+	float c[KS_LANES], x1[KS_LANES], y1[KS_LANES], prev[KS_LANES];
+	float wt[KS_LANES];
+	int on[KS_LANES];
+	float *line;
+	uint32_t pos, mask;
+	size_t i;
+	int j, nl;
+
+	if (s->nlanes == 1) {
+		ks_set_chunk1(s, out, n);
+		return;
+	}
+
+	/* gather */
+	nl = s->nlanes <= KS_LANES / 2 ? KS_LANES / 2 : KS_LANES;
+	for (j=0; j<nl; j++) {
+		on[j] = (j < s->nlanes) && (s->next >= s->start[j])
+			&& (s->next < s->end[j]);
+		wt[j] = on[j] ? 1.0f : 0.0f;
+
+		if (!on[j]) {
+			/* a string that has not started stays at zero */
+			for (i=0; i<n; i++) {
+				in[i][j] = 0.0f;
+			}
+			continue;
+		}
+		line = s->line[j];
+		pos = s->pos[j] - s->delay[j];
+		mask = s->mask[j];
+		for (i=0; i<n; i++) {
+			in[i][j] = line[(pos + i) & mask];
+		}
+	}
+
+	memcpy(c, s->c, sizeof(c));
+	memcpy(x1, s->x1, sizeof(x1));
+	memcpy(y1, s->y1, sizeof(y1));
+	memcpy(prev, s->prev, sizeof(prev));
+
+	/* all strings at once, small sets need no more than 4 lanes */
+	if (s->nlanes <= KS_LANES / 2) {
+		ks_set_loop(in, y, c, x1, y1, prev, wt, out, n,
+			KS_LANES / 2);
+	} else {
+		ks_set_loop(in, y, c, x1, y1, prev, wt, out, n, KS_LANES);
+	}
+
+	memcpy(s->x1, x1, sizeof(x1));
+	memcpy(s->y1, y1, sizeof(y1));
+	memcpy(s->prev, prev, sizeof(prev));
+
+	/* scatter */
+	for (j=0; j<s->nlanes; j++) {
+		if (!on[j]) {
+			continue;
+		}
+		line = s->line[j];
+		pos = s->pos[j];
+		mask = s->mask[j];
+		for (i=0; i<n; i++) {
+			line[(pos + i) & mask] = y[i][j];
+		}
+		s->pos[j] = pos + n;
+	}
+
+	s->next += n;
+}
+
+/* samples of the set until the next string starts or stops, max n */
+static inline size_t
+ks_set_span(const struct ks_set *s, size_t n)
+{
+	int j;
+
+	if (n > KS_CHUNK) {
+		n = KS_CHUNK;
+	}
+
+	for (j=0; j<s->nlanes; j++) {
+		size_t edge;
+
+		if (s->next < s->start[j]) {
+			edge = s->start[j];
+		} else if (s->next < s->end[j]) {
+			edge = s->end[j];
+			if (n > s->delay[j]) {
+				n = s->delay[j];
+			}
+		} else {
+			continue;
+		}
+		if (n > edge - s->next) {
+			n = edge - s->next;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * samples off .. off + n - 1 of the set, offsets may only grow. A set
+ * picked up in the middle runs silently up to off
+ */
+static inline void
+ks_set_render(struct ks_set *s, float *out, size_t off, size_t n)
+{
+	float skip[KS_CHUNK];
+
+	if (off < s->next) {
+		/* can not go back */
+		memset(out, 0, sizeof(float) * n);
+		return;
+	}
+
+	while (s->next < off) {
+		ks_set_chunk(s, skip, ks_set_span(s, off - s->next));
+	}
+
+	while (n > 0) {
+		size_t chunk = ks_set_span(s, n);
+
+		ks_set_chunk(s, out, chunk);
+		out += chunk;
+		n -= chunk;
+	}
+}
+
+static inline void
+ks_set_release(struct ks_set *s)
+{
+	int j;
+
+	for (j=0; j<s->nlanes; j++) {
+		ks_line_put(s->line[j], s->bits[j]);
+		s->line[j] = NULL;
+	}
+	s->nlanes = 0;
+}
+
+#endif
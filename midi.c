@@ -0,0 +1,284 @@
+/*
+ * MIDI files played with the instruments of the other pieces: the piano,
+ * Karplus-Strong strings for guitars, basses and harps, the drum kit of
+ * drums.c on channel 10. See smf.h
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra midi.c -o midi -lm -pthread
+ * $ ./midi song.mid | aplay -f S16_LE -r 44100 -c 2
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline.h"
+#include "freq.h"
+#include "osc.h"
+#include "ks.h"
+#include "smf.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+static void
+piano_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	osc_piano(voice, 2.0 * M_PI * ev->fr / R, out, off, n);
+}
+
+/* the envelope of osc.h */
+static size_t
+piano_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, OSC_PIANO_PEAK,
+		0.0004 * 2.0 * M_PI * ev->fr / R, level);
+}
+
+static const struct tl_instr instr_piano = {&piano_render,
+	sizeof(struct osc_piano), NULL, &piano_audible};
+
+struct ks_voice
+{
+	struct ks_set set;
+	int ready;
+};
+
+static void
+ks_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	struct ks_voice *v = voice;
+
+	if (!v->ready) {
+		/* noise comes from the note, not from the order of rendering */
+		if (ks_string(&v->set, R / ev->fr, 0, ev->len, ev->seed) != 0) {
+			fprintf(stderr, "string of %.1f Hz not played\n",
+				ev->fr);
+		}
+		v->ready = 1;
+	}
+
+	ks_set_render(&v->set, out, off, n);
+}
+
+static void
+ks_release(void *voice)
+{
+	struct ks_voice *v = voice;
+
+	ks_set_release(&v->set);
+}
+
+static const struct tl_instr ks_string_instr = {&ks_render,
+	sizeof(struct ks_voice), &ks_release, NULL};
+
+/* the kit of drums.c */
+struct drum_voice
+{
+	struct osc_exp env1, env2;
+};
+
+static void
+kick_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	struct drum_voice *v = voice;
+	double env[TL_BLOCK], ph[TL_BLOCK];
+	size_t i;
+
+	osc_exp(&v->env1, -4.0 / R, env, off, n);
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
+
+		ph[i] = 2*M_PI*t*ev->fr * exp(-t*20);
+	}
+
+	for (i=0; i<n; i++) {
+		out[i] = env[i] * sin(ph[i]);
+	}
+}
+
+static size_t
+kick_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, 1.0, 4.0 / R, level);
+}
+
+static const struct tl_instr instr_kick = {&kick_render,
+	sizeof(struct drum_voice), NULL, &kick_audible};
+
+static void
+tom_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	struct drum_voice *v = voice;
+	double env1[TL_BLOCK], env2[TL_BLOCK], ph1[TL_BLOCK], ph2[TL_BLOCK];
+	size_t i;
+
+	osc_exp(&v->env1, -4.0 / R, env1, off, n);
+	osc_exp(&v->env2, -2.0 / R, env2, off, n);
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
+
+		ph1[i] = 2*M_PI*t*ev->fr * exp(-t*20);
+		ph2[i] = 2*M_PI*t*ev->fr * exp(-t*5);
+	}
+
+	for (i=0; i<n; i++) {
+		out[i] = env1[i] * sin(ph1[i]) + env2[i] * sin(ph2[i]);
+	}
+}
+
+static size_t
+tom_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, 2.0, 2.0 / R, level);
+}
+
+static const struct tl_instr instr_tom = {&tom_render,
+	sizeof(struct drum_voice), NULL, &tom_audible};
+
+static void
+cym_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	double e[TL_BLOCK];
+	size_t i;
+	(void)voice;
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
+
+		e[i] = exp(-t*25);
+	}
+
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
+
+		out[i] = e[i] * tan(2*M_PI*t*ev->fr * e[i]);
+	}
+}
+
+/*
+ * |tan x| <= 2|x| for |x| <= 1, and x = 2 pi t fr e only shrinks after
+ * t = 1/25
+ */
+static size_t
+cym_audible(const struct tl_event *ev, double level)
+{
+	size_t i;
+
+	for (i=R/25; i<ev->len; i+=TL_BLOCK) {
+		double t = i / R;
+		double e = exp(-t*25);
+		double x = 2*M_PI*t*ev->fr * e;
+
+		if ((x <= 1.0) && (2.0 * x * e < level)) {
+			return i;
+		}
+	}
+
+	return ev->len;
+}
+
+static const struct tl_instr instr_cym = {&cym_render, 0, NULL,
+	&cym_audible};
+
+/* General MIDI programs and drum keys to the instruments above */
+static void
+map_init(struct smf_map *map)
+{
+	static const struct smf_patch piano = {&instr_piano, 0.02, 0, 0.0,
+		0.0};
+	static const struct smf_patch string = {&ks_string_instr, 0.5, 0,
+		0.0, 0.0};
+	static const struct smf_patch kick = {&instr_kick, 0.5, 30, 0.5,
+		0.0};
+	static const struct smf_patch tom = {&instr_tom, 0.2, 30, 0.5,
+		-0.2};
+	static const struct smf_patch cym = {&instr_cym, 0.005, 700, 0.3,
+		0.6};
+	static const unsigned char toms[] = {41, 43, 45, 47, 48, 50};
+	static const unsigned char cyms[] = {42, 44, 46, 49, 51, 52, 53, 55,
+		57, 59};
+	unsigned i;
+
+	memset(map, 0, sizeof(*map));
+
+	/* guitars, basses, harp, sitar .. koto are plucked, no effects */
+	for (i=0; i<120; i++) {
+		map->program[i] = piano;
+	}
+	for (i=24; i<40; i++) {
+		map->program[i] = string;
+	}
+	map->program[46] = string;
+	for (i=104; i<108; i++) {
+		map->program[i] = string;
+	}
+
+	map->drum[35] = kick;
+	map->drum[36] = kick;
+	/* no snare in the kit, a high tom stands in */
+	map->drum[37] = tom;
+	map->drum[37].note = 52;
+	map->drum[38] = tom;
+	map->drum[38].note = 48;
+	map->drum[40] = map->drum[38];
+	for (i=0; i<sizeof(toms); i++) {
+		map->drum[toms[i]] = tom;
+		map->drum[toms[i]].note = 28 + 3 * i;
+	}
+	for (i=0; i<sizeof(cyms); i++) {
+		map->drum[cyms[i]] = cym;
+	}
+	/* open hi-hat and crashes ring higher */
+	map->drum[46].note = 800;
+	map->drum[49].note = 800;
+	map->drum[57].note = 800;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct smf_map map;
+	struct timeline *tl;
+	struct smf f;
+	char err[256];
+	int rc;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file.mid\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	map_init(&map);
+
+	if (smf_open(&f, argv[1], err, sizeof(err)) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[1], err);
+		return EXIT_FAILURE;
+	}
+
+	tl = timeline_stream_init();
+	if (!tl) {
+		smf_close(&f);
+		return EXIT_FAILURE;
+	}
+	timeline_cache(tl, 0);
+
+	rc = smf_play(tl, &f, R, &map, err, sizeof(err));
+	if (rc != 0) {
+		fprintf(stderr, "%s: %s\n", argv[1], err);
+	} else {
+		rc = timeline_play(tl);
+	}
+
+	timeline_free(tl);
+	smf_close(&f);
+	ks_pool_free();
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,244 @@
+/*
+ * Phasor oscillator for the piano-like tone
+ *
+ *   k = 2 * M_PI * fr * t
+ *   tone = exp(-0.0004 * k) * (sin(k) + sin(2k) / 2 + ... + sin(6k) / 32)
+ *   tone += tone * tone * tone
+ *
+ * Instead of six sin() and six exp() per sample the phase is kept as a
+ * unit phasor (cos k, sin k) rotated by a fixed angle every sample,
+ * harmonics come from the Chebyshev recurrence
+ *
+ *   sin(hk) = 2 cos(k) sin((h-1)k) - sin((h-2)k)
+ *
+ * and the decay is a per-sample multiplication. Every OSC_RESEED samples
+ * of the note the phasor and the envelope are set again from cos(), sin()
+ * and exp(), so rounding does not pile up over long notes. Reseed points
+ * are fixed relative to the note start, the output does not depend on
+ * how the note is split into blocks.
+ *
+ * Against the direct formula computed in double the error stays below
+ * 2e-12 (tone before loudness) for notes of any length at audio
+ * frequencies, far under the rounding of the float output (6e-8 per
+ * unit). bench/osc-bench.c measures it.
+ */
+#ifndef osc_h_included
+#define osc_h_included
+
+#include <stddef.h>
+#include <math.h>
+
+#define OSC_RESEED 1024   /* samples between exact reseeds */
+#define OSC_CHUNK 256
+
+/*
+ * the harmonics add up to at most 63/32 times the envelope, with the
+ * cube the tone stays under OSC_PIANO_PEAK * exp(-0.0004 * k)
+ */
+#define OSC_PIANO_PEAK (63.0 / 32.0 * (1.0 + 63.0 / 32.0 * 63.0 / 32.0))
+
+struct osc_piano
+{
+	size_t next;     /* sample c, s and env belong to */
+	double c, s;     /* cos and sin of the phase */
+	double env;      /* exp(-0.0004 * phase) */
+
+	double w;        /* phase increment per sample */
+	double wc, ws;   /* rotation per sample */
+	double decay;    /* envelope factor per sample */
+	int ready;
+};
+
+static inline void
+osc_piano_seed(struct osc_piano *p, size_t t)
+{
+	double ph = p->w * t;
+
+	p->c = cos(ph);
+	p->s = sin(ph);
+	p->env = exp(-0.0004 * ph);
+	p->next = t;
+}
+
+static inline void
+osc_piano_step(struct osc_piano *p)
+{
+	double c = p->c, s = p->s;
+
+	p->c = c * p->wc - s * p->ws;
+	p->s = s * p->wc + c * p->ws;
+	p->env *= p->decay;
+	p->next++;
+
+	if ((p->next % OSC_RESEED) == 0) {
+		osc_piano_seed(p, p->next);
+	}
+}
+
+/*
+ * samples off .. off + n - 1 of a note with phase increment w
+ * (2 * M_PI * fr / R), state must be zeroed before the first call
+ */
+static inline void
+osc_piano(struct osc_piano *p, double w, float *out, size_t off, size_t n)
+{
+	double c[OSC_CHUNK], s[OSC_CHUNK], e[OSC_CHUNK];
+
+	if (!p->ready || (p->w != w)) {
+		p->w = w;
+		p->wc = cos(w);
+		p->ws = sin(w);
+		p->decay = exp(-0.0004 * w);
+		p->ready = 1;
+		osc_piano_seed(p, off - off % OSC_RESEED);
+	} else if (off != p->next) {
+		osc_piano_seed(p, off - off % OSC_RESEED);
+	}
+	while (p->next < off) {
+		osc_piano_step(p);
+	}
+
+	while (n > 0) {
+		size_t i, chunk = n < OSC_CHUNK ? n : OSC_CHUNK;
+
+		/* serial part, phasor and envelope */
+		for (i=0; i<chunk; i++) {
+			c[i] = p->c;
+			s[i] = p->s;
+			e[i] = p->env;
+			osc_piano_step(p);
+		}
+
+		/* harmonics, vectorizable */
+		for (i=0; i<chunk; i++) {
+			double c2 = 2.0 * c[i];
+			double s1, s2, s3, s4, s5, s6;
+			double tone;
+
+			s1 = s[i];
+			s2 = c2 * s1;
+			s3 = c2 * s2 - s1;
+			s4 = c2 * s3 - s2;
+			s5 = c2 * s4 - s3;
+			s6 = c2 * s5 - s4;
+
+			tone = e[i] * (s1 + s2 / 2.0 + s3 / 4.0 + s4 / 8.0
+				+ s5 / 16.0 + s6 / 32.0);
+
+			tone += tone * tone * tone;
+			out[i] = tone;
+		}
+
+		out += chunk;
+		n -= chunk;
+	}
+}
+
+/*
+ * Generic generators for block instruments, same reseeding scheme as
+ * the piano: exact values every OSC_RESEED samples of the note,
+ * recurrence in between
+ */
+
+/* exp(k * t) */
+struct osc_exp
+{
+	size_t next;
+	double v;
+	double k, f;
+	int ready;
+};
+
+static inline void
+osc_exp(struct osc_exp *e, double k, double *out, size_t off, size_t n)
+{
+	if (!e->ready || (e->k != k) || (off != e->next)) {
+		e->k = k;
+		e->f = exp(k);
+		e->next = off - off % OSC_RESEED;
+		e->v = exp(k * e->next);
+		e->ready = 1;
+	}
+
+	while (n > 0) {
+		size_t i, seg;
+		double v = e->v, f = e->f;
+		int skip = e->next < off;
+
+		seg = OSC_RESEED - e->next % OSC_RESEED;
+		if (skip && (seg > off - e->next)) {
+			seg = off - e->next;
+		} else if (!skip && (seg > n)) {
+			seg = n;
+		}
+
+		for (i=0; i<seg; i++) {
+			if (!skip) {
+				out[i] = v;
+			}
+			v *= f;
+		}
+
+		e->next += seg;
+		if (!skip) {
+			out += seg;
+			n -= seg;
+		}
+
+		if ((e->next % OSC_RESEED) == 0) {
+			v = exp(k * e->next);
+		}
+		e->v = v;
+	}
+}
+
+/* sin(w * t) */
+struct osc_sin
+{
+	size_t next;
+	double c, s;
+	double w, wc, ws;
+	int ready;
+};
+
+static inline void
+osc_sin_seed(struct osc_sin *p, size_t t)
+{
+	p->c = cos(p->w * t);
+	p->s = sin(p->w * t);
+	p->next = t;
+}
+
+static inline void
+osc_sin(struct osc_sin *p, double w, double *out, size_t off, size_t n)
+{
+	size_t i;
+
+	if (!p->ready || (p->w != w)) {
+		p->w = w;
+		p->wc = cos(w);
+		p->ws = sin(w);
+		p->ready = 1;
+		osc_sin_seed(p, off - off % OSC_RESEED);
+	} else if (off != p->next) {
+		osc_sin_seed(p, off - off % OSC_RESEED);
+	}
+
+	for (i=0; (p->next < off) || (i < n); ) {
+		double c = p->c, s = p->s;
+
+		if (p->next >= off) {
+			out[i++] = s;
+		}
+
+		p->c = c * p->wc - s * p->ws;
+		p->s = s * p->wc + c * p->ws;
+		p->next++;
+
+		if ((p->next % OSC_RESEED) == 0) {
+			osc_sin_seed(p, p->next);
+		}
+	}
+}
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * $ cc -Wall -pedantic -Wextra overdrive.c -o overdrive -lm
+ * $ cc -Wall -pedantic -Wextra overdrive.c -o overdrive -lm -pthread
  * $ ./overdrive 12345 | aplay -f S16_LE -r 44100 -c 2
  */
 
@@ -7,182 +7,143 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "timeline.h"
+#include "osc.h"
+
 
 static const double R = 44100;        /* sample rate (samples per second) */
-static const double maxamp = 1.0;     /* max. amplitude */
 
-typedef double (*instr_func)(double t, double fr, double overdrive);
 
-struct timeline
+static void
+piano_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	size_t n;
-	size_t end;
+	double overdrive = ev->param;
+	size_t i;
 
-	float *left, *right;
-	float min, max;
-};
+	osc_piano(voice, 2.0 * M_PI * ev->fr / R, out, off, n);
 
-static struct timeline *
-timeline_init(size_t n)
+	for (i=0; i<n; i++) {
+		if (out[i] >= overdrive) {
+			out[i] = overdrive;
+		} else if (out[i] <= -overdrive) {
+			out[i] = -overdrive;
+		}
+	}
+}
+
+/* the envelope of osc.h, clipping only makes it quieter */
+static size_t
+piano_audible(const struct tl_event *ev, double level)
 {
-	struct timeline *t;
+	return tl_decay_audible(ev, OSC_PIANO_PEAK,
+		0.0004 * 2.0 * M_PI * ev->fr / R, level);
+}
 
-	t = malloc(sizeof(struct timeline));
-	if (!t) {
-		goto tmalloc_failed;
-	}
+static const struct tl_instr instr_piano = {&piano_render,
+	sizeof(struct osc_piano), NULL, &piano_audible};
 
-	t->left = calloc(n, sizeof(float));
-	if (!t->left) {
-		goto left_malloc_failed;
-	}
+/*
+ * Instruments render a block at a time, see drums.c. Decays inside a
+ * phase are computed exactly, cymbal phases are huge.
+ */
+struct drum_voice
+{
+	struct osc_exp env1, env2;
+	struct osc_sin s1;
+};
 
-	t->right = calloc(n, sizeof(float));
-	if (!t->right) {
-		goto right_malloc_failed;
-	}
+static void
+cym2_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	struct drum_voice *v = voice;
+	double e[TL_BLOCK], s[TL_BLOCK];
+	size_t i;
 
-	t->n = n;
-	t->end = 0;
+	osc_sin(&v->s1, 2 * M_PI * ev->fr / R, s, off, n);
 
-	return t;
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-right_malloc_failed:
-	free(t->left);
+		e[i] = exp(-t*8);
+	}
 
-left_malloc_failed:
-	free(t);
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-tmalloc_failed:
-	return NULL;
+		out[i] = e[i] *
+		(
+			sin(2 * M_PI * t * ev->fr * e[i])
+			+ s[i] * 0.9f
+		);
+	}
 }
 
-static void
-timeline_free(struct timeline *tl)
+static size_t
+cym2_audible(const struct tl_event *ev, double level)
 {
-	free(tl->left);
-	free(tl->right);
-
-	tl->left = tl->right = NULL;
-	tl->n = tl->end = 0;
-
-	free(tl);
+	return tl_decay_audible(ev, 1.9, 8.0 / R, level);
 }
 
+static const struct tl_instr instr_cym2 = {&cym2_render,
+	sizeof(struct drum_voice), NULL, &cym2_audible};
+
 static void
-timeline_play(struct timeline *tl)
+tom_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	size_t t;
-	for (t=0; t<tl->end; t++) {
-		int16_t tone;
-
-		if (tl->left[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->left[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->left[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
-
-		if (tl->right[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->right[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->right[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
-	}
-}
+	struct drum_voice *v = voice;
+	double env1[TL_BLOCK], env2[TL_BLOCK], ph1[TL_BLOCK], ph2[TL_BLOCK];
+	size_t i;
 
+	osc_exp(&v->env1, -4.0 / R, env1, off, n);
+	osc_exp(&v->env2, -2.0 / R, env2, off, n);
 
-static double
-instr_piano(double t, double fr, double overdrive)
-{
-	double tone;
-
-	t *= 2.0 * M_PI * fr;
-
-	tone = sin(t) * exp(-0.0004 * t);
-                                                                
-	tone += sin(2.0 * t) * exp(-0.0004 * t) / 2.0;
-	tone += sin(3.0 * t) * exp(-0.0004 * t) / 4.0;
-	tone += sin(4.0 * t) * exp(-0.0004 * t) / 8.0;
-	tone += sin(5.0 * t) * exp(-0.0004 * t) / 16.0;
-	tone += sin(6.0 * t) * exp(-0.0004 * t) / 32.0;
- 
-	tone += tone * tone * tone;
-
-	if (tone >= overdrive) {
-		tone = overdrive;
-	} else if (tone <= -overdrive) {
-		tone = -overdrive;
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
+
+		ph1[i] = 2*M_PI*t*ev->fr * exp(-t*20);
+		ph2[i] = 2*M_PI*t*ev->fr * exp(-t*5);
 	}
-	return tone;
-}
 
-static double
-instr_cym2(double t, double fr, double overdrive)
-{
-	double tone;
-	(void)overdrive;
-
-	tone = exp(-t*8) *
-	(
-		sin(2 * M_PI * t * fr * exp(-t*8))
-		+ sin(2 * M_PI * t * fr) * 0.9f
-	);
-	return tone;
+	for (i=0; i<n; i++) {
+		out[i] = env1[i] * sin(ph1[i]) + env2[i] * sin(ph2[i]);
+	}
 }
 
-static double
-instr_tom(double t, double fr, double overdrive)
+static size_t
+tom_audible(const struct tl_event *ev, double level)
 {
-	double tone;
-	(void)overdrive;
-
-	tone = exp(-t*4) * sin(2*M_PI*t*fr * exp(-t*20))
-		+ exp(-t*2) * sin(2*M_PI*t*fr * exp(-t*5));
-
-	return tone;
+	return tl_decay_audible(ev, 2.0, 2.0 / R, level);
 }
 
+static const struct tl_instr instr_tom = {&tom_render,
+	sizeof(struct drum_voice), NULL, &tom_audible};
+
 static void
 add_note(struct timeline *tl, double start,
 	double fr, double duration, double loudness, double overdrive,
-	instr_func instr)
+	const struct tl_instr *instr)
 {
-	size_t tstart, tend, t;
+	struct tl_event ev;
+	size_t tstart, tend;
 
 	tstart = start * R;
 	tend = tstart + duration * R;
 
-	for (t=tstart; t<tend; t++) {
-		double tone;
-		double k;
-
-		k = (t - tstart) / R;
-
-		tone = (*instr)(k, fr, overdrive);
-
-		tone *= loudness;
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = instr;
+	ev.start = tstart;
+	ev.len = tend - tstart;
+	ev.loudness = loudness;
+	ev.fr = fr;
+	ev.param = overdrive;
 
-		if (t >= tl->n) {
-			break;
-		}
-		 /* first channel */
-		tl->left[t] += tone;
-
-		/* second channel */
-		tl->right[t] += tone;
-	}
-
-	if (t > tl->end) {
-		tl->end = t;
-	}
+	timeline_add(tl, &ev);
 }
 
 static void
@@ -231,6 +192,8 @@ main()
 	if (!tl) {
 		return EXIT_FAILURE;
 	}
+	timeline_threads(tl, 0);
+	timeline_cache(tl, 0);
 
 	where = 0.0;
 
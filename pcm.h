@@ -0,0 +1,245 @@
+/*
+ * Block PCM writer
+ *
+ * Converts float left/right planes to interleaved signed 16 bit samples
+ * (S16_LE, what aplay and ffmpeg are told to expect) and writes them
+ * out in large chunks. Samples are clamped to [-1.0, 1.0] and scaled by
+ * INT16_MAX with truncation, exactly as the old per-sample loop did.
+ *
+ * Conversion uses AVX2 or SSE2 when the compiler targets them (-mavx2,
+ * -march=native; SSE2 is always on for x86-64), scalar code otherwise.
+ *
+ * Built with -DPCM_F32 the writer outputs interleaved 32 bit floats
+ * (F32_LE) as they are, without clamping or scaling. bench/golden.c
+ * uses it to compare renders before quantization.
+ */
+#ifndef pcm_h_included
+#define pcm_h_included
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define PCM_BUF_FRAMES 8192   /* frames per write() */
+
+#ifdef PCM_F32
+typedef float pcm_t;
+#else
+typedef int16_t pcm_t;
+#endif
+
+struct pcm_writer
+{
+	int fd;
+	size_t used;   /* frames in buf */
+
+	pcm_t buf[PCM_BUF_FRAMES * 2];
+};
+
+static inline int16_t
+pcm_sample(float s)
+{
+	if (s > 1.0f) {
+		return INT16_MAX;
+	} else if (s < -1.0f) {
+		return -INT16_MAX;
+	}
+	return s * INT16_MAX;
+}
+
+#ifdef PCM_F32
+
+static inline void
+pcm_convert(float *dst, const float *left, const float *right, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		dst[i * 2 + 0] = left[i];
+		dst[i * 2 + 1] = right[i];
+	}
+}
+
+#else
+
+/* interleave and convert n frames */
+static inline void
+pcm_convert(int16_t *dst, const float *left, const float *right, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256 hi = _mm256_set1_ps(1.0f);
+	const __m256 lo = _mm256_set1_ps(-1.0f);
+	const __m256 scale = _mm256_set1_ps(INT16_MAX);
+
+	for (; i + 8 <= n; i += 8) {
+		__m256 l, r;
+		__m256i il, ir, p;
+
+		l = _mm256_loadu_ps(left + i);
+		r = _mm256_loadu_ps(right + i);
+
+		l = _mm256_max_ps(_mm256_min_ps(l, hi), lo);
+		r = _mm256_max_ps(_mm256_min_ps(r, hi), lo);
+
+		il = _mm256_cvttps_epi32(_mm256_mul_ps(l, scale));
+		ir = _mm256_cvttps_epi32(_mm256_mul_ps(r, scale));
+
+		/*
+		 * unpack and pack work within 128 bit lanes, so the result
+		 * is already in l0 r0 l1 r1 ... l7 r7 order
+		 */
+		p = _mm256_packs_epi32(_mm256_unpacklo_epi32(il, ir),
+			_mm256_unpackhi_epi32(il, ir));
+		_mm256_storeu_si256((__m256i *)(dst + i * 2), p);
+	}
+#elif defined(__SSE2__)
+	const __m128 hi = _mm_set1_ps(1.0f);
+	const __m128 lo = _mm_set1_ps(-1.0f);
+	const __m128 scale = _mm_set1_ps(INT16_MAX);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128 l, r;
+		__m128i il, ir, p;
+
+		l = _mm_loadu_ps(left + i);
+		r = _mm_loadu_ps(right + i);
+
+		l = _mm_max_ps(_mm_min_ps(l, hi), lo);
+		r = _mm_max_ps(_mm_min_ps(r, hi), lo);
+
+		il = _mm_cvttps_epi32(_mm_mul_ps(l, scale));
+		ir = _mm_cvttps_epi32(_mm_mul_ps(r, scale));
+
+		p = _mm_packs_epi32(_mm_unpacklo_epi32(il, ir),
+			_mm_unpackhi_epi32(il, ir));
+		_mm_storeu_si128((__m128i *)(dst + i * 2), p);
+	}
+#endif
+
+	for (; i<n; i++) {
+		dst[i * 2 + 0] = pcm_sample(left[i]);
+		dst[i * 2 + 1] = pcm_sample(right[i]);
+	}
+}
+
+#endif
+
+static inline int
+pcm_write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+
+	while (size > 0) {
+		ssize_t w;
+
+		w = write(fd, p, size);
+		if (w < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += w;
+		size -= w;
+	}
+
+	return 0;
+}
+
+static inline void
+pcm_writer_init(struct pcm_writer *w, int fd)
+{
+	w->fd = fd;
+	w->used = 0;
+}
+
+static inline int
+pcm_writer_flush(struct pcm_writer *w)
+{
+	int rc;
+
+	rc = pcm_write_all(w->fd, w->buf, w->used * 2 * sizeof(pcm_t));
+	w->used = 0;
+
+	return rc;
+}
+
+static inline int
+pcm_writer_put(struct pcm_writer *w, const float *left, const float *right,
+	size_t n)
+{
+	while (n > 0) {
+		size_t chunk = PCM_BUF_FRAMES - w->used;
+
+		if (chunk > n) {
+			chunk = n;
+		}
+
+		pcm_convert(w->buf + w->used * 2, left, right, chunk);
+		w->used += chunk;
+		left += chunk;
+		right += chunk;
+		n -= chunk;
+
+		if (w->used == PCM_BUF_FRAMES) {
+			if (pcm_writer_flush(w) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static inline int
+pcm_writer_silence(struct pcm_writer *w, size_t n)
+{
+	while (n > 0) {
+		size_t chunk = PCM_BUF_FRAMES - w->used;
+
+		if (chunk > n) {
+			chunk = n;
+		}
+
+		memset(w->buf + w->used * 2, 0, chunk * 2 * sizeof(pcm_t));
+		w->used += chunk;
+		n -= chunk;
+
+		if (w->used == PCM_BUF_FRAMES) {
+			if (pcm_writer_flush(w) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* write n frames to stdout */
+static inline int
+pcm_write(const float *left, const float *right, size_t n)
+{
+	static struct pcm_writer w;
+
+	/* anything left in stdio buffers goes first */
+	fflush(stdout);
+
+	pcm_writer_init(&w, fileno(stdout));
+	if (pcm_writer_put(&w, left, right, n) != 0) {
+		return -1;
+	}
+	return pcm_writer_flush(&w);
+}
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * $ cc -Wall -pedantic -Wextra random-cons.c -o random-cons -lm
+ * $ cc -Wall -pedantic -Wextra random-cons.c -o random-cons -lm -pthread
  * $ ./random-cons 12345 | aplay -f S16_LE -r 44100 -c 2
  */
 
@@ -7,171 +7,73 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "timeline.h"
+#include "freq.h"
+#include "osc.h"
 
-static const double R = 44100;        /* sample rate (samples per second) */
-static const double maxamp = 1.0;     /* max. amplitude */
-
-typedef double (*instr_func)(double t, double fr);
-
-struct timeline
-{
-	size_t n;
-	size_t end;
-
-	float *left, *right;
-	float min, max;
-};
-
-static struct timeline *
-timeline_init(size_t n)
-{
-	struct timeline *t;
-
-	t = malloc(sizeof(struct timeline));
-	if (!t) {
-		goto tmalloc_failed;
-	}
-
-	t->left = calloc(n, sizeof(float));
-	if (!t->left) {
-		goto left_malloc_failed;
-	}
 
-	t->right = calloc(n, sizeof(float));
-	if (!t->right) {
-		goto right_malloc_failed;
-	}
-
-	t->n = n;
-	t->end = 0;
-
-	return t;
-
-right_malloc_failed:
-	free(t->left);
+static const double R = 44100;        /* sample rate (samples per second) */
 
-left_malloc_failed:
-	free(t);
-
-tmalloc_failed:
-	return NULL;
-}
 
 static void
-timeline_free(struct timeline *tl)
+piano_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	free(tl->left);
-	free(tl->right);
-
-	tl->left = tl->right = NULL;
-	tl->n = tl->end = 0;
-
-	free(tl);
+	osc_piano(voice, 2.0 * M_PI * ev->fr / R, out, off, n);
 }
 
-static void
-timeline_play(struct timeline *tl)
+/* the envelope of osc.h */
+static size_t
+piano_audible(const struct tl_event *ev, double level)
 {
-	size_t t;
-	for (t=0; t<tl->end; t++) {
-		int16_t tone;
-
-		if (tl->left[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->left[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->left[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
-
-		if (tl->right[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->right[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->right[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
-	}
+	return tl_decay_audible(ev, OSC_PIANO_PEAK,
+		0.0004 * 2.0 * M_PI * ev->fr / R, level);
 }
 
-static double
-freq(int n)
-{
-	double f;
-
-	f = pow(2.0, ((double)n - 49.0) / 12.0) * 440.0;
-	return f;
-}
+static const struct tl_instr instr_piano = {&piano_render,
+	sizeof(struct osc_piano), NULL, &piano_audible};
 
 
-static double
-instr_piano(double t, double fr)
+static void
+sin_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	double tone;
-
-	t *= 2.0 * M_PI * fr;
-
-	tone = sin(t) * exp(-0.0004 * t);
-                                                                
-	tone += sin(2.0 * t) * exp(-0.0004 * t) / 2.0;
-	tone += sin(3.0 * t) * exp(-0.0004 * t) / 4.0;
-	tone += sin(4.0 * t) * exp(-0.0004 * t) / 8.0;
-	tone += sin(5.0 * t) * exp(-0.0004 * t) / 16.0;
-	tone += sin(6.0 * t) * exp(-0.0004 * t) / 32.0;
- 
-	tone += tone * tone * tone;
-	return tone;
-}
-
+	size_t i;
+	(void)voice;
 
-static double
-instr_sin(double t, double fr)
-{
-	double tone;
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-	t *= 2.0 * M_PI * fr;
+		t *= 2.0 * M_PI * ev->fr;
 
-	tone = sin(t);
-                                                                
-	return tone;
+		out[i] = sin(t);
+	}
 }
 
+static const struct tl_instr instr_sin = {&sin_render, 0, NULL, NULL};
+
 static void
 add_note(struct timeline *tl, double start,
-	double fr, double duration, double loudness, instr_func instr)
+	double fr, double duration, double loudness,
+	const struct tl_instr *instr)
 {
-	size_t tstart, tend, t;
+	struct tl_event ev;
+	size_t tstart, tend;
 
 	tstart = start * R;
 	tend = tstart + duration * R;
 
-	for (t=tstart; t<tend; t++) {
-		double tone;
-		double k;
-
-		k = (t - tstart) / R;
-
-		tone = (*instr)(k, fr);
-
-		tone *= loudness;
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = instr;
+	ev.start = tstart;
+	ev.len = tend - tstart;
+	ev.loudness = loudness;
+	ev.fr = fr;
 
-		if (t >= tl->n) {
-			break;
-		}
-		 /* first channel */
-		tl->left[t] += tone;
-
-		/* second channel */
-		tl->right[t] += tone;
-	}
-
-	if (t > tl->end) {
-		tl->end = t;
-	}
+	timeline_add(tl, &ev);
 }
 
 
@@ -194,7 +96,7 @@ main(int argc, char *argv[])
 
 	struct timeline *tl;
 
-	tl = timeline_init(100 * R);
+	tl = timeline_stream_init();
 	if (!tl) {
 		return EXIT_FAILURE;
 	}
@@ -215,6 +117,7 @@ main(int argc, char *argv[])
 		len = notelen * (rand() % 8);
 		add_note(tl, where, fr, len, vol * 0.5, &instr_piano);
 		where += len;
+		timeline_flush_until(tl, where * R);
 
 		fprintf(stderr, "len: %f, freq: %f\n", len, fr);
 	}
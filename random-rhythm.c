@@ -1,219 +1,226 @@
 /*
- * $ cc -g -Wall -pedantic -Wextra random-rhythm.c  -o random-rhythm -lm
+ * $ cc -O2 -g -Wall -pedantic -Wextra random-rhythm.c  -o random-rhythm -lm -pthread
  * $ ./random-rhythm | aplay -f S16_LE -r 44100 -c 2
  * or
  * $ ./random-rhythm <SEED> | aplay -f S16_LE -r 44100 -c 2
+ *
+ * -o file writes the notes as a compiled score instead of playing them,
+ * -i file plays one (see scorebin.h):
+ * $ ./random-rhythm <SEED> -o rhythm.scb
+ * $ ./random-rhythm -i rhythm.scb | aplay -f S16_LE -r 44100 -c 2
  */
 
 #include <stdio.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "timeline.h"
+#include "osc.h"
+#include "ks.h"
+#include "scorebin.h"
+
 #define L 12
 
 static const double R = 44100;        /* sample rate (samples per second) */
-static const double maxamp = 1.0;     /* max. amplitude */
 
-typedef double (*instr_func)(double t, double fr, double overdrive);
 
-struct timeline
+static void
+add_note(struct timeline *tl, double start,
+	double fr, double duration, double loudness, double overdrive,
+	const struct tl_instr *instr)
 {
-	size_t n;
-	size_t end;
+	struct tl_event ev;
+	size_t tstart, tend;
 
-	float *left, *right;
-	float min, max;
+	tstart = start * R;
+	tend = tstart + duration * R;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = instr;
+	ev.start = tstart;
+	ev.len = tend - tstart;
+	ev.loudness = loudness;
+	ev.fr = fr;
+	ev.param = overdrive;
+
+	timeline_add(tl, &ev);
+}
+
+/*
+ * Instruments render a block at a time, see drums.c. Decays inside a
+ * phase are computed exactly, cymbal phases are huge.
+ */
+struct drum_voice
+{
+	struct osc_exp env1, env2;
+	struct osc_sin s1;
 };
 
-static struct timeline *
-timeline_init(size_t n)
+static void
+cym_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	struct timeline *t;
+	struct drum_voice *v = voice;
+	double e[TL_BLOCK], s[TL_BLOCK];
+	size_t i;
 
-	t = malloc(sizeof(struct timeline));
-	if (!t) {
-		goto tmalloc_failed;
-	}
+	osc_sin(&v->s1, 2 * M_PI * ev->fr / R, s, off, n);
 
-	t->left = calloc(n, sizeof(float));
-	if (!t->left) {
-		goto left_malloc_failed;
-	}
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-	t->right = calloc(n, sizeof(float));
-	if (!t->right) {
-		goto right_malloc_failed;
+		e[i] = exp(-t*8);
 	}
 
-	t->n = n;
-	t->end = 0;
-
-	return t;
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-right_malloc_failed:
-	free(t->left);
-
-left_malloc_failed:
-	free(t);
+		out[i] = e[i] *
+		(
+			sin(2 * M_PI * t * ev->fr * e[i])
+			+ s[i] * 0.9f
+		);
+	}
+}
 
-tmalloc_failed:
-	return NULL;
+static size_t
+cym_audible(const struct tl_event *ev, double level)
+{
+	return tl_decay_audible(ev, 1.9, 8.0 / R, level);
 }
 
+static const struct tl_instr instr_cym = {&cym_render,
+	sizeof(struct drum_voice), NULL, &cym_audible};
+
 static void
-timeline_free(struct timeline *tl)
+tom_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
 {
-	free(tl->left);
-	free(tl->right);
+	struct drum_voice *v = voice;
+	double env1[TL_BLOCK], env2[TL_BLOCK], ph1[TL_BLOCK], ph2[TL_BLOCK];
+	size_t i;
 
-	tl->left = tl->right = NULL;
-	tl->n = tl->end = 0;
+	osc_exp(&v->env1, -4.0 / R, env1, off, n);
+	osc_exp(&v->env2, -2.0 / R, env2, off, n);
 
-	free(tl);
-}
+	for (i=0; i<n; i++) {
+		double t = (off + i) / R;
 
-static void
-timeline_play(struct timeline *tl)
-{
-	size_t t;
-	for (t=0; t<tl->end; t++) {
-		int16_t tone;
-
-		if (tl->left[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->left[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->left[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
+		ph1[i] = 2*M_PI*t*ev->fr * exp(-t*20);
+		ph2[i] = 2*M_PI*t*ev->fr * exp(-t*5);
+	}
 
-		if (tl->right[t] > maxamp) {
-			tone = INT16_MAX;
-		} else if (tl->right[t] < -maxamp) {
-			tone = -INT16_MAX;
-		} else {
-			tone = tl->right[t] * INT16_MAX;
-		}
-		fwrite(&tone, sizeof(int16_t), 1, stdout);
+	for (i=0; i<n; i++) {
+		out[i] = env1[i] * sin(ph1[i]) + env2[i] * sin(ph2[i]);
 	}
 }
 
-static void
-add_note(struct timeline *tl, double start,
-	double fr, double duration, double loudness, double overdrive,
-	instr_func instr)
+static size_t
+tom_audible(const struct tl_event *ev, double level)
 {
-	size_t tstart, tend, t;
-
-	tstart = start * R;
-	tend = tstart + duration * R;
-
-	for (t=tstart; t<tend; t++) {
-		double tone;
-		double k;
+	return tl_decay_audible(ev, 2.0, 2.0 / R, level);
+}
 
-		k = (t - tstart) / R;
+static const struct tl_instr instr_tom = {&tom_render,
+	sizeof(struct drum_voice), NULL, &tom_audible};
 
-		tone = (*instr)(k, fr, overdrive);
+struct ks_voice
+{
+	struct ks_set set;
+	int ready;
+};
 
-		tone *= loudness;
+static void
+ks_render(const struct tl_event *ev, void *voice, float *out,
+	size_t off, size_t n)
+{
+	struct ks_voice *v = voice;
 
-		if (t >= tl->n) {
-			break;
+	if (!v->ready) {
+		/* noise comes from the note, not from the order of rendering */
+		if (ks_string(&v->set, R / ev->fr, 0, ev->len, ev->seed) != 0) {
+			fprintf(stderr, "string of %.1f Hz not played\n",
+				ev->fr);
 		}
-		 /* first channel */
-		tl->left[t] += tone;
-
-		/* second channel */
-		tl->right[t] += tone;
+		v->ready = 1;
 	}
 
-	if (t > tl->end) {
-		tl->end = t;
-	}
-}
-
-static double
-instr_cym(double t, double fr, double overdrive)
-{
-	double tone;
-	(void)overdrive;
-
-	tone = exp(-t*8) *
-	(
-		sin(2 * M_PI * t * fr * exp(-t*8))
-		+ sin(2 * M_PI * t * fr) * 0.9f
-	);
-	return tone;
+	/* the note may be picked up in the middle by a render thread */
+	ks_set_render(&v->set, out, off, n);
 }
 
-static double
-instr_tom(double t, double fr, double overdrive)
+static void
+ks_release(void *voice)
 {
-	double tone;
-	(void)overdrive;
-
-	tone = exp(-t*4) * sin(2*M_PI*t*fr * exp(-t*20))
-		+ exp(-t*2) * sin(2*M_PI*t*fr * exp(-t*5));
+	struct ks_voice *v = voice;
 
-	return tone;
+	ks_set_release(&v->set);
 }
 
+static const struct tl_instr ks_string_instr = {&ks_render,
+	sizeof(struct ks_voice), &ks_release, NULL};
 
 static void
 karplus_strong(struct timeline *tl, double start, double fr,
 	double duration, double loudness)
 {
-	size_t i, c;
-	double prev;
-	size_t init_len = R / fr;
-	double *init_waveform;
-	size_t tstart, tend, t;
-
-	init_waveform = malloc(sizeof(double) * init_len);
-
-	for (i=0; i<init_len; i++) {
-		init_waveform[i] = (double)rand() / (double)RAND_MAX;
-	}
+	struct tl_event ev;
+	size_t tstart, tend;
 
 	tstart = start * R;
 	tend = tstart + duration * R;
 
-	c = 0;
-	prev = 0.0f;
-	for (t=tstart; t<tend; t++) {
-		double tone;
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = &ks_string_instr;
+	ev.start = tstart;
+	ev.len = tend - tstart;
+	ev.loudness = loudness;
+	ev.fr = fr;
+	ev.seed = rand();
 
-		init_waveform[c] = ((init_waveform[c] + prev) / 2.0) * 0.9999f;
-		tone = init_waveform[c];
-		prev = tone;
-		c = (c + 1) % init_len;
+	timeline_add(tl, &ev);
+}
 
-		tone *= loudness;
+static const char *const instr_names[] = {"tom", "cym", "ks"};
+static const struct tl_instr *const instrs[] = {&instr_tom, &instr_cym,
+	&ks_string_instr};
 
-		if (t >= tl->n) {
-			break;
-		}
-		 /* first channel */
-		tl->left[t] += tone;
+static int
+play_compiled(const char *path)
+{
+	struct timeline *tl;
+	struct scorebin sb;
+	char err[256];
+	int rc = -1;
+
+	if (scorebin_open(&sb, path, R, instr_names, instrs, 3, err,
+		sizeof(err)) != 0) {
+
+		fprintf(stderr, "%s: %s\n", path, err);
+		return EXIT_FAILURE;
+	}
 
-		/* second channel */
-		tl->right[t] += tone;
+	tl = timeline_init(sb.h->end);
+	if (tl && (scorebin_play(tl, &sb) == 0)) {
+		rc = timeline_play(tl);
 	}
 
-	if (t > tl->end) {
-		tl->end = t;
+	if (tl) {
+		timeline_free(tl);
 	}
+	scorebin_close(&sb);
+	ks_pool_free();
 
-	free(init_waveform);
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int
 main(int argc, char *argv[])
 {
+	const char *save = NULL;
 	int bpm = 100;
 
 	double vol = 0.5;
@@ -226,10 +233,15 @@ main(int argc, char *argv[])
 	double notes[L];
 	int play_notes[L];
 
-	if (argc == 1) {
-		seed = time(NULL);
-	} else {
-		seed = atoi(argv[1]);
+	seed = time(NULL);
+	for (i=1; i<argc; i++) {
+		if ((strcmp(argv[i], "-i") == 0) && (i + 1 < argc)) {
+			return play_compiled(argv[i + 1]);
+		} else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+			save = argv[++i];
+		} else {
+			seed = atoi(argv[i]);
+		}
 	}
 	fprintf(stderr, "seed: %d\n", seed);
 	srand(seed);
@@ -238,6 +250,7 @@ main(int argc, char *argv[])
 	if (!tl) {
 		return EXIT_FAILURE;
 	}
+	timeline_threads(tl, 0);
 
 
 	for (i=0; i<L; i++) {
@@ -304,9 +317,22 @@ main(int argc, char *argv[])
 		}
 	}
 
-	timeline_play(tl);
+	if (save) {
+		char err[256];
+
+		if (scorebin_save(tl, save, R, instr_names, instrs, 3, err,
+			sizeof(err)) != 0) {
+
+			fprintf(stderr, "%s: %s\n", save, err);
+			timeline_free(tl);
+			return EXIT_FAILURE;
+		}
+	} else {
+		timeline_play(tl);
+	}
 
 	timeline_free(tl);
+	ks_pool_free();
 
 	return EXIT_SUCCESS;
 }
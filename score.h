@@ -0,0 +1,953 @@
+/*
+ * Text scores
+ *
+ * A score is a list of words separated by white space, # comments out
+ * the rest of the line:
+ *
+ *   tempo 120            beats a minute, from the position of the track
+ *                        on, for every track
+ *   track bass           the following words go to track bass, a new
+ *                        track starts where the current one is
+ *   instr piano          instrument of the track, by the names the
+ *                        program gives
+ *   @0.2                 loudness of the following notes of the track
+ *   DO_3:2               a note of 2 beats, the track moves on by 2
+ *   FA_DIES_3 SI_BEMOL_2 DO RE MI FA SOL LA SI, _DIES (sharp) or _BEMOL
+ *                        (flat), octave. DO_3 is middle C, key 40 in
+ *                        freq.h
+ *   60                   MIDI note number, 60 is DO_3 as well
+ *   [MI_3 SOL_3 SI_3]:3  chord, the notes start and end together
+ *   -:2                  rest
+ *   DO_3:2-0.05s         sounds 0.05 seconds shorter, the track still
+ *                        moves on by 2 beats
+ *   |: ... :|3           played 3 times (:| - twice), repeats nest
+ *   sync                 every track moves on to the one furthest on
+ *
+ * Numbers may be written as fractions, tempo 1000/3, DO_3:3/2, @0.2/6.
+ * Words before the first track go to track main. A note or chord
+ * without :beats lasts as long as the last one of the track, 1 beat at
+ * first. Positions are counted in SCORE_PPQ ticks per
+ * beat, frames are worked out from the tick, so nothing drifts.
+ *
+ * score_parse() goes through the text once and hands every note to the
+ * sink as soon as it is read, with its start and length in frames.
+ * Tracks may be written one after another, notes do not have to come in
+ * order of start, but sink->flush(t) is called whenever every track is
+ * past frame t, streaming timelines write out everything before it.
+ * A track that stops early holds that back, sync moves it on.
+ *
+ * score_play() reads a score into a timeline, score_read() loads a
+ * file. bench/score-bench.c measures the parser on generated scores.
+ */
+#ifndef score_h_included
+#define score_h_included
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+
+#include "timeline.h"
+#include "freq.h"
+
+#define SCORE_PPQ 960       /* ticks per beat */
+#define SCORE_TRACKS 64
+#define SCORE_TEMPOS 256
+#define SCORE_CHORD 32      /* notes in a chord */
+#define SCORE_REPEATS 16    /* nested repeats */
+#define SCORE_FLUSH 4096    /* frames at least between flushes */
+#define SCORE_MAX_BEATS 1e5  /* length of a note or a rest */
+#define SCORE_MAX_CUT 1e5    /* seconds cut off a note */
+
+struct score_note
+{
+	size_t start, len;   /* in frames */
+	int note;            /* numbered like freq.h */
+	double loudness;
+	unsigned instr;      /* index into the names given to score_parse() */
+	unsigned track;
+};
+
+struct score_sink
+{
+	int (*note)(void *arg, const struct score_note *n);
+	int (*flush)(void *arg, size_t t);   /* optional */
+	void *arg;
+};
+
+struct score_track
+{
+	char name[32];
+	size_t tick;      /* position */
+	size_t frame;     /* of tick, SIZE_MAX - to be worked out */
+	size_t beats;     /* length of the last note, in ticks */
+	double loudness;
+	unsigned instr;
+	int used;         /* named or written to, holds flushes back */
+};
+
+/* frames from tick on, until the next one */
+struct score_tempo
+{
+	size_t tick;
+	double frame;
+	double per_tick;
+};
+
+struct score_repeat
+{
+	const char *from;
+	unsigned left;    /* times to go back, 0 - not there yet */
+};
+
+struct score_parser
+{
+	const char *src, *p, *end;
+	unsigned rate;
+	const char *const *instrs;
+	size_t ninstrs;
+	const struct score_sink *sink;
+
+	struct score_track tracks[SCORE_TRACKS];
+	size_t ntracks;
+	struct score_track *cur;
+
+	struct score_tempo tempos[SCORE_TEMPOS];
+	size_t ntempos;
+
+	struct score_repeat repeats[SCORE_REPEATS];
+	size_t nrepeats;
+
+	size_t flushed;   /* last frame given to sink->flush */
+
+	char *err;
+	size_t errlen;
+	int failed;
+};
+
+/* word delimiters */
+static const unsigned char score_space[256] = {
+	[0] = 1, ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1,
+	[' '] = 1,
+};
+
+/* powers of ten a double holds exactly */
+static const double score_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+	1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline void
+score_fail(struct score_parser *ps, const char *fmt, ...)
+{
+	const char *s;
+	int line = 1, col = 1, len;
+	va_list ap;
+
+	if (ps->failed) {
+		return;
+	}
+	ps->failed = 1;
+
+	for (s=ps->src; s<ps->p; s++) {
+		col++;
+		if (*s == '\n') {
+			line++;
+			col = 1;
+		}
+	}
+
+	len = snprintf(ps->err, ps->errlen, "%d:%d: ", line, col);
+	if ((len < 0) || ((size_t)len >= ps->errlen)) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(ps->err + len, ps->errlen - len, fmt, ap);
+	va_end(ap);
+}
+
+static inline int
+score_at_space(const struct score_parser *ps)
+{
+	return (ps->p == ps->end) || score_space[(unsigned char)*ps->p];
+}
+
+/*
+ * decimal number. Up to 15 digits it is the integer divided by a power
+ * of ten, both exact, so the one rounding gives what strtod() does
+ */
+static inline int
+score_decimal(struct score_parser *ps, double *v)
+{
+	const char *p = ps->p, *start = ps->p;
+	uint64_t m = 0;
+	int digits = 0, frac = 0;
+
+	while ((p < ps->end) && (*p >= '0') && (*p <= '9')) {
+		m = m * 10 + (*p++ - '0');
+		digits++;
+	}
+	if ((p < ps->end) && (*p == '.')) {
+		p++;
+		while ((p < ps->end) && (*p >= '0') && (*p <= '9')) {
+			m = m * 10 + (*p++ - '0');
+			digits++;
+			frac++;
+		}
+	}
+	if (digits == 0) {
+		score_fail(ps, "number expected");
+		return -1;
+	}
+
+	if (frac == 0 && digits <= 15) {
+		*v = (double)m;
+	} else if (digits <= 15) {
+		*v = (double)m / score_pow10[frac];
+	} else {
+		char buf[64];
+		size_t n = p - start < 63 ? p - start : 63;
+
+		memcpy(buf, start, n);
+		buf[n] = '\0';
+		*v = strtod(buf, NULL);
+	}
+
+	ps->p = p;
+	return 0;
+}
+
+/* number or fraction */
+static inline int
+score_number(struct score_parser *ps, double *v)
+{
+	double d;
+
+	if (score_decimal(ps, v) != 0) {
+		return -1;
+	}
+	if ((ps->p < ps->end) && (*ps->p == '/')) {
+		ps->p++;
+		if (score_decimal(ps, &d) != 0) {
+			return -1;
+		}
+		if (d == 0.0) {
+			score_fail(ps, "division by zero");
+			return -1;
+		}
+		*v /= d;
+	}
+
+	return 0;
+}
+
+/* the word starting at ps->p, for messages */
+static inline int
+score_word_len(const struct score_parser *ps)
+{
+	const char *p = ps->p;
+
+	while ((p < ps->end) && !score_space[(unsigned char)*p]
+		&& (p - ps->p < 32)) {
+
+		p++;
+	}
+
+	return (int)(p - ps->p);
+}
+
+/* note names by the first letter, | 32 if the second is O */
+struct score_step
+{
+	char name[5];
+	int len, semi;
+};
+
+static const struct score_step score_steps[64] = {
+	[4 | 32] = {"DO_", 3, 0},
+	[18] = {"RE_", 3, 2},
+	[13] = {"MI_", 3, 4},
+	[6] = {"FA_", 3, 5},
+	[19 | 32] = {"SOL_", 4, 7},
+	[12] = {"LA_", 3, 9},
+	[19] = {"SI_", 3, 11},
+};
+
+/* DO_3, FA_DIES_3, SI_BEMOL_2 */
+static inline int
+score_name(struct score_parser *ps, int *note)
+{
+	const struct score_step *st;
+	const char *p = ps->p;
+	size_t left = ps->end - p;
+	int semi, oct = 0, neg = 0;
+
+	/* looked up rather than branched on, scores jump between notes */
+	if (left < 4) {
+		goto bad;
+	}
+	st = &score_steps[(p[0] & 31) | ((p[1] == 'O') << 5)];
+	if (!((p[0] == st->name[0]) & (p[1] == st->name[1])
+		& (p[2] == st->name[2])
+		& ((st->len == 3) | (p[3] == st->name[3])))
+		|| (st->len == 0)) {
+
+		goto bad;
+	}
+	semi = st->semi;
+	p += st->len;
+	left = ps->end - p;
+
+	if ((p < ps->end) && (*p >= '0') && (*p <= '9')) {
+		/* plain note, the usual case */
+	} else if ((left > 5) && (memcmp(p, "DIES_", 5) == 0)) {
+		semi++;
+		p += 5;
+	} else if ((left > 6) && (memcmp(p, "BEMOL_", 6) == 0)) {
+		semi--;
+		p += 6;
+	}
+
+	if ((p < ps->end) && (*p == '-')) {
+		neg = 1;
+		p++;
+	}
+	if ((p == ps->end) || (*p < '0') || (*p > '9')) {
+		goto bad;
+	}
+	while ((p < ps->end) && (*p >= '0') && (*p <= '9') && (oct < 100)) {
+		oct = oct * 10 + (*p++ - '0');
+	}
+
+	*note = 40 + (neg ? -oct - 3 : oct - 3) * 12 + semi;
+	ps->p = p;
+	return 0;
+
+bad:
+	score_fail(ps, "unknown note '%.*s'", score_word_len(ps), ps->p);
+	return -1;
+}
+
+static inline int
+score_note_word(struct score_parser *ps, int *note)
+{
+	const char *p = ps->p;
+	int v = 0;
+
+	if ((*p >= '0') && (*p <= '9')) {
+		while ((p < ps->end) && (*p >= '0') && (*p <= '9') && (v < 128)) {
+			v = v * 10 + (*p++ - '0');
+		}
+		if (v > 127) {
+			score_fail(ps, "MIDI notes are 0 .. 127");
+			return -1;
+		}
+		ps->p = p;
+		*note = v - 20;
+		return 0;
+	}
+
+	return score_name(ps, note);
+}
+
+/* :beats[-seconds s], *cut in frames */
+static inline int
+score_length(struct score_parser *ps, size_t *ticks, size_t *cut)
+{
+	double v;
+
+	*cut = 0;
+	if ((ps->p == ps->end) || (*ps->p != ':')) {
+		*ticks = ps->cur->beats;
+		return 0;
+	}
+	ps->p++;
+
+	if (score_number(ps, &v) != 0) {
+		return -1;
+	}
+	if (!(v <= SCORE_MAX_BEATS)) {
+		score_fail(ps, "length over %g beats", SCORE_MAX_BEATS);
+		return -1;
+	}
+	*ticks = (size_t)(v * SCORE_PPQ + 0.5);
+	ps->cur->beats = *ticks;
+
+	if ((ps->p < ps->end) && (*ps->p == '-')) {
+		ps->p++;
+		if (score_number(ps, &v) != 0) {
+			return -1;
+		}
+		if ((ps->p == ps->end) || (*ps->p != 's')) {
+			score_fail(ps, "seconds expected, like -0.05s");
+			return -1;
+		}
+		if (!(v <= SCORE_MAX_CUT)) {
+			score_fail(ps, "cut over %g seconds", SCORE_MAX_CUT);
+			return -1;
+		}
+		ps->p++;
+		*cut = (size_t)(v * ps->rate + 0.5);
+	}
+
+	return 0;
+}
+
+/* frame of a tick */
+static inline size_t
+score_frame(const struct score_parser *ps, size_t tick)
+{
+	const struct score_tempo *t = &ps->tempos[ps->ntempos - 1];
+
+	/* tracks are mostly in the last tempo */
+	while (t->tick > tick) {
+		t--;
+	}
+
+	return (size_t)(t->frame + (tick - t->tick) * t->per_tick + 0.5);
+}
+
+static inline int
+score_tempo(struct score_parser *ps, double bpm)
+{
+	struct score_tempo *t = &ps->tempos[ps->ntempos - 1];
+	size_t tick = ps->cur->tick, i;
+
+	if ((bpm <= 0.0) || !isfinite(bpm)) {
+		score_fail(ps, "tempo must be above 0");
+		return -1;
+	}
+	if (tick < t->tick) {
+		score_fail(ps, "tempo change before the last one");
+		return -1;
+	}
+	if (tick > t->tick) {
+		if (ps->ntempos == SCORE_TEMPOS) {
+			score_fail(ps, "too many tempo changes");
+			return -1;
+		}
+		t[1].tick = tick;
+		t[1].frame = t->frame + (tick - t->tick) * t->per_tick;
+		t++;
+		ps->ntempos++;
+	}
+	t->per_tick = ps->rate * 60.0 / bpm / SCORE_PPQ;
+
+	for (i=0; i<ps->ntracks; i++) {
+		ps->tracks[i].frame = SIZE_MAX;
+	}
+
+	return 0;
+}
+
+/* tell the sink when every track got past another SCORE_FLUSH frames */
+static inline int
+score_flush(struct score_parser *ps)
+{
+	size_t i, tick = SIZE_MAX, t;
+
+	for (i=0; i<ps->ntracks; i++) {
+		if (ps->tracks[i].used && (ps->tracks[i].tick < tick)) {
+			tick = ps->tracks[i].tick;
+		}
+	}
+	if (tick == SIZE_MAX) {
+		return 0;
+	}
+
+	t = score_frame(ps, tick);
+	if (t < ps->flushed + SCORE_FLUSH) {
+		return 0;
+	}
+	ps->flushed = t;
+
+	if (ps->sink->flush(ps->sink->arg, t) != 0) {
+		score_fail(ps, "flush failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* notes starting at the track position, then the track moves on */
+static inline int
+score_emit(struct score_parser *ps, const int *notes, size_t n, size_t ticks,
+	size_t cut)
+{
+	struct score_track *tr = ps->cur;
+	struct score_note sn;
+	size_t i, end;
+
+	/* a track mostly goes on where its last note ended */
+	if (tr->frame == SIZE_MAX) {
+		tr->frame = score_frame(ps, tr->tick);
+	}
+	sn.start = tr->frame;
+	end = score_frame(ps, tr->tick + ticks);
+	sn.len = end - sn.start > cut ? end - sn.start - cut : 0;
+	sn.loudness = tr->loudness;
+	sn.instr = tr->instr;
+	sn.track = tr - ps->tracks;
+
+	for (i=0; (i<n) && (sn.len > 0); i++) {
+		sn.note = notes[i];
+		if (ps->sink->note(ps->sink->arg, &sn) != 0) {
+			score_fail(ps, "can not add a note");
+			return -1;
+		}
+	}
+
+	tr->tick += ticks;
+	tr->frame = end;
+	tr->used = 1;
+
+	return (tr->tick > 0) && ps->sink->flush ? score_flush(ps) : 0;
+}
+
+/* a name after a keyword */
+static inline int
+score_arg(struct score_parser *ps, const char **name, size_t *len)
+{
+	while ((ps->p < ps->end) && score_space[(unsigned char)*ps->p]) {
+		ps->p++;
+	}
+	*name = ps->p;
+	while ((ps->p < ps->end) && !score_space[(unsigned char)*ps->p]) {
+		ps->p++;
+	}
+	*len = ps->p - *name;
+
+	if (*len == 0) {
+		score_fail(ps, "name expected");
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline int
+score_track(struct score_parser *ps)
+{
+	struct score_track *tr;
+	const char *name;
+	size_t len, i;
+
+	if (score_arg(ps, &name, &len) != 0) {
+		return -1;
+	}
+	if (len >= sizeof(tr->name)) {
+		score_fail(ps, "track name is too long");
+		return -1;
+	}
+
+	for (i=0; i<ps->ntracks; i++) {
+		tr = &ps->tracks[i];
+		if ((memcmp(tr->name, name, len) == 0) && !tr->name[len]) {
+			tr->used = 1;
+			ps->cur = tr;
+			return 0;
+		}
+	}
+
+	if (ps->ntracks == SCORE_TRACKS) {
+		score_fail(ps, "too many tracks");
+		return -1;
+	}
+	tr = &ps->tracks[ps->ntracks++];
+	*tr = *ps->cur;
+	memcpy(tr->name, name, len);
+	tr->name[len] = '\0';
+	tr->used = 1;
+	ps->cur = tr;
+
+	return 0;
+}
+
+static inline int
+score_instr(struct score_parser *ps)
+{
+	const char *name;
+	size_t len, i;
+
+	if (score_arg(ps, &name, &len) != 0) {
+		return -1;
+	}
+
+	for (i=0; i<ps->ninstrs; i++) {
+		if ((strncmp(ps->instrs[i], name, len) == 0)
+			&& !ps->instrs[i][len]) {
+
+			ps->cur->instr = i;
+			return 0;
+		}
+	}
+
+	ps->p = name;
+	score_fail(ps, "unknown instrument '%.*s'", (int)len, name);
+	return -1;
+}
+
+/* tempo, track, instr, sync */
+static inline int
+score_keyword(struct score_parser *ps)
+{
+	size_t len = score_word_len(ps), i;
+	double v;
+
+	if ((len == 5) && (memcmp(ps->p, "tempo", 5) == 0)) {
+		ps->p += 5;
+		while ((ps->p < ps->end)
+			&& score_space[(unsigned char)*ps->p]) {
+
+			ps->p++;
+		}
+		if (score_number(ps, &v) != 0) {
+			return -1;
+		}
+		return score_tempo(ps, v);
+	}
+	if ((len == 5) && (memcmp(ps->p, "track", 5) == 0)) {
+		ps->p += 5;
+		return score_track(ps);
+	}
+	if ((len == 5) && (memcmp(ps->p, "instr", 5) == 0)) {
+		ps->p += 5;
+		return score_instr(ps);
+	}
+	if ((len == 4) && (memcmp(ps->p, "sync", 4) == 0)) {
+		size_t tick = 0;
+
+		ps->p += 4;
+		for (i=0; i<ps->ntracks; i++) {
+			if (ps->tracks[i].tick > tick) {
+				tick = ps->tracks[i].tick;
+			}
+		}
+		for (i=0; i<ps->ntracks; i++) {
+			if (ps->tracks[i].tick != tick) {
+				ps->tracks[i].tick = tick;
+				ps->tracks[i].frame = SIZE_MAX;
+			}
+		}
+		return ps->sink->flush ? score_flush(ps) : 0;
+	}
+
+	score_fail(ps, "unknown word '%.*s'", (int)len, ps->p);
+	return -1;
+}
+
+static inline int
+score_chord(struct score_parser *ps)
+{
+	int notes[SCORE_CHORD];
+	size_t n = 0, ticks, cut;
+
+	ps->p++;
+	for (;;) {
+		while ((ps->p < ps->end)
+			&& score_space[(unsigned char)*ps->p]) {
+
+			ps->p++;
+		}
+		if (ps->p == ps->end) {
+			score_fail(ps, "chord is not closed");
+			return -1;
+		}
+		if (*ps->p == ']') {
+			ps->p++;
+			break;
+		}
+		if (n == SCORE_CHORD) {
+			score_fail(ps, "too many notes in a chord");
+			return -1;
+		}
+		if (score_note_word(ps, &notes[n++]) != 0) {
+			return -1;
+		}
+		if (!score_at_space(ps) && (*ps->p != ']')) {
+			score_fail(ps, "chord notes take no length");
+			return -1;
+		}
+	}
+
+	if (score_length(ps, &ticks, &cut) != 0) {
+		return -1;
+	}
+
+	return score_emit(ps, notes, n, ticks, cut);
+}
+
+/* |: and :|n */
+static inline int
+score_repeat(struct score_parser *ps)
+{
+	struct score_repeat *r;
+	double v = 2.0;
+
+	if (*ps->p == '|') {
+		if ((ps->p + 1 == ps->end) || (ps->p[1] != ':')) {
+			goto bad;
+		}
+		if (ps->nrepeats == SCORE_REPEATS) {
+			score_fail(ps, "repeats nest too deep");
+			return -1;
+		}
+		ps->p += 2;
+		r = &ps->repeats[ps->nrepeats++];
+		r->from = ps->p;
+		r->left = 0;
+		return 0;
+	}
+
+	if ((ps->p + 1 == ps->end) || (ps->p[1] != '|')) {
+		goto bad;
+	}
+	if (ps->nrepeats == 0) {
+		score_fail(ps, "':|' without '|:'");
+		return -1;
+	}
+	ps->p += 2;
+	if (!score_at_space(ps) && (score_number(ps, &v) != 0)) {
+		return -1;
+	}
+	if ((v < 1.0) || (v != floor(v)) || (v > 65536.0)) {
+		score_fail(ps, "repeat count must be 1 .. 65536");
+		return -1;
+	}
+
+	r = &ps->repeats[ps->nrepeats - 1];
+	if (r->left == 0) {
+		r->left = (unsigned)v;
+	}
+	if (--r->left > 0) {
+		ps->p = r->from;
+	} else {
+		ps->nrepeats--;
+	}
+
+	return 0;
+
+bad:
+	score_fail(ps, "unknown word '%.*s'", score_word_len(ps), ps->p);
+	return -1;
+}
+
+static inline int
+score_word(struct score_parser *ps)
+{
+	int note;
+	size_t ticks, cut;
+	double v;
+
+	switch (*ps->p) {
+	case '#':
+		while ((ps->p < ps->end) && (*ps->p != '\n')) {
+			ps->p++;
+		}
+		return 0;
+	case '@':
+		ps->p++;
+		if (score_number(ps, &v) != 0) {
+			return -1;
+		}
+		ps->cur->loudness = v;
+		break;
+	case '[':
+		if (score_chord(ps) != 0) {
+			return -1;
+		}
+		break;
+	case '-':
+		ps->p++;
+		if ((score_length(ps, &ticks, &cut) != 0)
+			|| (score_emit(ps, NULL, 0, ticks, 0) != 0)) {
+
+			return -1;
+		}
+		break;
+	case '|':
+	case ':':
+		if (score_repeat(ps) != 0) {
+			return -1;
+		}
+		break;
+	default:
+		if ((*ps->p >= 'a') && (*ps->p <= 'z')) {
+			return score_keyword(ps);
+		}
+		if ((score_note_word(ps, &note) != 0)
+			|| (score_length(ps, &ticks, &cut) != 0)
+			|| (score_emit(ps, &note, 1, ticks, cut) != 0)) {
+
+			return -1;
+		}
+	}
+
+	if (!score_at_space(ps)) {
+		score_fail(ps, "unexpected '%c'", *ps->p);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * go through len bytes of text, hand notes to the sink at rate frames a
+ * second. Instruments are named by instrs[0 .. ninstrs), tracks play
+ * the first one unless they say otherwise. -1 and a message in err if
+ * the text is not a score or the sink failed
+ */
+static inline int
+score_parse(const char *text, size_t len, unsigned rate,
+	const char *const *instrs, size_t ninstrs,
+	const struct score_sink *sink, char *err, size_t errlen)
+{
+	struct score_parser *ps;
+	int rc;
+
+	ps = (struct score_parser *)calloc(1, sizeof(struct score_parser));
+	if (!ps) {
+		snprintf(err, errlen, "out of memory");
+		return -1;
+	}
+
+	ps->src = ps->p = text;
+	ps->end = text + len;
+	ps->rate = rate;
+	ps->instrs = instrs;
+	ps->ninstrs = ninstrs;
+	ps->sink = sink;
+	ps->err = err;
+	ps->errlen = errlen;
+
+	strcpy(ps->tracks[0].name, "main");
+	ps->tracks[0].frame = SIZE_MAX;
+	ps->tracks[0].beats = SCORE_PPQ;
+	ps->tracks[0].loudness = 1.0;
+	ps->ntracks = 1;
+	ps->cur = &ps->tracks[0];
+
+	ps->ntempos = 1;
+	score_tempo(ps, 120.0);
+
+	for (;;) {
+		while ((ps->p < ps->end)
+			&& score_space[(unsigned char)*ps->p]) {
+
+			ps->p++;
+		}
+		if ((ps->p == ps->end) || (score_word(ps) != 0)) {
+			break;
+		}
+	}
+	if (!ps->failed && (ps->nrepeats > 0)) {
+		score_fail(ps, "'|:' without ':|'");
+	}
+
+	rc = ps->failed ? -1 : 0;
+	free(ps);
+
+	return rc;
+}
+
+/* the whole file, NUL terminated, NULL if it can not be read */
+static inline char *
+score_read(const char *path, size_t *len)
+{
+	FILE *f;
+	char *buf = NULL;
+	size_t size = 0, cap = 0, n;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+
+	do {
+		if (cap - size < (1 << 16)) {
+			char *tmp;
+
+			cap = cap ? cap * 2 : (1 << 20);
+			tmp = (char *)realloc(buf, cap + 1);
+			if (!tmp) {
+				free(buf);
+				fclose(f);
+				return NULL;
+			}
+			buf = tmp;
+		}
+		n = fread(buf + size, 1, cap - size, f);
+		size += n;
+	} while (n > 0);
+
+	if (ferror(f)) {
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+
+	buf[size] = '\0';
+	*len = size;
+	return buf;
+}
+
+/* instruments of a timeline */
+struct score_timeline
+{
+	struct timeline *tl;
+	const struct tl_instr *const *instrs;
+};
+
+static inline int
+score_tl_note(void *arg, const struct score_note *n)
+{
+	struct score_timeline *st = (struct score_timeline *)arg;
+	struct tl_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = st->instrs[n->instr];
+	ev.start = n->start;
+	ev.len = n->len;
+	ev.loudness = n->loudness;
+	ev.note = n->note;
+	ev.fr = freq(n->note);
+
+	return timeline_add(st->tl, &ev);
+}
+
+static inline int
+score_tl_flush(void *arg, size_t t)
+{
+	struct score_timeline *st = (struct score_timeline *)arg;
+
+	return timeline_flush_until(st->tl, t);
+}
+
+/*
+ * add the notes of a score to a timeline, instrument names[i] is
+ * instrs[i]
+ */
+static inline int
+score_play(struct timeline *tl, const char *text, size_t len,
+	unsigned rate, const char *const *names,
+	const struct tl_instr *const *instrs, size_t ninstrs, char *err,
+	size_t errlen)
+{
+	struct score_timeline st;
+	struct score_sink sink;
+
+	st.tl = tl;
+	st.instrs = instrs;
+	sink.note = &score_tl_note;
+	sink.flush = &score_tl_flush;
+	sink.arg = &st;
+
+	return score_parse(text, len, rate, names, ninstrs, &sink, err,
+		errlen);
+}
+
+#endif
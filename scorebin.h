@@ -0,0 +1,494 @@
+/*
+ * Compiled scores: the notes of a piece in a file that is mapped and
+ * read in place
+ *
+ * Text scores and pieces generating their notes in C have to be parsed
+ * or run and every note recorded before the first sample is rendered,
+ * with millions of notes that is what startup takes. A compiled score
+ * is the notes as the scheduler wants them, sorted by start, one column
+ * per field:
+ *
+ *   header        struct scorebin_header, at 0
+ *   start, len    uint64_t, frames
+ *   fr, loudness, pan, param
+ *                 double
+ *   note          int32_t
+ *   seed          uint32_t
+ *   instr         uint32_t, index into the instrument names of the
+ *                 header
+ *
+ * Columns are where col[] of the header says, SCOREBIN_ALIGN aligned,
+ * in the byte order of the machine that wrote them; the version goes up
+ * whenever any of this changes. scorebin_open() maps the file and checks
+ * the header only, notes are read from the columns when the scheduler
+ * of timeline.h gets to them, scorebin_play() hands them to a timeline.
+ * Instruments are matched by name with those of the program.
+ *
+ * scorebin_save() writes the notes recorded by an in-memory timeline,
+ * after culling, so a piece made in C (random-rhythm -o) or a text
+ * score (scorec.c) is compiled by adding its notes to a timeline and
+ * saving it. bench/scorebin-bench.c measures startup of both kinds.
+ */
+#ifndef scorebin_h_included
+#define scorebin_h_included
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timeline.h"
+
+#define SCOREBIN_MAGIC "SNDSCORE"
+#define SCOREBIN_VERSION 1
+#define SCOREBIN_ORDER 0x01020304   /* reads otherwise in another order */
+#define SCOREBIN_INSTRS 32
+#define SCOREBIN_NAME 32            /* instrument name, with the NUL */
+#define SCOREBIN_ALIGN 64
+#define SCOREBIN_FLUSH 4096         /* notes between streaming flushes */
+
+enum {
+	SCOREBIN_START, SCOREBIN_LEN, SCOREBIN_FR, SCOREBIN_LOUDNESS,
+	SCOREBIN_PAN, SCOREBIN_PARAM, SCOREBIN_NOTE, SCOREBIN_SEED,
+	SCOREBIN_INSTR, SCOREBIN_COLUMNS
+};
+
+/* bytes of a value of every column */
+static const size_t scorebin_width[SCOREBIN_COLUMNS] = {8, 8, 8, 8, 8, 8,
+	4, 4, 4};
+
+struct scorebin_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t order;     /* SCOREBIN_ORDER */
+	uint32_t rate;      /* frames a second */
+	uint32_t ninstrs;
+	uint64_t n;         /* notes */
+	uint64_t end;       /* the piece lasts until here */
+	uint64_t col[SCOREBIN_COLUMNS];   /* offsets of the columns */
+	char instrs[SCOREBIN_INSTRS][SCOREBIN_NAME];
+};
+
+/* a mapped compiled score */
+struct scorebin
+{
+	void *map;
+	size_t size;
+	const struct scorebin_header *h;
+
+	const uint64_t *start, *len;
+	const double *fr, *loudness, *pan, *param;
+	const int32_t *note;
+	const uint32_t *seed, *instr;
+
+	/* instruments of the program by id of the file */
+	const struct tl_instr *instrs[SCOREBIN_INSTRS];
+
+	struct tl_source src;
+};
+
+static size_t
+scorebin_start(const void *arg, size_t i)
+{
+	const struct scorebin *sb = (const struct scorebin *)arg;
+
+	return sb->start[i];
+}
+
+/* note i of the score, -1 if its instrument id is not in the header */
+static int
+scorebin_event(const void *arg, size_t i, struct tl_event *ev, size_t *seq)
+{
+	const struct scorebin *sb = (const struct scorebin *)arg;
+	uint32_t id = sb->instr[i];
+
+	if (id >= sb->h->ninstrs) {
+		return -1;
+	}
+
+	ev->instr = sb->instrs[id];
+	ev->start = sb->start[i];
+	ev->len = sb->len[i];
+	ev->loudness = sb->loudness[i];
+	ev->pan = sb->pan[i];
+	ev->fr = sb->fr[i];
+	ev->note = sb->note[i];
+	ev->param = sb->param[i];
+	ev->seed = sb->seed[i];
+	*seq = i;
+
+	return 0;
+}
+
+static inline size_t
+scorebin_align(size_t off)
+{
+	return (off + SCOREBIN_ALIGN - 1) & ~(size_t)(SCOREBIN_ALIGN - 1);
+}
+
+/* header of n notes with offsets of the columns, size of the file */
+static inline size_t
+scorebin_layout(struct scorebin_header *h, size_t n)
+{
+	size_t off = scorebin_align(sizeof(struct scorebin_header));
+	int c;
+
+	for (c=0; c<SCOREBIN_COLUMNS; c++) {
+		h->col[c] = off;
+		off = scorebin_align(off + n * scorebin_width[c]);
+	}
+
+	return off;
+}
+
+static inline void
+scorebin_close(struct scorebin *sb)
+{
+	if (sb->map) {
+		munmap(sb->map, sb->size);
+	}
+	sb->map = NULL;
+}
+
+/*
+ * map a compiled score, instrument names[i] of the program is instrs[i].
+ * -1 and a message in err if it is not one, is for another rate or
+ * names an instrument the program does not have
+ */
+static inline int
+scorebin_open(struct scorebin *sb, const char *path, unsigned rate,
+	const char *const *names, const struct tl_instr *const *instrs,
+	size_t ninstrs, char *err, size_t errlen)
+{
+	const struct scorebin_header *h;
+	struct scorebin_header want;
+	const char *base;
+	struct stat st;
+	size_t i, j;
+	int fd;
+
+	memset(sb, 0, sizeof(*sb));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		snprintf(err, errlen, "can't open");
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0)
+		|| ((size_t)st.st_size < sizeof(struct scorebin_header))) {
+
+		snprintf(err, errlen, "not a compiled score");
+		close(fd);
+		return -1;
+	}
+	sb->size = st.st_size;
+	sb->map = mmap(NULL, sb->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (sb->map == MAP_FAILED) {
+		sb->map = NULL;
+		snprintf(err, errlen, "can't map");
+		return -1;
+	}
+	/* the scheduler goes through the columns front to back */
+	posix_madvise(sb->map, sb->size, POSIX_MADV_SEQUENTIAL);
+
+	base = (const char *)sb->map;
+	sb->h = h = (const struct scorebin_header *)base;
+	if (memcmp(h->magic, SCOREBIN_MAGIC, sizeof(h->magic)) != 0) {
+		snprintf(err, errlen, "not a compiled score");
+		goto fail;
+	}
+	if (h->order != SCOREBIN_ORDER) {
+		snprintf(err, errlen, "written in another byte order");
+		goto fail;
+	}
+	if (h->version != SCOREBIN_VERSION) {
+		snprintf(err, errlen, "version %u, not %u",
+			(unsigned)h->version, SCOREBIN_VERSION);
+		goto fail;
+	}
+	if (h->rate != rate) {
+		snprintf(err, errlen, "compiled for %u frames a second, not %u",
+			(unsigned)h->rate, rate);
+		goto fail;
+	}
+
+	/* columns are where they would be written, inside the file */
+	if ((h->n > sb->size / 8)
+		|| (scorebin_layout(&want, h->n) > sb->size)
+		|| (memcmp(want.col, h->col, sizeof(want.col)) != 0)) {
+
+		snprintf(err, errlen, "truncated or broken");
+		goto fail;
+	}
+
+	if (h->ninstrs > SCOREBIN_INSTRS) {
+		snprintf(err, errlen, "%u instruments", (unsigned)h->ninstrs);
+		goto fail;
+	}
+	for (i=0; i<h->ninstrs; i++) {
+		const char *name = h->instrs[i];
+
+		if (memchr(name, '\0', SCOREBIN_NAME) == NULL) {
+			snprintf(err, errlen, "broken instrument name");
+			goto fail;
+		}
+		for (j=0; (j<ninstrs) && (strcmp(names[j], name) != 0); j++) {
+		}
+		if (j == ninstrs) {
+			snprintf(err, errlen, "no instrument '%s' here", name);
+			goto fail;
+		}
+		sb->instrs[i] = instrs[j];
+	}
+
+	sb->start = (const uint64_t *)(base + h->col[SCOREBIN_START]);
+	sb->len = (const uint64_t *)(base + h->col[SCOREBIN_LEN]);
+	sb->fr = (const double *)(base + h->col[SCOREBIN_FR]);
+	sb->loudness = (const double *)(base + h->col[SCOREBIN_LOUDNESS]);
+	sb->pan = (const double *)(base + h->col[SCOREBIN_PAN]);
+	sb->param = (const double *)(base + h->col[SCOREBIN_PARAM]);
+	sb->note = (const int32_t *)(base + h->col[SCOREBIN_NOTE]);
+	sb->seed = (const uint32_t *)(base + h->col[SCOREBIN_SEED]);
+	sb->instr = (const uint32_t *)(base + h->col[SCOREBIN_INSTR]);
+
+	sb->src.n = h->n;
+	sb->src.end = h->end;
+	sb->src.start = &scorebin_start;
+	sb->src.event = &scorebin_event;
+	sb->src.arg = sb;
+	sb->src.admit = 1;
+
+	return 0;
+
+fail:
+	scorebin_close(sb);
+	return -1;
+}
+
+/*
+ * notes of the score into a timeline: an in-memory one reads them from
+ * the mapping when it renders, which has to stay open until then, a
+ * streaming one gets them added and flushed as they come
+ */
+static inline int
+scorebin_play(struct timeline *tl, struct scorebin *sb)
+{
+	struct tl_event ev;
+	size_t i, seq;
+
+	if (!tl->stream) {
+		return timeline_source(tl, &sb->src);
+	}
+
+	for (i=0; i<sb->src.n; i++) {
+		if ((scorebin_event(sb, i, &ev, &seq) != 0)
+			|| (timeline_add(tl, &ev) != 0)) {
+
+			return -1;
+		}
+		if (((i + 1) % SCOREBIN_FLUSH == 0)
+			&& (timeline_flush_until(tl, ev.start) != 0)) {
+
+			return -1;
+		}
+	}
+	tl_extend(tl, sb->src.end);
+
+	return 0;
+}
+
+/* n values of column c of the notes in order into f */
+static inline int
+scorebin_put(FILE *f, const struct tl_event *events, const uint32_t *ids,
+	const struct tl_start *order, size_t n, int c)
+{
+	union {
+		uint64_t u64[1024];
+		double f64[1024];
+		int32_t i32[1024];
+		uint32_t u32[1024];
+	} buf;
+	size_t i, k;
+
+	for (i=0; i<n; i+=k) {
+		for (k=0; (k<1024) && (i + k < n); k++) {
+			size_t e = order[i + k].ev;
+			const struct tl_event *ev = &events[e];
+
+			switch (c) {
+			case SCOREBIN_START:
+				buf.u64[k] = ev->start;
+				break;
+			case SCOREBIN_LEN:
+				buf.u64[k] = ev->len;
+				break;
+			case SCOREBIN_FR:
+				buf.f64[k] = ev->fr;
+				break;
+			case SCOREBIN_LOUDNESS:
+				buf.f64[k] = ev->loudness;
+				break;
+			case SCOREBIN_PAN:
+				buf.f64[k] = ev->pan;
+				break;
+			case SCOREBIN_PARAM:
+				buf.f64[k] = ev->param;
+				break;
+			case SCOREBIN_NOTE:
+				buf.i32[k] = ev->note;
+				break;
+			case SCOREBIN_SEED:
+				buf.u32[k] = ev->seed;
+				break;
+			case SCOREBIN_INSTR:
+				buf.u32[k] = ids[e];
+				break;
+			}
+		}
+		if (fwrite(&buf, scorebin_width[c], k, f) != k) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * write n notes lasting until end as a compiled score, instrument
+ * instrs[i] is called names[i]. Notes starting together keep their
+ * order
+ */
+static inline int
+scorebin_write(const char *path, const struct tl_event *events, size_t n,
+	size_t end, unsigned rate, const char *const *names,
+	const struct tl_instr *const *instrs, size_t ninstrs, char *err,
+	size_t errlen)
+{
+	static const char zero[SCOREBIN_ALIGN];
+	struct scorebin_header h;
+	struct tl_start *order;
+	uint32_t *ids;
+	size_t i, j, pos, used = 0;
+	FILE *f = NULL;
+	int c, rc = -1;
+
+	order = (struct tl_start *)malloc((n ? n : 1) * sizeof(*order));
+	ids = (uint32_t *)malloc((n ? n : 1) * sizeof(*ids));
+	if (!order || !ids) {
+		snprintf(err, errlen, "out of memory");
+		goto done;
+	}
+
+	/* ids in order of first use, only instruments playing are named */
+	memset(&h, 0, sizeof(h));
+	for (i=0; i<n; i++) {
+		for (j=0; (j<ninstrs) && (instrs[j] != events[i].instr); j++) {
+		}
+		if (j == ninstrs) {
+			snprintf(err, errlen, "note %lu: unnamed instrument",
+				(unsigned long)i);
+			goto done;
+		}
+		for (ids[i]=0; ids[i]<used; ids[i]++) {
+			if (strcmp(h.instrs[ids[i]], names[j]) == 0) {
+				break;
+			}
+		}
+		if (ids[i] == used) {
+			if ((used == SCOREBIN_INSTRS)
+				|| (strlen(names[j]) >= SCOREBIN_NAME)) {
+
+				snprintf(err, errlen, "too many instruments or "
+					"name too long: '%s'", names[j]);
+				goto done;
+			}
+			strcpy(h.instrs[used++], names[j]);
+		}
+
+		order[i].start = events[i].start;
+		order[i].ev = i;
+	}
+	qsort(order, n, sizeof(struct tl_start), &tl_start_cmp);
+
+	memcpy(h.magic, SCOREBIN_MAGIC, sizeof(h.magic));
+	h.version = SCOREBIN_VERSION;
+	h.order = SCOREBIN_ORDER;
+	h.rate = rate;
+	h.ninstrs = used;
+	h.n = n;
+	h.end = end;
+	scorebin_layout(&h, n);
+
+	f = fopen(path, "wb");
+	if (!f) {
+		snprintf(err, errlen, "can't create");
+		goto done;
+	}
+
+	if (fwrite(&h, sizeof(h), 1, f) != 1) {
+		goto write_failed;
+	}
+	pos = sizeof(h);
+	for (c=0; c<SCOREBIN_COLUMNS; c++) {
+		if ((fwrite(zero, 1, h.col[c] - pos, f) != h.col[c] - pos)
+			|| (scorebin_put(f, events, ids, order, n, c) != 0)) {
+
+			goto write_failed;
+		}
+		pos = h.col[c] + n * scorebin_width[c];
+	}
+	/* the last column is padded too, the file ends where the layout does */
+	if (fwrite(zero, 1, scorebin_align(pos) - pos, f)
+		!= scorebin_align(pos) - pos) {
+
+		goto write_failed;
+	}
+
+	if (fclose(f) != 0) {
+		f = NULL;
+		goto write_failed;
+	}
+	f = NULL;
+	rc = 0;
+	goto done;
+
+write_failed:
+	snprintf(err, errlen, "can't write");
+
+done:
+	if (f) {
+		fclose(f);
+	}
+	free(ids);
+	free(order);
+
+	return rc;
+}
+
+/* notes recorded by an in-memory timeline, before it plays */
+static inline int
+scorebin_save(const struct timeline *tl, const char *path, unsigned rate,
+	const char *const *names, const struct tl_instr *const *instrs,
+	size_t ninstrs, char *err, size_t errlen)
+{
+	if (tl->stream) {
+		snprintf(err, errlen, "streaming timelines do not keep notes");
+		return -1;
+	}
+	if (tl->ninstances > 0) {
+		snprintf(err, errlen, "clips placed in the timeline are not "
+			"its notes");
+		return -1;
+	}
+
+	return scorebin_write(path, tl->events, tl->nevents, tl->end, rate,
+		names, instrs, ninstrs, err, errlen);
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Text score to compiled score, see scorebin.h
+ *
+ * $ cc -O2 -Wall -pedantic -Wextra scorec.c -o scorec -lm -pthread
+ * $ ./scorec anthem2.score anthem2.scb [instrument ...]
+ *
+ * Instruments are the names the score may use, piano if none are given,
+ * the program playing the compiled score has to know them.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline.h"
+#include "score.h"
+#include "scorebin.h"
+
+static const double R = 44100;        /* sample rate (samples per second) */
+
+/* stand-ins, notes are only recorded */
+static struct tl_instr instrs[SCOREBIN_INSTRS];
+
+int
+main(int argc, char *argv[])
+{
+	static const char *const piano[] = {"piano"};
+	const struct tl_instr *ptrs[SCOREBIN_INSTRS];
+	const char *const *names = piano;
+	struct timeline *tl;
+	char err[256], *text;
+	size_t len, ninstrs = 1, i;
+	int rc;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s score compiled [instrument ...]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc > 3) {
+		names = (const char *const *)argv + 3;
+		ninstrs = argc - 3;
+	}
+	if (ninstrs > SCOREBIN_INSTRS) {
+		fprintf(stderr, "%d instruments at most\n", SCOREBIN_INSTRS);
+		return EXIT_FAILURE;
+	}
+	for (i=0; i<ninstrs; i++) {
+		ptrs[i] = &instrs[i];
+	}
+
+	text = score_read(argv[1], &len);
+	if (!text) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	tl = timeline_init(0);
+	if (!tl) {
+		free(text);
+		return EXIT_FAILURE;
+	}
+
+	rc = score_play(tl, text, len, R, names, ptrs, ninstrs, err,
+		sizeof(err));
+	if (rc != 0) {
+		fprintf(stderr, "%s:%s\n", argv[1], err);
+	} else {
+		rc = scorebin_save(tl, argv[2], R, names, ptrs, ninstrs, err,
+			sizeof(err));
+		if (rc != 0) {
+			fprintf(stderr, "%s: %s\n", argv[2], err);
+		}
+	}
+
+	timeline_free(tl);
+	free(text);
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,679 @@
+/*
+ * Standard MIDI files, type 0 and 1
+ *
+ * smf_open() maps the file and finds its track chunks. smf_parse() walks
+ * all the tracks at once, a cursor in each, always taking the event with
+ * the smallest tick next, so a type 1 file is merged on the fly and no
+ * track is expanded into a list of events. Ticks turn into frames
+ * through the tempo changes met on the way (or the SMPTE division).
+ * Note-on and note-off pairs become notes handed to the sink when the
+ * note ends, with the program, volume (CC 7) and pan (CC 10) the
+ * channel had when it began. A note-on of a key already sounding ends
+ * it first, notes still on at the end of the file end there. Memory is
+ * the cursors and a table of the 16 x 128 keys, whatever the length of
+ * the file.
+ *
+ * Notes come out in order of their end, sink->flush(t) is called
+ * whenever no note can start before frame t any more, the earliest
+ * sounding note or the position of the file, so a streaming timeline
+ * writes out as the file is read.
+ *
+ * smf_play() reads a file into a timeline with a map of programs and of
+ * the keys of the drum channel (10, SMF_DRUMS counted from 0) to
+ * instruments. Sustain, pitch bend and the rest are ignored.
+ */
+#ifndef smf_h_included
+#define smf_h_included
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timeline.h"
+#include "freq.h"
+
+#define SMF_CHANNELS 16
+#define SMF_KEYS 128
+#define SMF_DRUMS 9          /* channel 10 */
+#define SMF_TEMPO 500000     /* microseconds a beat until the file says */
+#define SMF_FLUSH 4096       /* frames at least between flushes */
+
+struct smf_note
+{
+	size_t start, len;   /* in frames */
+	unsigned channel, key, velocity;
+	unsigned program, volume, pan;   /* of the channel at the start */
+};
+
+struct smf_sink
+{
+	int (*note)(void *arg, const struct smf_note *n);
+	int (*flush)(void *arg, size_t t);   /* optional */
+	void *arg;
+};
+
+/* a mapped file */
+struct smf
+{
+	void *map;
+	size_t size;
+	unsigned format, ntracks;
+	unsigned division;   /* ticks a beat, or SMPTE if the top bit is set */
+};
+
+/* cursor in a track */
+struct smf_track
+{
+	const unsigned char *p, *start, *end;
+	uint64_t tick;       /* of the event at p */
+	unsigned status;     /* running status, 0 - none */
+};
+
+/* a key sounding */
+struct smf_key
+{
+	size_t start;
+	unsigned char velocity, program, volume, pan;
+	unsigned open;       /* index in the open list + 1, 0 - off */
+};
+
+struct smf_parser
+{
+	const struct smf *f;
+	const struct smf_sink *sink;
+	unsigned rate;
+
+	/*
+	 * min-heap of unfinished tracks, tick << 16 | track: by tick, then
+	 * by number, in one compare
+	 */
+	struct smf_track *tracks;
+	uint64_t *heap;
+	unsigned nheap;
+
+	/* tempo segment the position is in */
+	uint64_t tempo_tick;
+	double tempo_frame, per_tick;
+
+	unsigned char program[SMF_CHANNELS], volume[SMF_CHANNELS];
+	unsigned char pan[SMF_CHANNELS];
+	struct smf_key keys[SMF_CHANNELS][SMF_KEYS];
+	uint16_t open[SMF_CHANNELS * SMF_KEYS];   /* channel * 128 + key */
+	unsigned nopen;
+
+	size_t frame, flushed;
+	size_t check;        /* frame to look at the open notes again */
+
+	char *err;
+	size_t errlen;
+};
+
+static inline void
+smf_close(struct smf *f)
+{
+	if (f->map) {
+		munmap(f->map, f->size);
+	}
+	f->map = NULL;
+}
+
+static inline uint32_t
+smf_be(const unsigned char *p, int n)
+{
+	uint32_t v = 0;
+
+	while (n-- > 0) {
+		v = (v << 8) | *p++;
+	}
+
+	return v;
+}
+
+/* map a MIDI file and check its chunks, -1 and a message in err if not */
+static inline int
+smf_open(struct smf *f, const char *path, char *err, size_t errlen)
+{
+	const unsigned char *p, *end;
+	struct stat st;
+	unsigned n;
+	int fd;
+
+	memset(f, 0, sizeof(*f));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		snprintf(err, errlen, "can't open");
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) || (st.st_size < 14)) {
+		snprintf(err, errlen, "not a MIDI file");
+		close(fd);
+		return -1;
+	}
+	f->size = st.st_size;
+	f->map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (f->map == MAP_FAILED) {
+		f->map = NULL;
+		snprintf(err, errlen, "can't map");
+		return -1;
+	}
+	posix_madvise(f->map, f->size, POSIX_MADV_SEQUENTIAL);
+
+	p = (const unsigned char *)f->map;
+	end = p + f->size;
+	if ((memcmp(p, "MThd", 4) != 0) || (smf_be(p + 4, 4) < 6)
+		|| (smf_be(p + 4, 4) > f->size - 8)) {
+
+		snprintf(err, errlen, "not a MIDI file");
+		goto fail;
+	}
+	f->format = smf_be(p + 8, 2);
+	f->ntracks = smf_be(p + 10, 2);
+	f->division = smf_be(p + 12, 2);
+	if (f->format > 1) {
+		snprintf(err, errlen, "type %u files are not supported",
+			f->format);
+		goto fail;
+	}
+	if ((f->division & 0x7fff) == 0) {
+		snprintf(err, errlen, "division 0");
+		goto fail;
+	}
+
+	/* there have to be as many tracks as the header says */
+	p += 8 + smf_be(p + 4, 4);
+	for (n=0; (n<f->ntracks) && (p <= end - 8); ) {
+		uint32_t len = smf_be(p + 4, 4);
+
+		if (len > (size_t)(end - p) - 8) {
+			snprintf(err, errlen, "chunk at byte %lu: truncated",
+				(unsigned long)(p - (const unsigned char *)f->map));
+			goto fail;
+		}
+		if (memcmp(p, "MTrk", 4) == 0) {
+			n++;
+		}
+		p += 8 + len;
+	}
+	if (n < f->ntracks) {
+		snprintf(err, errlen, "%u tracks of %u", n, f->ntracks);
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	smf_close(f);
+	return -1;
+}
+
+static inline void
+smf_fail(struct smf_parser *ps, const struct smf_track *t, const char *msg)
+{
+	snprintf(ps->err, ps->errlen, "track %u, byte %lu: %s",
+		(unsigned)(t - ps->tracks) + 1,
+		(unsigned long)(t->p - (const unsigned char *)ps->f->map), msg);
+}
+
+/* variable length quantity, -1 if it runs over the end */
+static inline int
+smf_varlen(const unsigned char **p, const unsigned char *end, uint32_t *v)
+{
+	int i;
+
+	*v = 0;
+	for (i=0; (i<4) && (*p < end); i++) {
+		unsigned char c = *(*p)++;
+
+		*v = (*v << 7) | (c & 0x7f);
+		if (!(c & 0x80)) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static inline void
+smf_heap_down(struct smf_parser *ps, unsigned i)
+{
+	uint64_t *h = ps->heap, v = h[i];
+	unsigned n = ps->nheap;
+
+	for (;;) {
+		unsigned m = 2 * i + 1;
+
+		if (m >= n) {
+			break;
+		}
+		if ((m + 1 < n) && (h[m + 1] < h[m])) {
+			m++;
+		}
+		if (v <= h[m]) {
+			break;
+		}
+		h[i] = h[m];
+		i = m;
+	}
+	h[i] = v;
+}
+
+/* frame of a tick at or after the last tempo change */
+static inline size_t
+smf_frame(const struct smf_parser *ps, uint64_t tick)
+{
+	return (size_t)(ps->tempo_frame
+		+ (double)(tick - ps->tempo_tick) * ps->per_tick + 0.5);
+}
+
+static inline void
+smf_tempo(struct smf_parser *ps, uint64_t tick, uint32_t us)
+{
+	ps->tempo_frame += (double)(tick - ps->tempo_tick) * ps->per_tick;
+	ps->tempo_tick = tick;
+	ps->per_tick = (double)ps->rate * us / 1e6 / ps->f->division;
+}
+
+/* the key is over at the current frame */
+static inline int
+smf_note_off(struct smf_parser *ps, unsigned channel, unsigned key)
+{
+	struct smf_key *k = &ps->keys[channel][key];
+	struct smf_note n;
+	unsigned last;
+
+	/* out of the open list, the last one takes its place */
+	last = ps->open[--ps->nopen];
+	ps->open[k->open - 1] = last;
+	ps->keys[last >> 7][last & 0x7f].open = k->open;
+	k->open = 0;
+
+	n.start = k->start;
+	n.len = ps->frame - k->start;
+	n.channel = channel;
+	n.key = key;
+	n.velocity = k->velocity;
+	n.program = k->program;
+	n.volume = k->volume;
+	n.pan = k->pan;
+
+	return ps->sink->note(ps->sink->arg, &n);
+}
+
+static inline int
+smf_note_on(struct smf_parser *ps, unsigned channel, unsigned key,
+	unsigned velocity)
+{
+	struct smf_key *k = &ps->keys[channel][key];
+
+	if (k->open && (smf_note_off(ps, channel, key) != 0)) {
+		return -1;
+	}
+
+	k->start = ps->frame;
+	k->velocity = velocity;
+	k->program = ps->program[channel];
+	k->volume = ps->volume[channel];
+	k->pan = ps->pan[channel];
+	ps->open[ps->nopen++] = channel << 7 | key;
+	k->open = ps->nopen;
+
+	return 0;
+}
+
+/*
+ * nothing starts before the earliest sounding note or the position, the
+ * notes are looked at every SMF_FLUSH frames, a held note would have
+ * them looked at for every event otherwise
+ */
+static inline int
+smf_flush(struct smf_parser *ps)
+{
+	size_t t = ps->frame;
+	unsigned i;
+
+	if (!ps->sink->flush || (t < ps->check)) {
+		return 0;
+	}
+	ps->check = t + SMF_FLUSH;
+
+	for (i=0; i<ps->nopen; i++) {
+		const struct smf_key *k = &ps->keys[ps->open[i] >> 7]
+			[ps->open[i] & 0x7f];
+
+		t = k->start < t ? k->start : t;
+	}
+	if (t <= ps->flushed) {
+		return 0;
+	}
+
+	ps->flushed = t;
+	return ps->sink->flush(ps->sink->arg, t);
+}
+
+/* the event at the cursor, then on to the tick of the next one */
+static inline int
+smf_event(struct smf_parser *ps, struct smf_track *t, int *done)
+{
+	const unsigned char *end = t->end;
+	unsigned status, channel, a = 0, b = 0;
+	uint32_t len, delta;
+
+	if (t->p == end) {
+		*done = 1;
+		return 0;
+	}
+
+	status = *t->p;
+	if (status & 0x80) {
+		t->p++;
+	} else if (t->status) {
+		status = t->status;
+	} else {
+		smf_fail(ps, t, "data without a status");
+		return -1;
+	}
+
+	if (status < 0xf0) {
+		int ndata = ((status & 0xe0) == 0xc0) ? 1 : 2;
+
+		if (end - t->p < ndata) {
+			smf_fail(ps, t, "truncated");
+			return -1;
+		}
+		a = t->p[0] & 0x7f;
+		b = ndata == 2 ? t->p[1] & 0x7f : 0;
+		t->p += ndata;
+		t->status = status;
+
+		channel = status & 0x0f;
+		switch (status & 0xf0) {
+		case 0x90:
+			if (b > 0) {
+				if (smf_note_on(ps, channel, a, b) != 0) {
+					return -1;
+				}
+				break;
+			}
+			/* velocity 0 is note-off */
+			/* fallthrough */
+		case 0x80:
+			if (ps->keys[channel][a].open
+				&& (smf_note_off(ps, channel, a) != 0)) {
+
+				return -1;
+			}
+			break;
+		case 0xb0:
+			if (a == 7) {
+				ps->volume[channel] = b;
+			} else if (a == 10) {
+				ps->pan[channel] = b;
+			}
+			break;
+		case 0xc0:
+			ps->program[channel] = a;
+			break;
+		}
+	} else if ((status == 0xf0) || (status == 0xf7) || (status == 0xff)) {
+		unsigned type = 0;
+
+		/* sysex and meta events cancel running status */
+		t->status = 0;
+		if (status == 0xff) {
+			if (t->p == end) {
+				smf_fail(ps, t, "truncated");
+				return -1;
+			}
+			type = *t->p++;
+		}
+		if ((smf_varlen(&t->p, end, &len) != 0)
+			|| ((size_t)(end - t->p) < len)) {
+
+			smf_fail(ps, t, "truncated");
+			return -1;
+		}
+
+		if ((status == 0xff) && (type == 0x51) && (len == 3)
+			&& !(ps->f->division & 0x8000)) {
+
+			smf_tempo(ps, t->tick, smf_be(t->p, 3));
+		}
+		t->p += len;
+		if ((status == 0xff) && (type == 0x2f)) {
+			*done = 1;
+			return 0;
+		}
+	} else {
+		smf_fail(ps, t, "not a file event");
+		return -1;
+	}
+
+	if (t->p == end) {
+		*done = 1;
+		return 0;
+	}
+	if (smf_varlen(&t->p, end, &delta) != 0) {
+		smf_fail(ps, t, "truncated");
+		return -1;
+	}
+	t->tick += delta;
+
+	return 0;
+}
+
+/*
+ * go through the tracks of f, hand notes to the sink at rate frames a
+ * second. -1 and a message in err if the file is broken or the sink
+ * failed
+ */
+static inline int
+smf_parse(const struct smf *f, unsigned rate, const struct smf_sink *sink,
+	char *err, size_t errlen)
+{
+	const unsigned char *p;
+	struct smf_parser *ps;
+	unsigned i, n;
+	int rc = -1;
+
+	if (errlen > 0) {
+		err[0] = '\0';
+	}
+
+	ps = (struct smf_parser *)calloc(1, sizeof(struct smf_parser));
+	if (!ps) {
+		snprintf(err, errlen, "out of memory");
+		return -1;
+	}
+	ps->tracks = (struct smf_track *)calloc(f->ntracks + 1,
+		sizeof(struct smf_track));
+	ps->heap = (uint64_t *)calloc(f->ntracks + 1, sizeof(uint64_t));
+	if (!ps->tracks || !ps->heap) {
+		snprintf(err, errlen, "out of memory");
+		goto done;
+	}
+
+	ps->f = f;
+	ps->sink = sink;
+	ps->rate = rate;
+	ps->err = err;
+	ps->errlen = errlen;
+	for (i=0; i<SMF_CHANNELS; i++) {
+		ps->volume[i] = 100;
+		ps->pan[i] = 64;
+	}
+	if (f->division & 0x8000) {
+		/* frames a second and ticks a frame */
+		ps->per_tick = (double)rate / (256 - (f->division >> 8))
+			/ (f->division & 0xff);
+	} else {
+		ps->per_tick = (double)rate * SMF_TEMPO / 1e6 / f->division;
+	}
+
+	/* cursors at the first delta of every track, smf_open() checked */
+	p = (const unsigned char *)f->map;
+	p += 8 + smf_be(p + 4, 4);
+	for (n=0; n<f->ntracks; ) {
+		uint32_t len = smf_be(p + 4, 4);
+
+		if (memcmp(p, "MTrk", 4) == 0) {
+			struct smf_track *t = &ps->tracks[n];
+			uint32_t delta;
+
+			t->start = t->p = p + 8;
+			t->end = p + 8 + len;
+			if (t->p < t->end) {
+				if (smf_varlen(&t->p, t->end, &delta) != 0) {
+					smf_fail(ps, t, "truncated");
+					goto done;
+				}
+				t->tick = delta;
+				ps->heap[ps->nheap++] = (uint64_t)delta << 16 | n;
+			}
+			n++;
+		}
+		p += 8 + len;
+	}
+	for (i=ps->nheap/2; i-->0; ) {
+		smf_heap_down(ps, i);
+	}
+
+	while (ps->nheap > 0) {
+		unsigned top = ps->heap[0] & 0xffff;
+		struct smf_track *t = &ps->tracks[top];
+		int done = 0;
+
+		ps->frame = smf_frame(ps, t->tick);
+		if (smf_event(ps, t, &done) != 0) {
+			goto done;
+		}
+		if (done) {
+			ps->heap[0] = ps->heap[--ps->nheap];
+		} else {
+			ps->heap[0] = t->tick << 16 | top;
+		}
+		smf_heap_down(ps, 0);
+
+		if (smf_flush(ps) != 0) {
+			snprintf(err, errlen, "can't flush");
+			goto done;
+		}
+	}
+
+	/* what still sounds ends with the file */
+	while (ps->nopen > 0) {
+		unsigned last = ps->open[ps->nopen - 1];
+
+		if (smf_note_off(ps, last >> 7, last & 0x7f) != 0) {
+			goto done;
+		}
+	}
+	rc = 0;
+
+done:
+	if ((rc != 0) && (err[0] == '\0')) {
+		snprintf(err, errlen, "can't add a note");
+	}
+	free(ps->heap);
+	free(ps->tracks);
+	free(ps);
+
+	return rc;
+}
+
+/* what a program, or a key of the drum channel, plays */
+struct smf_patch
+{
+	const struct tl_instr *instr;   /* NULL - nothing */
+	double gain;     /* loudness at full velocity and volume */
+	int note;        /* pitch like freq.h, 0 - of the key */
+	double hold;     /* seconds the note sounds at least */
+	double pan;      /* of drums, other channels have CC 10 */
+};
+
+struct smf_map
+{
+	struct smf_patch program[128];
+	struct smf_patch drum[SMF_KEYS];
+};
+
+struct smf_timeline
+{
+	struct timeline *tl;
+	const struct smf_map *map;
+	unsigned rate;
+};
+
+static inline int
+smf_tl_note(void *arg, const struct smf_note *n)
+{
+	struct smf_timeline *st = (struct smf_timeline *)arg;
+	const struct smf_patch *patch;
+	struct tl_event ev;
+	size_t hold;
+
+	if (n->channel == SMF_DRUMS) {
+		patch = &st->map->drum[n->key];
+	} else {
+		patch = &st->map->program[n->program];
+	}
+	if (!patch->instr) {
+		return 0;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.instr = patch->instr;
+	ev.start = n->start;
+	ev.len = n->len;
+	hold = patch->hold * st->rate;
+	if (ev.len < hold) {
+		ev.len = hold;
+	}
+	ev.loudness = patch->gain * n->velocity / 127.0 * n->volume / 127.0;
+	ev.note = patch->note ? patch->note : (int)n->key - 20;
+	ev.fr = freq(ev.note);
+	/* noise differs from note to note and is the same every time */
+	ev.seed = (unsigned)n->start * 2654435761u + n->key;
+	if (n->channel == SMF_DRUMS) {
+		ev.pan = patch->pan;
+	} else {
+		ev.pan = n->pan >= 64 ? (n->pan - 64) / 63.0
+			: (n->pan - 64) / 64.0;
+	}
+
+	return timeline_add(st->tl, &ev);
+}
+
+static inline int
+smf_tl_flush(void *arg, size_t t)
+{
+	struct smf_timeline *st = (struct smf_timeline *)arg;
+
+	return timeline_flush_until(st->tl, t);
+}
+
+/* add the notes of a MIDI file to a timeline, instruments by map */
+static inline int
+smf_play(struct timeline *tl, const struct smf *f, unsigned rate,
+	const struct smf_map *map, char *err, size_t errlen)
+{
+	struct smf_timeline st;
+	struct smf_sink sink;
+
+	st.tl = tl;
+	st.map = map;
+	st.rate = rate;
+	sink.note = &smf_tl_note;
+	sink.flush = &smf_tl_flush;
+	sink.arg = &st;
+
+	return smf_parse(f, rate, &sink, err, errlen);
+}
+
+#endif
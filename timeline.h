@@ -0,0 +1,2446 @@
+/*
+ * Timeline: notes are mixed into float planes which are written to
+ * stdout as S16_LE PCM
+ *
+ * Notes are mono. Centered ones (pan 0) are mixed once into the mono bus
+ * which goes to both channels, notes with a pan are mixed into left and
+ * right side planes with constant power gains, unity in the middle and
+ * sqrt(2) at the edges. The channels are put together block by block on
+ * output, left = mono + left side, and the sides cost nothing until a
+ * panned note is there.
+ *
+ * Two modes:
+ *
+ *   timeline_init(n)     - the whole piece lives in memory. Notes are
+ *                          recorded as events and rendered when output
+ *                          starts in timeline_play(). Planes are split
+ *                          in pages allocated on first write, so silence
+ *                          costs nothing and the piece may be of any
+ *                          length, n is just a hint.
+ *
+ *   timeline_stream_init() - notes are kept as events and rendered block
+ *                          by block into a small ring buffer, finished
+ *                          blocks go to stdout right away. Memory does
+ *                          not depend on the length of the piece.
+ *
+ * An in-memory timeline renders on one thread with a scheduler: events
+ * are sorted by start sample and the piece is swept block by block, a
+ * note becomes a voice when the sweep reaches it and every voice
+ * sounding mixes its TL_BLOCK samples into a small bus that stays in L1,
+ * which then goes into the pages once. Rendering each note over its
+ * whole length instead walks every page it covers once per note and
+ * misses the cache for each of them. Voices mix in the order notes were
+ * added.
+ *
+ * timeline_source(tl, src) gives an in-memory timeline notes it does not
+ * keep itself, sorted by start somewhere else, e.g. columns of a mapped
+ * file (scorebin.h). The scheduler reads them in place as the sweep
+ * gets to them, after the notes added.
+ *
+ * timeline_clip(tl, clip, start, gain) places a pattern, e.g. a bar of
+ * drums: clip is an in-memory timeline of its own with notes from frame
+ * 0 on. It is rendered once, when the first timeline it is placed in
+ * renders, after that a placement only mixes its planes in at start
+ * with gain, a pass of the mixing kernel over the clip instead of all
+ * its notes again. Placements add up like notes, tails ringing into the
+ * next one included, and clips may hold clips. Voices keep no state from
+ * one note to another, so no placement needs its notes rendered again,
+ * except in streaming mode: there are no pages to mix into and the notes
+ * the clip holds are added one by one. Notes of a clip sit on frames of
+ * the clip, a frame away at most from where the same note added to the
+ * piece itself would, and they are summed in a different order.
+ *
+ * In streaming mode timeline_flush_until(tl, t) tells the timeline that
+ * no note will start before sample t any more, everything before t is
+ * rendered and written out. Notes starting before the already written
+ * part lose their head.
+ *
+ * timeline_threads(tl, n) makes an in-memory timeline only record notes
+ * and render them in timeline_play() on n threads (0 - one per CPU or
+ * $TL_THREADS). The piece is cut in page sized slices, a thread renders
+ * every note overlapping its slice from the right offset into pages
+ * nobody else touches. Instruments give the same samples whatever the
+ * block boundaries are and notes are mixed in the order they were
+ * added, so the result is bit for bit what one thread gives.
+ * Instruments with state have to be able to start at any offset.
+ *
+ * timeline_cache(tl, max_bytes) turns on the note cache: every distinct
+ * (instrument, frequency, note, param, seed, length) is rendered once at
+ * unit loudness and then only mixed in with its loudness. Least recently
+ * used notes are dropped when the cache grows over max_bytes (0 -
+ * $TL_CACHE_MB or TL_CACHE_MB megabytes), notes that do not fit are
+ * rendered as usual. Mixing is the same for both, so is the output.
+ * Notes made from noise differ by seed and never hit, pieces full of
+ * them are better off without the cache.
+ *
+ * timeline_window(tl, start, end) right after init limits the timeline
+ * to frames start .. end - 1 (end 0 - to the end of the piece): notes
+ * outside are dropped when added, notes crossing the edges are rendered
+ * only over the part inside, bypassing the cache, and only the window is
+ * written out. Instruments have to be able to start at any offset here
+ * as well. Positions stay those of the whole piece.
+ *
+ * Programs playing the piece themselves take it from an in-memory
+ * timeline with timeline_read() instead of timeline_play(), or send the
+ * PCM to a descriptor of their own with timeline_output().
+ *
+ * Notes with zero loudness are not rendered at all. Instruments knowing
+ * how their envelope decays tell it with audible(), notes of those are
+ * cut where they drop below the silence threshold for good: -120 dBFS
+ * per note unless timeline_cull(tl, db) or $TL_CULL_DB say otherwise
+ * (-inf turns this off). The piece keeps its length either way.
+ *
+ * Rendering runs with flush-to-zero and denormals-are-zero set for the
+ * thread, see tl_fp_enter(). Build with -DTL_DENORMALS to keep them.
+ *
+ * With $TL_STATS set timeline_free() prints counters to stderr.
+ */
+#ifndef timeline_h_included
+#define timeline_h_included
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "pcm.h"
+
+#if defined(__FMA__) && !defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define TL_BLOCK 1024         /* frames rendered at once */
+#define TL_RING_BLOCKS 16     /* streaming ring buffer size in blocks */
+
+#define TL_PAGE_BITS 14
+#define TL_PAGE (1 << TL_PAGE_BITS)   /* frames per page */
+
+#define TL_CACHE_MB 64        /* default note cache size */
+#define TL_CULL_DB (-120)     /* default silence threshold, dBFS */
+
+struct tl_event;
+
+/* instrument */
+struct tl_instr
+{
+	/*
+	 * fill out[0 .. n) with samples off .. off + n - 1 of the note,
+	 * loudness is applied by the timeline. n is at most TL_BLOCK.
+	 * Calls for one note come with consecutive offsets, starting
+	 * from 0 unless the note is rendered on several threads or
+	 * begins before the render window
+	 */
+	void (*render)(const struct tl_event *ev, void *voice,
+		float *out, size_t off, size_t n);
+
+	size_t voice_size;              /* per-note state, zeroed */
+	void (*release)(void *voice);   /* optional */
+
+	/*
+	 * optional envelope bound: samples after which |out| stays below
+	 * level for good at unit loudness, ev->len if it never gets there
+	 */
+	size_t (*audible)(const struct tl_event *ev, double level);
+};
+
+/* note */
+struct tl_event
+{
+	const struct tl_instr *instr;
+
+	size_t start, len;   /* in samples */
+	double loudness;
+	double pan;          /* -1 left .. 1 right, 0 - center */
+
+	/* instrument parameters */
+	double fr;
+	int note;
+	double param;
+	unsigned seed;   /* for instruments using noise */
+};
+
+/* rendered note at unit loudness */
+struct tl_centry
+{
+	/* key */
+	const struct tl_instr *instr;
+	size_t len;
+	double fr, param;
+	int note;
+	unsigned seed;
+
+	uint64_t hash;
+	float *data;
+	int ready;    /* data is rendered */
+	size_t pins;  /* notes playing from it, not dropped while > 0 */
+
+	struct tl_centry *hnext;         /* hash chain */
+	struct tl_centry *prev, *next;   /* most recently used first */
+};
+
+struct tl_cache
+{
+	struct tl_centry **buckets;
+	size_t nbuckets, nentries;
+
+	struct tl_centry *head, *tail;
+	size_t bytes, max_bytes;
+
+	size_t hits, misses, evictions;
+	size_t bypassed;   /* did not fit */
+};
+
+struct tl_voice
+{
+	struct tl_event ev;
+	size_t off;   /* next sample of the note */
+	void *state;
+	struct tl_centry *cached;   /* or NULL, then it renders itself */
+	size_t seq;   /* order the note was added in, for the scheduler */
+};
+
+/* recorded note by start, for the scheduler */
+struct tl_start
+{
+	size_t start;
+	size_t ev;
+};
+
+/*
+ * notes for the scheduler in order of start, the recorded ones or notes
+ * read in place from elsewhere, see timeline_source(). start(arg, i) is
+ * where note i starts, event(arg, i, ev, seq) gives the note and the
+ * order its voice mixes in, -1 if it can not
+ */
+struct tl_source
+{
+	size_t n;
+	size_t end;   /* end of the last note */
+	size_t (*start)(const void *arg, size_t i);
+	int (*event)(const void *arg, size_t i, struct tl_event *ev,
+		size_t *seq);
+	const void *arg;
+	int admit;    /* notes did not come through timeline_add() */
+};
+
+/* clip placed in a timeline, see timeline_clip() */
+struct tl_instance
+{
+	struct timeline *clip;
+	size_t start;
+	float gain;
+};
+
+struct tl_pending
+{
+	struct tl_event ev;
+	size_t seq;   /* notes starting together keep the order they came in */
+};
+
+struct tl_stream
+{
+	size_t pos;   /* first frame of the next block */
+	size_t end;   /* end of the last note */
+	size_t seq;
+
+	/* min-heap by start */
+	struct tl_pending *pending;
+	size_t npending, pending_size;
+
+	/* in order of start */
+	struct tl_voice *active;
+	size_t nactive, active_size;
+
+	float mono[TL_RING_BLOCKS][TL_BLOCK];
+	float left[TL_RING_BLOCKS][TL_BLOCK];
+	float right[TL_RING_BLOCKS][TL_BLOCK];
+	int sides[TL_RING_BLOCKS];   /* left and right are in use */
+	size_t ring_head, ring_used;
+
+	struct pcm_writer out;
+};
+
+/* paged plane, NULL pages were never written to */
+struct tl_plane
+{
+	float **pages;
+	size_t npages;
+};
+
+struct timeline
+{
+	size_t n;     /* samples covered by the page tables */
+	size_t end;
+
+	struct tl_plane mono, left, right;
+	float min, max;
+
+	struct tl_stream *stream;
+	struct tl_cache *cache;
+	int fd;       /* output, stdout unless timeline_output() */
+
+	size_t win_start, win_end;   /* render window */
+
+	/* silence culling, threshold as amplitude */
+	double cull;
+	size_t culled_silent, culled_short, culled_samples;
+
+	/* deferred rendering */
+	int nthreads;
+	struct tl_event *events;
+	size_t nevents, events_size;
+	const struct tl_source *source;   /* rendered after the events */
+
+	/* placed clips, mixed in after the notes */
+	struct tl_instance *instances;
+	size_t ninstances, instances_size;
+
+	float scratch[TL_BLOCK];
+};
+
+/* events overlapping one slice, in order they were added */
+struct tl_slice
+{
+	size_t *ev;
+	size_t n, size;
+};
+
+struct tl_job
+{
+	struct timeline *tl;
+
+	struct tl_slice *slices;
+	size_t nslices;
+	size_t voice_size;
+
+	/* cache entry of every event, entries to render and their events */
+	struct tl_centry **cached;
+	struct tl_centry **fill;
+	size_t *fill_ev;
+	size_t nfill;
+
+	pthread_mutex_t lock;
+	size_t next, ntasks;
+	int rc;
+};
+
+/*
+ * Decaying notes and feedback loops end up in subnormal numbers, on x86
+ * every operation on one takes a microcode assist and a fading loop gets
+ * 10 - 100 times slower. Everything rendering notes does it between
+ * tl_fp_enter() and tl_fp_leave(): subnormal results and inputs are
+ * taken as zero there (MXCSR FTZ and DAZ, FZ in the ARM FPCR), the mode
+ * of the thread is restored afterwards. Normal numbers are not affected.
+ */
+static inline unsigned long
+tl_fp_enter(void)
+{
+#if defined(TL_DENORMALS)
+	return 0;
+#elif defined(__SSE__)
+	unsigned csr = _mm_getcsr();
+
+	_mm_setcsr(csr | 0x8040);   /* FTZ | DAZ */
+	return csr;
+#elif defined(__aarch64__)
+	unsigned long fpcr;
+
+	__asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+	__asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1UL << 24)));
+	return fpcr;
+#else
+	return 0;
+#endif
+}
+
+static inline void
+tl_fp_leave(unsigned long mode)
+{
+#if defined(TL_DENORMALS)
+	(void)mode;
+#elif defined(__SSE__)
+	_mm_setcsr((unsigned)mode);
+#elif defined(__aarch64__)
+	__asm__ __volatile__("msr fpcr, %0" : : "r"(mode));
+#else
+	(void)mode;
+#endif
+}
+
+/*
+ * mixing kernel every note goes through. Where samples of a note fall
+ * between the vector part and the tail depends on how it was split, so
+ * all parts round the same way: fused multiply-add when the target has
+ * it, separate multiply and add otherwise
+ */
+static inline void
+tl_mix(float *restrict dst, const float *restrict src, float gain, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256 g8 = _mm256_set1_ps(gain);
+
+	for (; i + 8 <= n; i += 8) {
+		__m256 d = _mm256_loadu_ps(dst + i);
+		__m256 s = _mm256_loadu_ps(src + i);
+
+#if defined(__FMA__)
+		d = _mm256_fmadd_ps(s, g8, d);
+#else
+		d = _mm256_add_ps(d, _mm256_mul_ps(s, g8));
+#endif
+		_mm256_storeu_ps(dst + i, d);
+	}
+#elif defined(__SSE2__)
+	const __m128 g4 = _mm_set1_ps(gain);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128 d = _mm_loadu_ps(dst + i);
+		__m128 s = _mm_loadu_ps(src + i);
+
+#if defined(__FMA__)
+		d = _mm_fmadd_ps(s, g4, d);
+#else
+		d = _mm_add_ps(d, _mm_mul_ps(s, g4));
+#endif
+		_mm_storeu_ps(dst + i, d);
+	}
+#endif
+
+	for (; i<n; i++) {
+#if defined(__FMA__)
+		dst[i] = fmaf(src[i], gain, dst[i]);
+#else
+		dst[i] += src[i] * gain;
+#endif
+	}
+}
+
+/*
+ * channel out of the mono bus and a side, dst = m + s. NULL is silence,
+ * without a side the bus goes out as it is
+ */
+static inline void
+tl_bus_side(float *dst, const float *m, const float *s, size_t n)
+{
+	size_t i;
+
+	if (!s) {
+		if (m) {
+			memcpy(dst, m, sizeof(float) * n);
+		} else {
+			memset(dst, 0, sizeof(float) * n);
+		}
+	} else if (!m) {
+		for (i=0; i<n; i++) {
+			dst[i] = 0.0f + s[i];
+		}
+	} else {
+		for (i=0; i<n; i++) {
+			dst[i] = m[i] + s[i];
+		}
+	}
+}
+
+static inline int
+tl_plane_grow(struct tl_plane *p, size_t npages)
+{
+	float **pages;
+
+	if (npages <= p->npages) {
+		return 0;
+	}
+
+	pages = realloc(p->pages, npages * sizeof(float *));
+	if (!pages) {
+		return -1;
+	}
+	memset(pages + p->npages, 0, (npages - p->npages) * sizeof(float *));
+
+	p->pages = pages;
+	p->npages = npages;
+
+	return 0;
+}
+
+static inline void
+tl_plane_free(struct tl_plane *p)
+{
+	size_t i;
+
+	for (i=0; i<p->npages; i++) {
+		free(p->pages[i]);
+	}
+	free(p->pages);
+
+	p->pages = NULL;
+	p->npages = 0;
+}
+
+/* page of the plane, NULL if it was never written to */
+static inline float *
+tl_plane_page(const struct tl_plane *p, size_t page)
+{
+	return page < p->npages ? p->pages[page] : NULL;
+}
+
+/* dst[t .. t + n) += src * gain, pages are allocated as needed */
+static inline int
+tl_plane_mix(struct tl_plane *p, size_t t, const float *src, float gain,
+	size_t n)
+{
+	size_t last = (t + n - 1) >> TL_PAGE_BITS;
+
+	if (last >= p->npages) {
+		/* grow geometrically, long pieces are written front to back */
+		size_t npages = p->npages * 2;
+
+		if (npages <= last) {
+			npages = last + 1;
+		}
+		if (tl_plane_grow(p, npages) != 0) {
+			return -1;
+		}
+	}
+
+	while (n > 0) {
+		size_t page = t >> TL_PAGE_BITS;
+		size_t off = t & (TL_PAGE - 1);
+		size_t chunk = TL_PAGE - off;
+
+		if (chunk > n) {
+			chunk = n;
+		}
+
+		if (!p->pages[page]) {
+			p->pages[page] = calloc(TL_PAGE, sizeof(float));
+			if (!p->pages[page]) {
+				return -1;
+			}
+		}
+
+		tl_mix(p->pages[page] + off, src, gain, chunk);
+
+		t += chunk;
+		src += chunk;
+		n -= chunk;
+	}
+
+	return 0;
+}
+
+static inline uint64_t
+tl_cache_hash(const struct tl_event *ev)
+{
+	uint64_t k[6], h = 1469598103934665603ULL;
+	size_t i;
+
+	k[0] = (uintptr_t)ev->instr;
+	k[1] = ev->len;
+	memcpy(&k[2], &ev->fr, sizeof(double));
+	memcpy(&k[3], &ev->param, sizeof(double));
+	k[4] = (unsigned)ev->note;
+	k[5] = ev->seed;
+
+	for (i=0; i<6; i++) {
+		h = (h ^ k[i]) * 1099511628211ULL;
+		h ^= h >> 29;
+	}
+
+	return h;
+}
+
+static inline int
+tl_cache_same(const struct tl_centry *e, const struct tl_event *ev)
+{
+	return (e->instr == ev->instr) && (e->len == ev->len)
+		&& (e->fr == ev->fr) && (e->param == ev->param)
+		&& (e->note == ev->note) && (e->seed == ev->seed);
+}
+
+static inline void
+tl_cache_unlink(struct tl_cache *c, struct tl_centry *e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		c->head = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	} else {
+		c->tail = e->prev;
+	}
+	e->prev = e->next = NULL;
+}
+
+static inline void
+tl_cache_push(struct tl_cache *c, struct tl_centry *e)
+{
+	e->prev = NULL;
+	e->next = c->head;
+	if (c->head) {
+		c->head->prev = e;
+	} else {
+		c->tail = e;
+	}
+	c->head = e;
+}
+
+static inline void
+tl_cache_drop(struct tl_cache *c, struct tl_centry *e)
+{
+	struct tl_centry **pp;
+	size_t b = e->hash & (c->nbuckets - 1);
+
+	for (pp=&c->buckets[b]; *pp!=e; pp=&(*pp)->hnext)
+		;
+	*pp = e->hnext;
+
+	tl_cache_unlink(c, e);
+	c->bytes -= e->len * sizeof(float);
+	c->nentries--;
+
+	free(e->data);
+	free(e);
+}
+
+/* make room for size more bytes, notes in use stay */
+static inline int
+tl_cache_evict(struct tl_cache *c, size_t size)
+{
+	struct tl_centry *e = c->tail;
+
+	while ((c->bytes + size > c->max_bytes) && e) {
+		struct tl_centry *prev = e->prev;
+
+		if (e->pins == 0) {
+			tl_cache_drop(c, e);
+			c->evictions++;
+		}
+		e = prev;
+	}
+
+	return c->bytes + size > c->max_bytes ? -1 : 0;
+}
+
+static inline int
+tl_cache_rehash(struct tl_cache *c, size_t nbuckets)
+{
+	struct tl_centry **buckets;
+	size_t i;
+
+	buckets = calloc(nbuckets, sizeof(struct tl_centry *));
+	if (!buckets) {
+		return -1;
+	}
+
+	for (i=0; i<c->nbuckets; i++) {
+		struct tl_centry *e, *next;
+
+		for (e=c->buckets[i]; e; e=next) {
+			size_t b = e->hash & (nbuckets - 1);
+
+			next = e->hnext;
+			e->hnext = buckets[b];
+			buckets[b] = e;
+		}
+	}
+
+	free(c->buckets);
+	c->buckets = buckets;
+	c->nbuckets = nbuckets;
+
+	return 0;
+}
+
+/*
+ * entry for the note, pinned, data is not rendered yet if it was not
+ * there before. NULL if it does not fit
+ */
+static inline struct tl_centry *
+tl_cache_get(struct tl_cache *c, const struct tl_event *ev)
+{
+	struct tl_centry *e;
+	uint64_t hash = tl_cache_hash(ev);
+	size_t b, size = ev->len * sizeof(float);
+
+	b = hash & (c->nbuckets - 1);
+	for (e=c->buckets[b]; e; e=e->hnext) {
+		if ((e->hash == hash) && tl_cache_same(e, ev)) {
+			tl_cache_unlink(c, e);
+			tl_cache_push(c, e);
+			e->pins++;
+			c->hits++;
+			return e;
+		}
+	}
+
+	c->misses++;
+
+	if ((size > c->max_bytes) || (tl_cache_evict(c, size) != 0)) {
+		goto no_room;
+	}
+
+	if (c->nentries >= c->nbuckets) {
+		if (tl_cache_rehash(c, c->nbuckets * 2) != 0) {
+			goto no_room;
+		}
+		b = hash & (c->nbuckets - 1);
+	}
+
+	e = calloc(1, sizeof(struct tl_centry));
+	if (!e) {
+		goto no_room;
+	}
+	e->data = malloc(size);
+	if (!e->data) {
+		goto data_malloc_failed;
+	}
+
+	e->instr = ev->instr;
+	e->len = ev->len;
+	e->fr = ev->fr;
+	e->param = ev->param;
+	e->note = ev->note;
+	e->seed = ev->seed;
+	e->hash = hash;
+	e->pins = 1;
+
+	e->hnext = c->buckets[b];
+	c->buckets[b] = e;
+	tl_cache_push(c, e);
+	c->nentries++;
+	c->bytes += size;
+
+	return e;
+
+data_malloc_failed:
+	free(e);
+
+no_room:
+	c->bypassed++;
+	return NULL;
+}
+
+/* render the whole note at unit loudness */
+static inline int
+tl_cache_fill(struct tl_centry *e, const struct tl_event *ev)
+{
+	void *state = NULL;
+	size_t off;
+
+	if (ev->instr->voice_size) {
+		state = calloc(1, ev->instr->voice_size);
+		if (!state) {
+			return -1;
+		}
+	}
+
+	for (off=0; off<ev->len; off+=TL_BLOCK) {
+		size_t n = ev->len - off;
+
+		if (n > TL_BLOCK) {
+			n = TL_BLOCK;
+		}
+		ev->instr->render(ev, state, e->data + off, off, n);
+	}
+
+	if (ev->instr->release) {
+		ev->instr->release(state);
+	}
+	free(state);
+
+	e->ready = 1;
+
+	return 0;
+}
+
+static inline void
+tl_cache_free(struct tl_cache *c)
+{
+	while (c->tail) {
+		tl_cache_drop(c, c->tail);
+	}
+	free(c->buckets);
+	free(c);
+}
+
+static inline int
+timeline_cache(struct timeline *tl, size_t max_bytes)
+{
+	struct tl_cache *c;
+
+	if (tl->cache) {
+		return 0;
+	}
+
+	if (max_bytes == 0) {
+		const char *env = getenv("TL_CACHE_MB");
+
+		max_bytes = (env ? (size_t)atol(env) : TL_CACHE_MB) << 20;
+	}
+
+	c = calloc(1, sizeof(struct tl_cache));
+	if (!c) {
+		goto cmalloc_failed;
+	}
+
+	c->nbuckets = 256;
+	c->buckets = calloc(c->nbuckets, sizeof(struct tl_centry *));
+	if (!c->buckets) {
+		goto buckets_malloc_failed;
+	}
+	c->max_bytes = max_bytes;
+
+	tl->cache = c;
+
+	return 0;
+
+buckets_malloc_failed:
+	free(c);
+
+cmalloc_failed:
+	return -1;
+}
+
+/*
+ * notes are cut where they stay under db dBFS (0 - $TL_CULL_DB or
+ * TL_CULL_DB), -inf renders them to the end
+ */
+static inline void
+timeline_cull(struct timeline *tl, double db)
+{
+	if (db == 0.0) {
+		const char *env = getenv("TL_CULL_DB");
+
+		db = env ? atof(env) : TL_CULL_DB;
+	}
+
+	tl->cull = pow(10.0, db / 20.0);
+}
+
+/*
+ * audible() of a note under amp * exp(-rate * sample): samples until
+ * that drops below level
+ */
+static inline size_t
+tl_decay_audible(const struct tl_event *ev, double amp, double rate,
+	double level)
+{
+	double t;
+
+	if (level <= 0.0) {
+		return ev->len;
+	}
+	if (amp <= level) {
+		return 0;
+	}
+
+	t = ceil(log(amp / level) / rate);
+
+	return t < ev->len ? (size_t)t : ev->len;
+}
+
+static inline struct timeline *
+timeline_init(size_t n)
+{
+	struct timeline *t;
+	size_t npages = (n + TL_PAGE - 1) / TL_PAGE;
+
+	t = calloc(1, sizeof(struct timeline));
+	if (!t) {
+		goto tmalloc_failed;
+	}
+
+	if (tl_plane_grow(&t->mono, npages) != 0) {
+		goto mono_malloc_failed;
+	}
+
+	t->n = npages * TL_PAGE;
+	t->end = 0;
+	t->stream = NULL;
+	t->fd = fileno(stdout);
+	t->win_end = SIZE_MAX;
+	timeline_cull(t, 0);
+
+	return t;
+
+mono_malloc_failed:
+	free(t);
+
+tmalloc_failed:
+	return NULL;
+}
+
+static inline struct timeline *
+timeline_stream_init(void)
+{
+	struct timeline *t;
+
+	t = calloc(1, sizeof(struct timeline));
+	if (!t) {
+		goto tmalloc_failed;
+	}
+
+	t->stream = calloc(1, sizeof(struct tl_stream));
+	if (!t->stream) {
+		goto stream_malloc_failed;
+	}
+
+	fflush(stdout);
+	t->fd = fileno(stdout);
+	pcm_writer_init(&t->stream->out, t->fd);
+
+	t->n = t->end = 0;
+	t->win_end = SIZE_MAX;
+	timeline_cull(t, 0);
+
+	return t;
+
+stream_malloc_failed:
+	free(t);
+
+tmalloc_failed:
+	return NULL;
+}
+
+/* write PCM to fd instead of stdout, before anything is written */
+static inline void
+timeline_output(struct timeline *tl, int fd)
+{
+	tl->fd = fd;
+	if (tl->stream) {
+		pcm_writer_init(&tl->stream->out, fd);
+	}
+}
+
+/*
+ * first frame of step number step on a grid of per_min steps a minute,
+ * rate frames a second. Exact and rounded to the nearest frame, scores
+ * counting in steps stay on the grid however long they are, where a
+ * position summed up in seconds drifts and truncates unevenly
+ */
+static inline size_t
+timeline_step(size_t step, unsigned rate, unsigned per_min)
+{
+	uint64_t num = (uint64_t)step * rate * 60;
+
+	return (num * 2 + per_min) / ((uint64_t)per_min * 2);
+}
+
+/* render and output only frames start .. end - 1, before notes are added */
+static inline void
+timeline_window(struct timeline *tl, size_t start, size_t end)
+{
+	tl->win_start = start;
+	tl->win_end = end ? end : SIZE_MAX;
+	if (tl->stream) {
+		tl->stream->pos = start;
+	}
+}
+
+/* offsets from .. to of the note inside the window, 1 if it is cut */
+static inline int
+tl_window_span(const struct timeline *tl, const struct tl_event *ev,
+	size_t *from, size_t *to)
+{
+	*from = ev->start < tl->win_start ? tl->win_start - ev->start : 0;
+	*to = ev->start + ev->len > tl->win_end ? tl->win_end - ev->start
+		: ev->len;
+
+	return (*from > 0) || (*to < ev->len);
+}
+
+/* end of the part that is written out */
+static inline size_t
+tl_window_end(const struct timeline *tl, size_t end)
+{
+	return end < tl->win_end ? end : tl->win_end;
+}
+
+static inline void
+tl_voice_release(struct tl_voice *v)
+{
+	if (v->cached) {
+		v->cached->pins--;
+		v->cached = NULL;
+		return;
+	}
+
+	if (v->ev.instr->release) {
+		v->ev.instr->release(v->state);
+	}
+	free(v->state);
+	v->state = NULL;
+}
+
+/* voice of a note, from the window start on and from the cache if it can */
+static inline int
+tl_voice_start(struct timeline *tl, struct tl_voice *v,
+	const struct tl_event *ev)
+{
+	size_t to;
+
+	v->ev = *ev;
+	v->state = NULL;
+	v->cached = NULL;
+
+	/* a note crossing the window start begins at the window */
+	if (!tl_window_span(tl, ev, &v->off, &to) && tl->cache) {
+		v->cached = tl_cache_get(tl->cache, ev);
+	}
+	if (v->cached) {
+		if (!v->cached->ready && (tl_cache_fill(v->cached, ev) != 0)) {
+			v->cached->pins--;
+			v->cached = NULL;
+			return -1;
+		}
+	} else if (ev->instr->voice_size) {
+		v->state = calloc(1, ev->instr->voice_size);
+		if (!v->state) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static inline void
+timeline_stats(const struct timeline *tl, FILE *f)
+{
+	const struct tl_cache *c = tl->cache;
+
+	if (c) {
+		fprintf(f, "note cache: %lu hits, %lu misses, %lu evicted, "
+			"%lu did not fit, %lu notes in %.1f MiB\n",
+			(unsigned long)c->hits, (unsigned long)c->misses,
+			(unsigned long)c->evictions, (unsigned long)c->bypassed,
+			(unsigned long)c->nentries, c->bytes / 1048576.0);
+	}
+
+	if (tl->culled_silent || tl->culled_short) {
+		fprintf(f, "culled: %lu silent notes, %lu cut short, "
+			"%lu samples not rendered (under %.0f dBFS)\n",
+			(unsigned long)tl->culled_silent,
+			(unsigned long)tl->culled_short,
+			(unsigned long)tl->culled_samples,
+			20.0 * log10(tl->cull));
+	}
+}
+
+static inline void
+timeline_free(struct timeline *tl)
+{
+	if (getenv("TL_STATS")) {
+		timeline_stats(tl, stderr);
+	}
+
+	if (tl->stream) {
+		struct tl_stream *st = tl->stream;
+		size_t i;
+
+		for (i=0; i<st->nactive; i++) {
+			tl_voice_release(&st->active[i]);
+		}
+		free(st->active);
+		free(st->pending);
+		free(st);
+	}
+	free(tl->events);
+	free(tl->instances);
+	if (tl->cache) {
+		tl_cache_free(tl->cache);
+	}
+
+	tl_plane_free(&tl->mono);
+	tl_plane_free(&tl->left);
+	tl_plane_free(&tl->right);
+
+	tl->n = tl->end = 0;
+
+	free(tl);
+}
+
+/* constant power gains of a panned note, gl^2 + gr^2 = 2 loudness^2 */
+static inline void
+tl_pan(const struct tl_event *ev, float *gl, float *gr)
+{
+	double pan = ev->pan < -1.0 ? -1.0 : ev->pan > 1.0 ? 1.0 : ev->pan;
+	double a = (pan + 1.0) * M_PI / 4.0;
+
+	*gl = ev->loudness * M_SQRT2 * cos(a);
+	*gr = ev->loudness * M_SQRT2 * sin(a);
+}
+
+/* mix n samples of the note from offset off into the mono bus or sides */
+static inline int
+tl_note_mix(struct timeline *tl, const struct tl_event *ev, size_t off,
+	const float *src, size_t n)
+{
+	float gl, gr;
+
+	if (ev->pan == 0.0) {
+		return tl_plane_mix(&tl->mono, ev->start + off, src,
+			ev->loudness, n);
+	}
+
+	tl_pan(ev, &gl, &gr);
+	if (tl_plane_mix(&tl->left, ev->start + off, src, gl, n) != 0) {
+		return -1;
+	}
+
+	return tl_plane_mix(&tl->right, ev->start + off, src, gr, n);
+}
+
+/* render offsets from .. to of the note into the planes */
+static inline int
+tl_render_span(struct timeline *tl, const struct tl_event *ev, void *state,
+	float *buf, size_t from, size_t to)
+{
+	size_t off;
+
+	for (off=from; off<to; off+=TL_BLOCK) {
+		size_t n = to - off;
+
+		if (n > TL_BLOCK) {
+			n = TL_BLOCK;
+		}
+
+		ev->instr->render(ev, state, buf, off, n);
+
+		if (tl_note_mix(tl, ev, off, buf, n) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* mix offsets from .. to of a cached note into the planes */
+static inline int
+tl_mix_cached(struct timeline *tl, const struct tl_event *ev,
+	const struct tl_centry *e, size_t from, size_t to)
+{
+	return tl_note_mix(tl, ev, from, e->data + from, to - from);
+}
+
+static inline void
+timeline_threads(struct timeline *tl, int nthreads)
+{
+	if (tl->stream) {
+		return;
+	}
+
+	if (nthreads <= 0) {
+		const char *env = getenv("TL_THREADS");
+
+		nthreads = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads <= 0) {
+			nthreads = 1;
+		}
+	}
+
+	tl->nthreads = nthreads;
+}
+
+/* the piece lasts at least until end */
+static inline void
+tl_extend(struct timeline *tl, size_t end)
+{
+	struct tl_stream *st = tl->stream;
+
+	if (st && (end > st->end)) {
+		st->end = end;
+	} else if (!st && (end > tl->end)) {
+		tl->end = end;
+	}
+}
+
+/*
+ * the part of a note to render, NULL if there is none: silent notes and
+ * inaudible tails are culled (the tail cut off into cut), notes outside
+ * the window dropped. The piece keeps its length
+ */
+static inline const struct tl_event *
+tl_admit(struct timeline *tl, const struct tl_event *ev, struct tl_event *cut)
+{
+	if (ev->len == 0) {
+		return NULL;
+	}
+
+	/* silent notes and their inaudible tails are not rendered */
+	if (ev->loudness == 0.0) {
+		tl->culled_silent++;
+		tl->culled_samples += ev->len;
+		tl_extend(tl, ev->start + ev->len);
+		return NULL;
+	}
+	if (ev->instr->audible) {
+		size_t len = ev->instr->audible(ev,
+			tl->cull / fabs(ev->loudness));
+
+		if (len < ev->len) {
+			tl->culled_short++;
+			tl->culled_samples += ev->len - len;
+			tl_extend(tl, ev->start + ev->len);
+
+			*cut = *ev;
+			cut->len = len;
+			ev = cut;
+			if (len == 0) {
+				return NULL;
+			}
+		}
+	}
+
+	/* outside the window, only the length of the piece counts */
+	if ((ev->start + ev->len <= tl->win_start)
+		|| (ev->start >= tl->win_end)) {
+
+		tl_extend(tl, ev->start + ev->len);
+		return NULL;
+	}
+
+	return ev;
+}
+
+static inline int
+tl_defer(struct timeline *tl, const struct tl_event *ev)
+{
+	if (tl->nevents == tl->events_size) {
+		size_t size = tl->events_size ? tl->events_size * 2 : 1024;
+		struct tl_event *e;
+
+		e = realloc(tl->events, size * sizeof(struct tl_event));
+		if (!e) {
+			return -1;
+		}
+		tl->events = e;
+		tl->events_size = size;
+	}
+
+	tl->events[tl->nevents++] = *ev;
+
+	if (ev->start + ev->len > tl->end) {
+		tl->end = ev->start + ev->len;
+	}
+
+	return 0;
+}
+
+/* next task for a worker, ntasks when there is nothing left to do */
+static inline size_t
+tl_job_next(struct tl_job *job)
+{
+	size_t s;
+
+	pthread_mutex_lock(&job->lock);
+	s = job->next++;
+	if (job->rc != 0) {
+		s = job->ntasks;
+	}
+	pthread_mutex_unlock(&job->lock);
+
+	return s;
+}
+
+static inline void
+tl_job_fail(struct tl_job *job)
+{
+	pthread_mutex_lock(&job->lock);
+	job->rc = -1;
+	pthread_mutex_unlock(&job->lock);
+}
+
+/* run ntasks tasks on up to tl->nthreads threads */
+static inline void
+tl_job_run(struct tl_job *job, size_t ntasks, void *(*worker)(void *))
+{
+	pthread_t *th;
+	int nth, started, i;
+
+	job->next = 0;
+	job->ntasks = ntasks;
+
+	nth = job->tl->nthreads;
+	if ((size_t)nth > ntasks) {
+		nth = ntasks ? ntasks : 1;
+	}
+
+	th = malloc(nth * sizeof(pthread_t));
+	started = 0;
+	if (th) {
+		for (; started<nth; started++) {
+			if (pthread_create(&th[started], NULL, worker,
+				job) != 0) {
+
+				break;
+			}
+		}
+	}
+	if (started == 0) {
+		/* no threads, do it here */
+		worker(job);
+	}
+	for (i=0; i<started; i++) {
+		pthread_join(th[i], NULL);
+	}
+
+	free(th);
+}
+
+/* render notes missing in the cache */
+static inline void *
+tl_fill_worker(void *arg)
+{
+	struct tl_job *job = arg;
+	unsigned long fp = tl_fp_enter();
+	size_t s;
+
+	while ((s = tl_job_next(job)) < job->ntasks) {
+		if (tl_cache_fill(job->fill[s],
+			&job->tl->events[job->fill_ev[s]]) != 0) {
+
+			tl_job_fail(job);
+		}
+	}
+
+	tl_fp_leave(fp);
+	return NULL;
+}
+
+static inline void *
+tl_worker(void *arg)
+{
+	struct tl_job *job = arg;
+	struct timeline *tl = job->tl;
+	float buf[TL_BLOCK];
+	unsigned long fp;
+	void *state;
+	size_t s;
+
+	state = malloc(job->voice_size ? job->voice_size : 1);
+	if (!state) {
+		tl_job_fail(job);
+		return NULL;
+	}
+
+	fp = tl_fp_enter();
+
+	while ((s = tl_job_next(job)) < job->ntasks) {
+		struct tl_slice *sl = &job->slices[s];
+		size_t s0, s1, i;
+
+		s0 = s * TL_PAGE;
+		s1 = s0 + TL_PAGE;
+		if (s0 < tl->win_start) {
+			s0 = tl->win_start;
+		}
+		s1 = tl_window_end(tl, s1);
+
+		for (i=0; i<sl->n; i++) {
+			const struct tl_event *ev = &tl->events[sl->ev[i]];
+			const struct tl_centry *e = NULL;
+			size_t from, to;
+			int rc;
+
+			from = ev->start < s0 ? s0 - ev->start : 0;
+			to = ev->start + ev->len > s1 ? s1 - ev->start : ev->len;
+
+			if (job->cached) {
+				e = job->cached[sl->ev[i]];
+			}
+
+			if (e) {
+				rc = tl_mix_cached(tl, ev, e, from, to);
+			} else {
+				memset(state, 0, ev->instr->voice_size);
+				rc = tl_render_span(tl, ev, state, buf,
+					from, to);
+				if (ev->instr->release) {
+					ev->instr->release(state);
+				}
+			}
+
+			if (rc != 0) {
+				tl_job_fail(job);
+				break;
+			}
+		}
+	}
+
+	tl_fp_leave(fp);
+	free(state);
+	return NULL;
+}
+
+/* look recorded notes up in the cache, new entries are rendered later */
+static inline int
+tl_defer_cached(struct timeline *tl, struct tl_job *job)
+{
+	size_t i;
+
+	job->cached = calloc(tl->nevents, sizeof(struct tl_centry *));
+	job->fill = malloc(tl->nevents * sizeof(struct tl_centry *));
+	job->fill_ev = malloc(tl->nevents * sizeof(size_t));
+	if (!job->cached || !job->fill || !job->fill_ev) {
+		return -1;
+	}
+
+	for (i=0; i<tl->nevents; i++) {
+		struct tl_centry *e;
+		size_t from, to;
+
+		if (tl_window_span(tl, &tl->events[i], &from, &to)) {
+			continue;
+		}
+		e = tl_cache_get(tl->cache, &tl->events[i]);
+		if (e && !e->ready && (e->pins == 1)) {
+			job->fill[job->nfill] = e;
+			job->fill_ev[job->nfill++] = i;
+		}
+		job->cached[i] = e;
+	}
+
+	return 0;
+}
+
+/* render recorded notes */
+static inline int
+tl_render_deferred(struct timeline *tl)
+{
+	struct tl_job job;
+	size_t i, s;
+	int rc;
+
+	memset(&job, 0, sizeof(job));
+	job.tl = tl;
+	job.nslices = (tl_window_end(tl, tl->end) + TL_PAGE - 1) / TL_PAGE;
+
+	/* page tables must not move under the threads */
+	if ((tl_plane_grow(&tl->mono, job.nslices) != 0)
+		|| (tl_plane_grow(&tl->left, job.nslices) != 0)
+		|| (tl_plane_grow(&tl->right, job.nslices) != 0)) {
+
+		return -1;
+	}
+	tl->n = tl->mono.npages * TL_PAGE;
+
+	job.slices = calloc(job.nslices ? job.nslices : 1,
+		sizeof(struct tl_slice));
+	if (!job.slices) {
+		return -1;
+	}
+
+	rc = 0;
+	for (i=0; (i<tl->nevents) && (rc == 0); i++) {
+		const struct tl_event *ev = &tl->events[i];
+		size_t first, last, from, to;
+
+		tl_window_span(tl, ev, &from, &to);
+		first = (ev->start + from) / TL_PAGE;
+		last = (ev->start + to - 1) / TL_PAGE;
+
+		if (ev->instr->voice_size > job.voice_size) {
+			job.voice_size = ev->instr->voice_size;
+		}
+
+		for (s=first; s<=last; s++) {
+			struct tl_slice *sl = &job.slices[s];
+
+			if (sl->n == sl->size) {
+				size_t size = sl->size ? sl->size * 2 : 16;
+				size_t *p;
+
+				p = realloc(sl->ev, size * sizeof(size_t));
+				if (!p) {
+					rc = -1;
+					break;
+				}
+				sl->ev = p;
+				sl->size = size;
+			}
+			sl->ev[sl->n++] = i;
+		}
+	}
+
+	if ((rc == 0) && tl->cache) {
+		rc = tl_defer_cached(tl, &job);
+	}
+
+	if (rc == 0) {
+		pthread_mutex_init(&job.lock, NULL);
+
+		/* every distinct note once, then the slices */
+		if (job.nfill > 0) {
+			tl_job_run(&job, job.nfill, &tl_fill_worker);
+		}
+		if (job.rc == 0) {
+			tl_job_run(&job, job.nslices, &tl_worker);
+		}
+
+		pthread_mutex_destroy(&job.lock);
+		rc = job.rc;
+	}
+
+	if (job.cached) {
+		for (i=0; i<tl->nevents; i++) {
+			if (job.cached[i]) {
+				job.cached[i]->pins--;
+			}
+		}
+	}
+	free(job.cached);
+	free(job.fill);
+	free(job.fill_ev);
+
+	for (s=0; s<job.nslices; s++) {
+		free(job.slices[s].ev);
+	}
+	free(job.slices);
+
+	free(tl->events);
+	tl->events = NULL;
+	tl->nevents = tl->events_size = 0;
+
+	return rc;
+}
+
+static int
+tl_start_cmp(const void *a, const void *b)
+{
+	const struct tl_start *x = a, *y = b;
+
+	if (x->start != y->start) {
+		return x->start < y->start ? -1 : 1;
+	}
+	return x->ev < y->ev ? -1 : x->ev > y->ev;
+}
+
+/* start a voice for note ev, voices go in by seq */
+static inline int
+tl_sched_voice(struct timeline *tl, struct tl_voice **active, size_t *nactive,
+	size_t *active_size, const struct tl_event *ev, size_t seq)
+{
+	struct tl_voice *a = *active;
+	size_t j = *nactive;
+
+	if (*nactive == *active_size) {
+		size_t size = *active_size ? *active_size * 2 : 64;
+
+		a = realloc(a, size * sizeof(struct tl_voice));
+		if (!a) {
+			return -1;
+		}
+		*active = a;
+		*active_size = size;
+	}
+
+	while ((j > 0) && (a[j - 1].seq > seq)) {
+		j--;
+	}
+	memmove(a + j + 1, a + j, (*nactive - j) * sizeof(struct tl_voice));
+	if (tl_voice_start(tl, &a[j], ev) != 0) {
+		memmove(a + j, a + j + 1,
+			(*nactive - j) * sizeof(struct tl_voice));
+		return -1;
+	}
+	a[j].seq = seq;
+	(*nactive)++;
+
+	return 0;
+}
+
+/*
+ * render the notes of src on this thread block by block: a note starts
+ * when the sweep gets to it, every sounding voice mixes its part into
+ * one TL_BLOCK bus which stays in L1 and the bus goes into the pages
+ * once
+ */
+static inline int
+tl_sweep(struct timeline *tl, const struct tl_source *src)
+{
+	float mono[TL_BLOCK], left[TL_BLOCK], right[TL_BLOCK];
+	struct tl_voice *active = NULL;
+	size_t nactive = 0, active_size = 0;
+	size_t next, pos, stop, i, j;
+	unsigned long fp;
+	int rc = 0;
+
+	fp = tl_fp_enter();
+
+	stop = tl_window_end(tl, tl->end);
+	pos = tl->win_start & ~(size_t)(TL_BLOCK - 1);
+	next = 0;
+	while ((rc == 0) && (pos < stop)
+		&& ((next < src->n) || (nactive > 0))) {
+
+		size_t bend, n;
+		int sides = 0;
+
+		/* nothing sounds until the next note */
+		if (nactive == 0) {
+			size_t start = src->start(src->arg, next);
+
+			if (start >= pos + TL_BLOCK) {
+				pos = start & ~(size_t)(TL_BLOCK - 1);
+				continue;
+			}
+		}
+		bend = pos + TL_BLOCK < stop ? pos + TL_BLOCK : stop;
+
+		while ((next < src->n) && (src->start(src->arg, next) < bend)) {
+			struct tl_event ev, cut;
+			const struct tl_event *e = &ev;
+			size_t seq, from, to;
+
+			if (src->event(src->arg, next, &ev, &seq) != 0) {
+				rc = -1;
+				break;
+			}
+			next++;
+
+			if (src->admit) {
+				e = tl_admit(tl, &ev, &cut);
+				if (!e) {
+					continue;
+				}
+			}
+
+			/* out of order, it would land outside the bus */
+			tl_window_span(tl, e, &from, &to);
+			if ((e->start + from < pos) || (e->start + from >= bend)) {
+				rc = -1;
+				break;
+			}
+
+			if (tl_sched_voice(tl, &active, &nactive, &active_size,
+				e, seq) != 0) {
+
+				rc = -1;
+				break;
+			}
+		}
+		if (rc != 0) {
+			break;
+		}
+
+		memset(mono, 0, sizeof(mono));
+		for (i=0, j=0; i<nactive; i++) {
+			struct tl_voice *v = &active[i];
+			const float *src;
+			size_t from;
+
+			from = v->ev.start + v->off;
+			n = v->ev.len - v->off;
+			if (from + n > bend) {
+				n = bend - from;
+			}
+
+			if (v->cached) {
+				src = v->cached->data + v->off;
+			} else {
+				v->ev.instr->render(&v->ev, v->state,
+					tl->scratch, v->off, n);
+				src = tl->scratch;
+			}
+
+			if (v->ev.pan == 0.0) {
+				tl_mix(mono + (from - pos), src, v->ev.loudness,
+					n);
+			} else {
+				float gl, gr;
+
+				if (!sides) {
+					memset(left, 0, sizeof(left));
+					memset(right, 0, sizeof(right));
+					sides = 1;
+				}
+
+				tl_pan(&v->ev, &gl, &gr);
+				tl_mix(left + (from - pos), src, gl, n);
+				tl_mix(right + (from - pos), src, gr, n);
+			}
+
+			v->off += n;
+			if (v->off == v->ev.len) {
+				tl_voice_release(v);
+			} else {
+				active[j++] = *v;
+			}
+		}
+		nactive = j;
+
+		n = bend - pos;
+		if (tl_plane_mix(&tl->mono, pos, mono, 1.0f, n) != 0) {
+			rc = -1;
+		} else if (sides
+			&& ((tl_plane_mix(&tl->left, pos, left, 1.0f, n) != 0)
+			|| (tl_plane_mix(&tl->right, pos, right, 1.0f, n)
+				!= 0))) {
+
+			rc = -1;
+		}
+		pos = bend;
+	}
+
+	tl_fp_leave(fp);
+
+	for (i=0; i<nactive; i++) {
+		tl_voice_release(&active[i]);
+	}
+	free(active);
+
+	if (tl->mono.npages * TL_PAGE > tl->n) {
+		tl->n = tl->mono.npages * TL_PAGE;
+	}
+
+	return rc;
+}
+
+/* recorded events in order of start */
+struct tl_recorded
+{
+	const struct tl_event *events;
+	const struct tl_start *order;
+};
+
+static size_t
+tl_recorded_start(const void *arg, size_t i)
+{
+	const struct tl_recorded *r = arg;
+
+	return r->order[i].start;
+}
+
+static int
+tl_recorded_event(const void *arg, size_t i, struct tl_event *ev,
+	size_t *seq)
+{
+	const struct tl_recorded *r = arg;
+
+	*seq = r->order[i].ev;
+	*ev = r->events[*seq];
+
+	return 0;
+}
+
+/*
+ * render recorded notes on this thread with the scheduler, voices mix in
+ * the order notes were added, as the slices do
+ */
+static inline int
+tl_render_scheduled(struct timeline *tl)
+{
+	struct tl_recorded rec;
+	struct tl_source src;
+	struct tl_start *order;
+	size_t i;
+	int rc;
+
+	order = malloc(tl->nevents * sizeof(struct tl_start));
+	if (!order) {
+		return -1;
+	}
+	for (i=0; i<tl->nevents; i++) {
+		order[i].start = tl->events[i].start;
+		order[i].ev = i;
+	}
+	qsort(order, tl->nevents, sizeof(struct tl_start), &tl_start_cmp);
+
+	rec.events = tl->events;
+	rec.order = order;
+	memset(&src, 0, sizeof(src));
+	src.n = tl->nevents;
+	src.end = tl->end;
+	src.start = &tl_recorded_start;
+	src.event = &tl_recorded_event;
+	src.arg = &rec;
+
+	rc = tl_sweep(tl, &src);
+
+	free(order);
+	free(tl->events);
+	tl->events = NULL;
+	tl->nevents = tl->events_size = 0;
+
+	return rc;
+}
+
+static inline int tl_render_events(struct timeline *tl);
+
+/* render what was added since the last time, if anything */
+static inline int
+tl_render_pending(struct timeline *tl)
+{
+	if ((tl->nevents == 0) && !tl->source && (tl->ninstances == 0)) {
+		return 0;
+	}
+
+	return tl_render_events(tl);
+}
+
+/* plane of a clip mixed in at start with gain, the part in the window */
+static inline int
+tl_clip_mix(struct timeline *tl, struct tl_plane *dst,
+	const struct tl_plane *src, size_t start, float gain, size_t len)
+{
+	size_t t, to;
+
+	t = start < tl->win_start ? tl->win_start - start : 0;
+	to = tl_window_end(tl, start + len);
+	to = to > start ? to - start : 0;
+
+	while (t < to) {
+		size_t page = t >> TL_PAGE_BITS;
+		size_t off = t & (TL_PAGE - 1);
+		size_t n = TL_PAGE - off;
+		const float *p = tl_plane_page(src, page);
+
+		if (n > to - t) {
+			n = to - t;
+		}
+		/* silent pages of the clip are skipped */
+		if (p && (tl_plane_mix(dst, start + t, p + off, gain, n)
+			!= 0)) {
+
+			return -1;
+		}
+		t += n;
+	}
+
+	return 0;
+}
+
+/* placed clips, each rendered the first time it is needed */
+static inline int
+tl_render_instances(struct timeline *tl)
+{
+	unsigned long fp;
+	size_t i;
+	int rc = 0;
+
+	fp = tl_fp_enter();
+	for (i=0; (i<tl->ninstances) && (rc == 0); i++) {
+		const struct tl_instance *in = &tl->instances[i];
+		struct timeline *clip = in->clip;
+
+		rc = tl_render_pending(clip);
+		if ((rc != 0) || (in->gain == 0.0f)) {
+			continue;
+		}
+
+		tl_extend(tl, in->start + clip->end);
+		if ((tl_clip_mix(tl, &tl->mono, &clip->mono, in->start,
+			in->gain, clip->end) != 0)
+			|| (tl_clip_mix(tl, &tl->left, &clip->left, in->start,
+			in->gain, clip->end) != 0)
+			|| (tl_clip_mix(tl, &tl->right, &clip->right, in->start,
+			in->gain, clip->end) != 0)) {
+
+			rc = -1;
+		}
+	}
+	tl_fp_leave(fp);
+
+	free(tl->instances);
+	tl->instances = NULL;
+	tl->ninstances = tl->instances_size = 0;
+
+	return rc;
+}
+
+/*
+ * render recorded notes, on threads if timeline_threads() asked for it,
+ * then the source and the clips
+ */
+static inline int
+tl_render_events(struct timeline *tl)
+{
+	const struct tl_source *src = tl->source;
+	int rc = 0;
+
+	if (tl->nevents > 0) {
+		if (tl->nthreads > 0) {
+			rc = tl_render_deferred(tl);
+		} else {
+			rc = tl_render_scheduled(tl);
+		}
+	}
+
+	tl->source = NULL;
+	if ((rc == 0) && src && (src->n > 0)) {
+		rc = tl_sweep(tl, src);
+	}
+
+	if ((rc == 0) && (tl->ninstances > 0)) {
+		rc = tl_render_instances(tl);
+	}
+
+	return rc;
+}
+
+/*
+ * render the notes of src as well when output starts, read in place
+ * through src which has to be there until then. In-memory timelines
+ * only, these notes go through the scheduler on one thread whatever
+ * timeline_threads() says
+ */
+static inline int
+timeline_source(struct timeline *tl, const struct tl_source *src)
+{
+	if (tl->stream || tl->source) {
+		return -1;
+	}
+
+	tl->source = src;
+	tl_extend(tl, src->end);
+
+	return 0;
+}
+
+static inline int
+tl_pending_less(const struct tl_pending *a, const struct tl_pending *b)
+{
+	if (a->ev.start != b->ev.start) {
+		return a->ev.start < b->ev.start;
+	}
+	return a->seq < b->seq;
+}
+
+static inline int
+tl_pending_push(struct tl_stream *st, const struct tl_event *ev)
+{
+	size_t i;
+
+	if (st->npending == st->pending_size) {
+		size_t size = st->pending_size ? st->pending_size * 2 : 256;
+		struct tl_pending *p;
+
+		p = realloc(st->pending, size * sizeof(struct tl_pending));
+		if (!p) {
+			return -1;
+		}
+		st->pending = p;
+		st->pending_size = size;
+	}
+
+	i = st->npending++;
+	st->pending[i].ev = *ev;
+	st->pending[i].seq = st->seq++;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		struct tl_pending tmp;
+
+		if (!tl_pending_less(&st->pending[i], &st->pending[parent])) {
+			break;
+		}
+		tmp = st->pending[i];
+		st->pending[i] = st->pending[parent];
+		st->pending[parent] = tmp;
+		i = parent;
+	}
+
+	return 0;
+}
+
+static inline void
+tl_pending_pop(struct tl_stream *st, struct tl_event *ev)
+{
+	size_t i = 0;
+
+	*ev = st->pending[0].ev;
+	st->pending[0] = st->pending[--st->npending];
+
+	for (;;) {
+		size_t l = i * 2 + 1, r = l + 1, m = i;
+		struct tl_pending tmp;
+
+		if ((l < st->npending)
+			&& tl_pending_less(&st->pending[l], &st->pending[m])) {
+			m = l;
+		}
+		if ((r < st->npending)
+			&& tl_pending_less(&st->pending[r], &st->pending[m])) {
+			m = r;
+		}
+		if (m == i) {
+			break;
+		}
+		tmp = st->pending[i];
+		st->pending[i] = st->pending[m];
+		st->pending[m] = tmp;
+		i = m;
+	}
+}
+
+static inline int
+tl_activate(struct timeline *tl, const struct tl_event *ev)
+{
+	struct tl_stream *st = tl->stream;
+	struct tl_voice *v;
+
+	if (st->nactive == st->active_size) {
+		size_t size = st->active_size ? st->active_size * 2 : 64;
+		struct tl_voice *a;
+
+		a = realloc(st->active, size * sizeof(struct tl_voice));
+		if (!a) {
+			return -1;
+		}
+		st->active = a;
+		st->active_size = size;
+	}
+
+	v = &st->active[st->nactive];
+	if (tl_voice_start(tl, v, ev) != 0) {
+		return -1;
+	}
+	st->nactive++;
+
+	/* the head of a late note is already gone, run it silently */
+	while ((v->ev.start + v->off < st->pos) && (v->off < v->ev.len)) {
+		size_t n = st->pos - (v->ev.start + v->off);
+
+		if (n > v->ev.len - v->off) {
+			n = v->ev.len - v->off;
+		}
+		if (v->cached) {
+			v->off += n;
+			continue;
+		}
+		if (n > TL_BLOCK) {
+			n = TL_BLOCK;
+		}
+		ev->instr->render(&v->ev, v->state, tl->scratch, v->off, n);
+		v->off += n;
+	}
+
+	/* nothing of it left */
+	if (v->off == v->ev.len) {
+		tl_voice_release(v);
+		st->nactive--;
+	}
+
+	return 0;
+}
+
+/* write n frames of a ring slot, the sides go on top of the mono bus */
+static inline int
+tl_stream_put(struct tl_stream *st, size_t slot, size_t n)
+{
+	if (!st->sides[slot]) {
+		return pcm_writer_put(&st->out, st->mono[slot],
+			st->mono[slot], n);
+	}
+
+	tl_bus_side(st->left[slot], st->mono[slot], st->left[slot], n);
+	tl_bus_side(st->right[slot], st->mono[slot], st->right[slot], n);
+
+	return pcm_writer_put(&st->out, st->left[slot], st->right[slot], n);
+}
+
+static inline int
+tl_stream_drain(struct timeline *tl)
+{
+	struct tl_stream *st = tl->stream;
+
+	while (st->ring_used > 0) {
+		if (tl_stream_put(st, st->ring_head, TL_BLOCK) != 0) {
+			return -1;
+		}
+		st->ring_head = (st->ring_head + 1) % TL_RING_BLOCKS;
+		st->ring_used--;
+	}
+
+	return pcm_writer_flush(&st->out);
+}
+
+/* render frames pos .. pos + TL_BLOCK into the next ring slot */
+static inline int
+tl_stream_block(struct timeline *tl)
+{
+	struct tl_stream *st = tl->stream;
+	size_t slot, bend, i, j;
+	float *mono;
+	unsigned long fp;
+
+	if (st->ring_used == TL_RING_BLOCKS) {
+		if (tl_stream_drain(tl) != 0) {
+			return -1;
+		}
+	}
+
+	fp = tl_fp_enter();
+
+	slot = (st->ring_head + st->ring_used) % TL_RING_BLOCKS;
+	mono = st->mono[slot];
+	memset(mono, 0, sizeof(float) * TL_BLOCK);
+	st->sides[slot] = 0;
+
+	bend = st->pos + TL_BLOCK;
+	while ((st->npending > 0) && (st->pending[0].ev.start < bend)) {
+		struct tl_event ev;
+
+		tl_pending_pop(st, &ev);
+		if (tl_activate(tl, &ev) != 0) {
+			tl_fp_leave(fp);
+			return -1;
+		}
+	}
+
+	for (i=0, j=0; i<st->nactive; i++) {
+		struct tl_voice *v = &st->active[i];
+		const float *src;
+		size_t from, n;
+
+		from = v->ev.start + v->off;
+		n = v->ev.len - v->off;
+		if (from + n > bend) {
+			n = bend - from;
+		}
+
+		if (v->cached) {
+			src = v->cached->data + v->off;
+		} else {
+			v->ev.instr->render(&v->ev, v->state, tl->scratch,
+				v->off, n);
+			src = tl->scratch;
+		}
+
+		if (v->ev.pan == 0.0) {
+			tl_mix(mono + (from - st->pos), src, v->ev.loudness, n);
+		} else {
+			float gl, gr;
+
+			if (!st->sides[slot]) {
+				memset(st->left[slot], 0,
+					sizeof(float) * TL_BLOCK);
+				memset(st->right[slot], 0,
+					sizeof(float) * TL_BLOCK);
+				st->sides[slot] = 1;
+			}
+
+			tl_pan(&v->ev, &gl, &gr);
+			tl_mix(st->left[slot] + (from - st->pos), src, gl, n);
+			tl_mix(st->right[slot] + (from - st->pos), src, gr, n);
+		}
+
+		v->off += n;
+		if (v->off == v->ev.len) {
+			tl_voice_release(v);
+		} else {
+			st->active[j++] = *v;
+		}
+	}
+	st->nactive = j;
+
+	st->pos = bend;
+	st->ring_used++;
+
+	tl_fp_leave(fp);
+	return 0;
+}
+
+/* render and write out everything that starts before t */
+static inline int
+timeline_flush_until(struct timeline *tl, size_t t)
+{
+	struct tl_stream *st = tl->stream;
+
+	if (!st) {
+		return 0;
+	}
+
+	t = tl_window_end(tl, t);
+	while (st->pos + TL_BLOCK <= t) {
+		if (tl_stream_block(tl) != 0) {
+			return -1;
+		}
+	}
+
+	return tl_stream_drain(tl);
+}
+
+static inline int
+timeline_add(struct timeline *tl, const struct tl_event *ev)
+{
+	struct tl_stream *st = tl->stream;
+	struct tl_event cut;
+
+	ev = tl_admit(tl, ev, &cut);
+	if (!ev) {
+		return 0;
+	}
+
+	if (!st) {
+		return tl_defer(tl, ev);
+	}
+
+	tl_extend(tl, ev->start + ev->len);
+
+	return tl_pending_push(st, ev);
+}
+
+/* note of a clip added at start with gain */
+static inline int
+tl_clip_note(struct timeline *tl, const struct tl_event *ev, size_t start,
+	double gain)
+{
+	struct tl_event e = *ev;
+
+	e.start += start;
+	e.loudness *= gain;
+
+	return timeline_add(tl, &e);
+}
+
+/* notes the clip holds added one by one, clips in it as well */
+static inline int
+tl_clip_notes(struct timeline *tl, const struct timeline *clip,
+	size_t start, double gain)
+{
+	const struct tl_source *src = clip->source;
+	struct tl_event ev;
+	size_t i, seq;
+
+	for (i=0; i<clip->nevents; i++) {
+		if (tl_clip_note(tl, &clip->events[i], start, gain) != 0) {
+			return -1;
+		}
+	}
+	for (i=0; src && (i<src->n); i++) {
+		if ((src->event(src->arg, i, &ev, &seq) != 0)
+			|| (tl_clip_note(tl, &ev, start, gain) != 0)) {
+
+			return -1;
+		}
+	}
+	for (i=0; i<clip->ninstances; i++) {
+		const struct tl_instance *in = &clip->instances[i];
+
+		if (tl_clip_notes(tl, in->clip, start + in->start,
+			gain * in->gain) != 0) {
+
+			return -1;
+		}
+	}
+	tl_extend(tl, start + clip->end);
+
+	return 0;
+}
+
+/*
+ * place clip at frame start with gain, see above. The clip has to be
+ * there until tl is rendered and must not hold tl, notes added to it
+ * before then play in every placement. In streaming mode its notes are
+ * taken right away, it must not have been rendered yet
+ */
+static inline int
+timeline_clip(struct timeline *tl, struct timeline *clip, size_t start,
+	double gain)
+{
+	struct tl_instance *in;
+
+	if ((clip == tl) || clip->stream) {
+		return -1;
+	}
+	if (tl->stream) {
+		return tl_clip_notes(tl, clip, start, gain);
+	}
+
+	if (tl->ninstances == tl->instances_size) {
+		size_t size = tl->instances_size ? tl->instances_size * 2 : 64;
+
+		in = realloc(tl->instances, size * sizeof(struct tl_instance));
+		if (!in) {
+			return -1;
+		}
+		tl->instances = in;
+		tl->instances_size = size;
+	}
+
+	in = &tl->instances[tl->ninstances++];
+	in->clip = clip;
+	in->start = start;
+	in->gain = gain;
+	tl_extend(tl, start + clip->end);
+
+	return 0;
+}
+
+/* write n frames of pages with panned notes, block by block */
+static inline int
+tl_put_sides(struct pcm_writer *w, const float *m, const float *l,
+	const float *r, size_t n)
+{
+	float bl[TL_BLOCK], br[TL_BLOCK];
+
+	while (n > 0) {
+		size_t chunk = n < TL_BLOCK ? n : TL_BLOCK;
+
+		tl_bus_side(bl, m, l, chunk);
+		tl_bus_side(br, m, r, chunk);
+		if (pcm_writer_put(w, bl, br, chunk) != 0) {
+			return -1;
+		}
+
+		m = m ? m + chunk : NULL;
+		l = l ? l + chunk : NULL;
+		r = r ? r + chunk : NULL;
+		n -= chunk;
+	}
+
+	return 0;
+}
+
+/* write the in-memory planes out, pages never touched are silence */
+static inline int
+tl_play_pages(struct timeline *tl)
+{
+	struct pcm_writer *w;
+	size_t t, n, stop;
+	int rc = 0;
+
+	w = malloc(sizeof(struct pcm_writer));
+	if (!w) {
+		return -1;
+	}
+
+	fflush(stdout);
+	pcm_writer_init(w, tl->fd);
+
+	stop = tl_window_end(tl, tl->end);
+	for (t=tl->win_start; (t < stop) && (rc == 0); t+=n) {
+		const float *m, *l, *r;
+		size_t page = t >> TL_PAGE_BITS;
+		size_t off = t & (TL_PAGE - 1);
+
+		n = TL_PAGE - off;
+		if (n > stop - t) {
+			n = stop - t;
+		}
+
+		m = tl_plane_page(&tl->mono, page);
+		l = tl_plane_page(&tl->left, page);
+		r = tl_plane_page(&tl->right, page);
+
+		if (!m && !l && !r) {
+			rc = pcm_writer_silence(w, n);
+		} else if (!l && !r) {
+			rc = pcm_writer_put(w, m + off, m + off, n);
+		} else {
+			rc = tl_put_sides(w, m ? m + off : NULL,
+				l ? l + off : NULL, r ? r + off : NULL, n);
+		}
+	}
+
+	if (rc == 0) {
+		rc = pcm_writer_flush(w);
+	}
+	free(w);
+
+	return rc;
+}
+
+/* frames in the piece so far */
+static inline size_t
+timeline_length(const struct timeline *tl)
+{
+	return tl->stream ? tl->stream->end : tl->end;
+}
+
+/*
+ * frames t .. t + n - 1 of an in-memory timeline as interleaved floats,
+ * for programs that play the piece themselves. Deferred notes are
+ * rendered on the first call
+ */
+static inline int
+timeline_read(struct timeline *tl, float *dst, size_t t, size_t n)
+{
+	if (tl->stream) {
+		return -1;
+	}
+	if (tl_render_pending(tl) != 0) {
+		return -1;
+	}
+
+	while (n > 0) {
+		size_t page = t >> TL_PAGE_BITS;
+		size_t off = t & (TL_PAGE - 1);
+		size_t i, chunk = TL_PAGE - off;
+		const float *m, *l, *r;
+
+		if (chunk > n) {
+			chunk = n;
+		}
+		m = tl_plane_page(&tl->mono, page);
+		l = tl_plane_page(&tl->left, page);
+		r = tl_plane_page(&tl->right, page);
+
+		for (i=0; i<chunk; i++) {
+			float c = m ? m[off + i] : 0.0f;
+
+			dst[i * 2 + 0] = l ? c + l[off + i] : c;
+			dst[i * 2 + 1] = r ? c + r[off + i] : c;
+		}
+
+		dst += chunk * 2;
+		t += chunk;
+		n -= chunk;
+	}
+
+	return 0;
+}
+
+static inline int
+timeline_play(struct timeline *tl)
+{
+	struct tl_stream *st = tl->stream;
+	size_t stop;
+
+	if (!st) {
+		if (tl_render_pending(tl) != 0) {
+			return -1;
+		}
+		return tl_play_pages(tl);
+	}
+
+	stop = tl_window_end(tl, st->end);
+	while (st->pos + TL_BLOCK <= stop) {
+		if (tl_stream_block(tl) != 0) {
+			return -1;
+		}
+	}
+	if (tl_stream_drain(tl) != 0) {
+		return -1;
+	}
+
+	/* last partial block */
+	if (st->pos < stop) {
+		if (tl_stream_block(tl) != 0) {
+			return -1;
+		}
+		if (tl_stream_put(st, st->ring_head,
+			stop - (st->pos - TL_BLOCK)) != 0) {
+
+			return -1;
+		}
+		st->ring_used = 0;
+		st->pos = stop;
+	}
+
+	return pcm_writer_flush(&st->out);
+}
+
+#endif